@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+/*
+ * Object churn. A client maps a batch of toplevels and disconnects, over
+ * and over, against a headless server; the pool counters show whether the
+ * slabs are reused. Then the allocation pattern is replayed on its own,
+ * with pool_zalloc() and with calloc() among unrelated heap allocations,
+ * to compare allocation latency early and late in the run and how much
+ * free space the heap is left with.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wlrston.h>
+#include <view.h>
+
+#include "client.h"
+#include "harness.h"
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define VIEW_WIDTH 64
+#define VIEW_HEIGHT 64
+#define LIVE_OBJECTS 4096 /* a power of two */
+/* allocations timed together, single ones are below the clock's resolution */
+#define BATCH 64
+#define NOISE_SLOTS 8192
+#define NOISE_MAX_SIZE 512
+
+static uint32_t rng_state = 0x2545f491;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/* Returns nsec per view mapped and destroyed, -1 on failure. */
+static int64_t churn_round(struct bench_harness *harness, int windows)
+{
+	struct bench_client_stats stats;
+	struct bench_client *client;
+	int64_t start = bench_now_nsec();
+	bool ok;
+
+	client = bench_harness_connect(harness, windows, VIEW_WIDTH,
+				       VIEW_HEIGHT, 0);
+	if (!client)
+		return -1;
+
+	ok = bench_harness_wait_views(harness, windows);
+	bench_client_stop(client, &stats);
+	/* the disconnect destroys every surface of the client */
+	if (!ok || stats.failed || !bench_harness_wait_views(harness, 0))
+		return -1;
+
+	return (bench_now_nsec() - start) / windows;
+}
+
+static int run_surfaces(int rounds, int windows)
+{
+	struct bench_harness harness = { 0 };
+	struct pool *views;
+	int64_t *samples;
+	size_t first_slabs = 0;
+	int i, ret = 1;
+
+	samples = calloc(rounds, sizeof(*samples));
+	if (!samples)
+		return 1;
+	if (!bench_harness_create(&harness))
+		goto out;
+	if (!bench_harness_start(&harness, 1, OUTPUT_WIDTH, OUTPUT_HEIGHT))
+		goto out_harness;
+
+	views = &harness.server->pools.views;
+	for (i = 0; i < rounds; i++) {
+		samples[i] = churn_round(&harness, windows);
+		if (samples[i] < 0)
+			goto out_harness;
+		if (i == 0)
+			first_slabs = views->n_slabs;
+	}
+	qsort(samples, rounds, sizeof(*samples), bench_compare_int64);
+
+	printf("  \"surfaces\": {\"rounds\": %d, \"windows\": %d, "
+	       "\"median_ns_per_view\": %" PRId64 ", \"max_ns_per_view\": %"
+	       PRId64 ", \"view_slabs_first_round\": %zu, \"view_slabs\": %zu, "
+	       "\"views_peak\": %zu, \"views_live\": %zu},\n", rounds, windows,
+	       samples[rounds / 2], samples[rounds - 1], first_slabs,
+	       views->n_slabs, views->peak, views->live);
+	ret = 0;
+
+out_harness:
+	bench_harness_destroy(&harness);
+out:
+	free(samples);
+	return ret;
+}
+
+struct alloc_run {
+	const char *name;
+	void *(*alloc)(void *data);
+	void (*free)(void *data, void *object);
+	void *data;
+};
+
+static void *pool_alloc_fn(void *data)
+{
+	return pool_zalloc(data);
+}
+
+static void pool_free_fn(void *data, void *object)
+{
+	pool_free(data, object);
+}
+
+static void *calloc_fn(void *data)
+{
+	return calloc(1, sizeof(struct wlrston_view));
+}
+
+static void calloc_free_fn(void *data, void *object)
+{
+	free(object);
+}
+
+static void report_samples(const char *name, int64_t *samples, int n)
+{
+	qsort(samples, n, sizeof(*samples), bench_compare_int64);
+	printf("\"%s_median_ns\": %" PRId64 ", \"%s_p99_ns\": %" PRId64 ", ",
+	       name, samples[n / 2], name, samples[n * 99 / 100]);
+}
+
+/*
+ * Replaces random live objects, BATCH at a time, while short and long lived
+ * allocations of other sizes come and go around it like the rest of the
+ * compositor's heap traffic.
+ */
+static int run_allocs(const struct alloc_run *run, int steps)
+{
+	void **live, **noise;
+	int64_t *samples, start;
+	int n_batches = steps / BATCH, i, j, ret = 1;
+	uint32_t slots[BATCH], base, stride;
+	size_t slot;
+
+	live = calloc(LIVE_OBJECTS, sizeof(*live));
+	noise = calloc(NOISE_SLOTS, sizeof(*noise));
+	samples = calloc(n_batches, sizeof(*samples));
+	if (!live || !noise || !samples || n_batches < 4)
+		goto out;
+
+	for (i = 0; i < LIVE_OBJECTS; i++)
+		live[i] = run->alloc(run->data);
+
+	for (i = 0; i < n_batches; i++) {
+		/* an odd stride visits BATCH distinct slots of the power of two */
+		base = rng();
+		stride = rng() | 1;
+		for (j = 0; j < BATCH; j++) {
+			slots[j] = (base + j * stride) % LIVE_OBJECTS;
+			run->free(run->data, live[slots[j]]);
+		}
+
+		start = bench_now_nsec();
+		for (j = 0; j < BATCH; j++)
+			live[slots[j]] = run->alloc(run->data);
+		samples[i] = (bench_now_nsec() - start) / BATCH;
+
+		for (j = 0; j < BATCH; j++) {
+			slot = rng() % NOISE_SLOTS;
+			free(noise[slot]);
+			noise[slot] = malloc(16 + rng() % NOISE_MAX_SIZE);
+		}
+	}
+
+	printf("    \"%s\": {", run->name);
+	/* first and last quarter, constant latency means they match */
+	report_samples("early", samples, n_batches / 4);
+	report_samples("late", samples + n_batches - n_batches / 4,
+		       n_batches / 4);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	{
+		struct mallinfo2 info = mallinfo2();
+
+		printf("\"heap_bytes\": %zu, \"heap_free_bytes\": %zu, ",
+		       info.arena, info.fordblks);
+	}
+#endif
+	printf("\"steps\": %d}", n_batches * BATCH);
+	ret = 0;
+
+	for (i = 0; i < LIVE_OBJECTS; i++)
+		run->free(run->data, live[i]);
+	for (i = 0; i < NOISE_SLOTS; i++)
+		free(noise[i]);
+out:
+	free(samples);
+	free(noise);
+	free(live);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	       "  -r, --rounds=N             client connections (default: 40)\n"
+	       "  -w, --windows=N            toplevels per connection (default: 100)\n"
+	       "  -s, --steps=N              replayed allocations (default: 1000000)\n"
+	       "  -h, --help                 show this help\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "rounds", required_argument, NULL, 'r' },
+		{ "windows", required_argument, NULL, 'w' },
+		{ "steps", required_argument, NULL, 's' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int rounds = 40, windows = 100, steps = 1000000;
+	struct pool pool;
+	struct alloc_run runs[] = {
+		{ "pool", pool_alloc_fn, pool_free_fn, &pool },
+		{ "calloc", calloc_fn, calloc_free_fn, NULL },
+	};
+	size_t i;
+	int ret = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "r:w:s:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'w':
+			windows = atoi(optarg);
+			break;
+		case 's':
+			steps = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+	if (rounds < 1 || windows < 1 || steps < 4 * BATCH) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	bench_harness_setup_env(false);
+
+	printf("{\n");
+	if (run_surfaces(rounds, windows) != 0)
+		return 1;
+
+	pool_init(&pool, "views", sizeof(struct wlrston_view));
+	printf("  \"allocs\": {\n");
+	for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		if (run_allocs(&runs[i], steps) != 0)
+			ret = 1;
+		printf("%s\n", i == sizeof(runs) / sizeof(runs[0]) - 1 ?
+		       "" : ",");
+	}
+	printf("  }\n}\n");
+	pool_finish(&pool);
+
+	return ret;
+}
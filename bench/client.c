@@ -0,0 +1,499 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include "config.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+
+#include "xdg-shell-client-protocol.h"
+#include "client.h"
+
+#define N_BUFFERS 2
+
+struct client_buffer {
+	struct bench_client *client;
+	struct wl_buffer *buffer;
+	uint32_t *data;
+	bool busy;
+};
+
+struct client_window {
+	struct bench_client *client;
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *toplevel;
+	bool configured;
+};
+
+struct bench_client {
+	pthread_t thread;
+	int fd, stop_fd;
+	int n_windows, width, height, rate;
+	struct bench_client_stats stats;
+
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+	struct wl_seat *seat;
+	struct wl_pointer *pointer;
+	struct wl_keyboard *keyboard;
+
+	struct client_window *windows;
+	int n_configured;
+
+	struct client_buffer buffers[N_BUFFERS];
+	void *shm_data;
+	size_t shm_size;
+	uint32_t frame;
+
+	/* frame paced */
+	struct wl_callback *frame_callback;
+	bool draw_pending; /* the frame came before a buffer was released */
+};
+
+static void noop() {}
+
+static void draw_frame(struct bench_client *client);
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct client_buffer *buffer = data;
+
+	buffer->busy = false;
+	if (buffer->client->draw_pending) {
+		buffer->client->draw_pending = false;
+		draw_frame(buffer->client);
+	}
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = buffer_release,
+};
+
+/* Input is delivered and parsed, but does not change what is drawn. */
+static const struct wl_pointer_listener pointer_listener = {
+	.enter = (void *)noop,
+	.leave = (void *)noop,
+	.motion = (void *)noop,
+	.button = (void *)noop,
+	.axis = (void *)noop,
+};
+
+static void keyboard_keymap(void *data, struct wl_keyboard *keyboard,
+			    uint32_t format, int32_t fd, uint32_t size)
+{
+	close(fd);
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+	.keymap = keyboard_keymap,
+	.enter = (void *)noop,
+	.leave = (void *)noop,
+	.key = (void *)noop,
+	.modifiers = (void *)noop,
+};
+
+static void seat_capabilities(void *data, struct wl_seat *seat, uint32_t caps)
+{
+	struct bench_client *client = data;
+
+	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !client->pointer) {
+		client->pointer = wl_seat_get_pointer(seat);
+		wl_pointer_add_listener(client->pointer, &pointer_listener, client);
+	}
+	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !client->keyboard) {
+		client->keyboard = wl_seat_get_keyboard(seat);
+		wl_keyboard_add_listener(client->keyboard, &keyboard_listener,
+					 client);
+	}
+}
+
+static const struct wl_seat_listener seat_listener = {
+	.capabilities = seat_capabilities,
+};
+
+static void wm_base_ping(void *data, struct xdg_wm_base *wm_base,
+			 uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = wm_base_ping,
+};
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+				  uint32_t serial)
+{
+	struct client_window *window = data;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+	window->client->stats.configures++;
+	if (!window->configured) {
+		window->configured = true;
+		window->client->n_configured++;
+	}
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = xdg_surface_configure,
+};
+
+/* The client keeps its size, whatever the compositor suggests. */
+static const struct xdg_toplevel_listener toplevel_listener = {
+	.configure = (void *)noop,
+	.close = (void *)noop,
+};
+
+static void registry_global(void *data, struct wl_registry *registry,
+			    uint32_t name, const char *interface,
+			    uint32_t version)
+{
+	struct bench_client *client = data;
+
+	if (strcmp(interface, "wl_compositor") == 0) {
+		client->compositor = wl_registry_bind(registry, name,
+						      &wl_compositor_interface, 4);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		client->shm = wl_registry_bind(registry, name,
+					       &wl_shm_interface, 1);
+	} else if (strcmp(interface, "xdg_wm_base") == 0) {
+		client->wm_base = wl_registry_bind(registry, name,
+						   &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(client->wm_base, &wm_base_listener,
+					 client);
+	} else if (strcmp(interface, "wl_seat") == 0 && !client->seat) {
+		client->seat = wl_registry_bind(registry, name,
+						&wl_seat_interface, 1);
+		wl_seat_add_listener(client->seat, &seat_listener, client);
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = registry_global,
+	.global_remove = (void *)noop,
+};
+
+static bool create_buffers(struct bench_client *client)
+{
+	struct wl_shm_pool *pool;
+	int stride = client->width * 4;
+	size_t size = (size_t)stride * client->height;
+	int fd, i;
+
+	fd = memfd_create("bench-client", MFD_CLOEXEC);
+	if (fd < 0)
+		return false;
+	client->shm_size = size * N_BUFFERS;
+	if (ftruncate(fd, client->shm_size) < 0) {
+		close(fd);
+		return false;
+	}
+	client->shm_data = mmap(NULL, client->shm_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+	if (client->shm_data == MAP_FAILED) {
+		client->shm_data = NULL;
+		close(fd);
+		return false;
+	}
+
+	pool = wl_shm_create_pool(client->shm, fd, client->shm_size);
+	for (i = 0; i < N_BUFFERS; i++) {
+		struct client_buffer *buffer = &client->buffers[i];
+
+		buffer->client = client;
+		buffer->data = (uint32_t *)((char *)client->shm_data + size * i);
+		buffer->buffer = wl_shm_pool_create_buffer(pool, size * i,
+							   client->width,
+							   client->height, stride,
+							   WL_SHM_FORMAT_ARGB8888);
+		wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+	}
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return true;
+}
+
+static void frame_done(void *data, struct wl_callback *callback,
+		       uint32_t time)
+{
+	struct bench_client *client = data;
+
+	wl_callback_destroy(callback);
+	client->frame_callback = NULL;
+	draw_frame(client);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+static void draw_frame(struct bench_client *client)
+{
+	struct client_buffer *buffer = NULL;
+	struct client_window *window;
+	uint32_t color;
+	size_t i, n;
+	int w;
+
+	for (i = 0; i < N_BUFFERS; i++) {
+		if (!client->buffers[i].busy) {
+			buffer = &client->buffers[i];
+			break;
+		}
+	}
+	if (!buffer) {
+		client->stats.skipped++;
+		client->draw_pending = client->rate == BENCH_CLIENT_FRAME_PACED;
+		return;
+	}
+
+	/* Translucent, so that every client is composited. */
+	client->frame++;
+	color = 0xc0000000 | (client->frame * 0x010203 & 0x00c0c0c0);
+	n = (size_t)client->width * client->height;
+	for (i = 0; i < n; i++)
+		buffer->data[i] = color;
+
+	if (client->rate == BENCH_CLIENT_FRAME_PACED) {
+		client->frame_callback =
+			wl_surface_frame(client->windows[0].surface);
+		wl_callback_add_listener(client->frame_callback,
+					 &frame_listener, client);
+	}
+
+	/* every window shows the same buffer */
+	for (w = 0; w < client->n_windows; w++) {
+		window = &client->windows[w];
+		wl_surface_attach(window->surface, buffer->buffer, 0, 0);
+		wl_surface_damage_buffer(window->surface, 0, 0, client->width,
+					 client->height);
+		wl_surface_commit(window->surface);
+		client->stats.commits++;
+	}
+	buffer->busy = true;
+}
+
+static void create_window(struct bench_client *client,
+			  struct client_window *window)
+{
+	window->client = client;
+	window->surface = wl_compositor_create_surface(client->compositor);
+	window->xdg_surface = xdg_wm_base_get_xdg_surface(client->wm_base,
+							  window->surface);
+	xdg_surface_add_listener(window->xdg_surface, &xdg_surface_listener,
+				 window);
+	window->toplevel = xdg_surface_get_toplevel(window->xdg_surface);
+	xdg_toplevel_add_listener(window->toplevel, &toplevel_listener, window);
+	xdg_toplevel_set_title(window->toplevel, "bench-client");
+	wl_surface_commit(window->surface);
+}
+
+static bool client_setup(struct bench_client *client)
+{
+	int i;
+
+	client->display = wl_display_connect_to_fd(client->fd);
+	if (!client->display) {
+		close(client->fd);
+		return false;
+	}
+
+	client->registry = wl_display_get_registry(client->display);
+	wl_registry_add_listener(client->registry, &registry_listener, client);
+	if (wl_display_roundtrip(client->display) < 0)
+		return false;
+	if (!client->compositor || !client->shm || !client->wm_base)
+		return false;
+
+	client->windows = calloc(client->n_windows, sizeof(*client->windows));
+	if (!client->windows)
+		return false;
+	for (i = 0; i < client->n_windows; i++)
+		create_window(client, &client->windows[i]);
+
+	while (client->n_configured < client->n_windows) {
+		if (wl_display_dispatch(client->display) < 0)
+			return false;
+	}
+
+	if (!create_buffers(client))
+		return false;
+
+	/* maps the toplevels */
+	draw_frame(client);
+	return wl_display_flush(client->display) >= 0;
+}
+
+static void client_run(struct bench_client *client)
+{
+	struct itimerspec interval = { 0 };
+	struct pollfd fds[3];
+	uint64_t expirations;
+	int timer_fd;
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		client->stats.failed = true;
+		return;
+	}
+	/* a zero rate leaves the timer disarmed, as does frame pacing */
+	if (client->rate > 0) {
+		interval.it_interval.tv_nsec = 1000000000 / client->rate;
+		interval.it_value = interval.it_interval;
+		timerfd_settime(timer_fd, 0, &interval, NULL);
+	}
+
+	fds[0].fd = wl_display_get_fd(client->display);
+	fds[0].events = POLLIN;
+	fds[1].fd = timer_fd;
+	fds[1].events = POLLIN;
+	fds[2].fd = client->stop_fd;
+	fds[2].events = POLLIN;
+
+	for (;;) {
+		while (wl_display_prepare_read(client->display) != 0)
+			wl_display_dispatch_pending(client->display);
+		wl_display_flush(client->display);
+
+		if (poll(fds, 3, -1) < 0) {
+			wl_display_cancel_read(client->display);
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			if (wl_display_read_events(client->display) < 0) {
+				client->stats.failed = true;
+				break;
+			}
+		} else {
+			wl_display_cancel_read(client->display);
+		}
+		if (wl_display_dispatch_pending(client->display) < 0) {
+			client->stats.failed = true;
+			break;
+		}
+
+		if (fds[2].revents & POLLIN)
+			break;
+		if ((fds[1].revents & POLLIN) &&
+		    read(timer_fd, &expirations, sizeof(expirations)) > 0)
+			draw_frame(client);
+	}
+
+	close(timer_fd);
+}
+
+static void client_teardown(struct bench_client *client)
+{
+	int i;
+
+	if (!client->display)
+		return;
+
+	if (client->frame_callback)
+		wl_callback_destroy(client->frame_callback);
+	for (i = 0; i < N_BUFFERS; i++) {
+		if (client->buffers[i].buffer)
+			wl_buffer_destroy(client->buffers[i].buffer);
+	}
+	if (client->shm_data)
+		munmap(client->shm_data, client->shm_size);
+	for (i = 0; client->windows && i < client->n_windows; i++) {
+		struct client_window *window = &client->windows[i];
+
+		xdg_toplevel_destroy(window->toplevel);
+		xdg_surface_destroy(window->xdg_surface);
+		wl_surface_destroy(window->surface);
+	}
+	free(client->windows);
+	if (client->pointer)
+		wl_pointer_destroy(client->pointer);
+	if (client->keyboard)
+		wl_keyboard_destroy(client->keyboard);
+	if (client->seat)
+		wl_seat_destroy(client->seat);
+	if (client->wm_base)
+		xdg_wm_base_destroy(client->wm_base);
+	if (client->shm)
+		wl_shm_destroy(client->shm);
+	if (client->compositor)
+		wl_compositor_destroy(client->compositor);
+	if (client->registry)
+		wl_registry_destroy(client->registry);
+	wl_display_disconnect(client->display);
+}
+
+static void *client_thread(void *data)
+{
+	struct bench_client *client = data;
+
+	if (client_setup(client))
+		client_run(client);
+	else
+		client->stats.failed = true;
+	client_teardown(client);
+
+	return NULL;
+}
+
+struct bench_client *bench_client_start(int fd, int windows, int width,
+					int height, int rate)
+{
+	struct bench_client *client;
+
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		close(fd);
+		return NULL;
+	}
+	client->fd = fd;
+	client->n_windows = windows > 0 ? windows : 1;
+	client->width = width;
+	client->height = height;
+	client->rate = rate;
+
+	client->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (client->stop_fd < 0)
+		goto failed;
+	if (pthread_create(&client->thread, NULL, client_thread, client) != 0) {
+		close(client->stop_fd);
+		goto failed;
+	}
+
+	return client;
+
+failed:
+	close(fd);
+	free(client);
+	return NULL;
+}
+
+void bench_client_stop(struct bench_client *client,
+		       struct bench_client_stats *stats)
+{
+	uint64_t one = 1;
+
+	if (write(client->stop_fd, &one, sizeof(one)) < 0)
+		perror("bench client stop");
+	pthread_join(client->thread, NULL);
+
+	*stats = client->stats;
+	close(client->stop_fd);
+	free(client);
+}
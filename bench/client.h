@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef BENCH_CLIENT_H
+#define BENCH_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Synthetic xdg-shell client running on a thread of its own. It maps a
+ * number of toplevels and commits a freshly drawn shm buffer to all of
+ * them at a fixed rate, only once if the rate is 0, or whenever the first
+ * window gets its frame callback with BENCH_CLIENT_FRAME_PACED.
+ * Kept apart from the compositor side, the client and server protocol
+ * headers cannot be included together.
+ */
+struct bench_client;
+
+#define BENCH_CLIENT_FRAME_PACED -1
+
+struct bench_client_stats {
+	uint64_t commits;
+	uint64_t skipped; /* ticks without a released buffer to draw into */
+	uint64_t configures;
+	bool failed;
+};
+
+/* Takes ownership of fd, a connected Wayland socket. */
+struct bench_client *bench_client_start(int fd, int windows, int width,
+					int height, int rate);
+
+void bench_client_stop(struct bench_client *client,
+		       struct bench_client_stats *stats);
+
+#endif
@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+/*
+ * Microbenchmarks of the compositor's hot paths, called directly against
+ * a headless server holding thousands of mapped views. Each operation is
+ * timed over several runs and the median is reported, which is what
+ * regression checks should compare.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/edges.h>
+#include <wlr/util/log.h>
+
+#include <wlrston.h>
+#include <view.h>
+
+#include "client.h"
+#include "harness.h"
+
+#define N_OUTPUTS 2
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define LAYOUT_WIDTH (N_OUTPUTS * OUTPUT_WIDTH)
+#define LAYOUT_HEIGHT OUTPUT_HEIGHT
+#define VIEW_WIDTH 320
+#define VIEW_HEIGHT 240
+#define N_DEVICES 4
+#define KEY_F1 59 /* Alt+F1 is bound to focus-next by default */
+/* calls between servicing clients, so that their buffers never fill */
+#define BATCH 16
+
+struct bench {
+	struct bench_harness harness;
+	struct wlrston_server *server; /* harness.server */
+	struct bench_client *client;
+
+	struct wlr_pointer pointers[N_DEVICES];
+	struct wlr_keyboard keyboards[N_DEVICES];
+
+	struct wlrston_view **views;
+	int n_views;
+};
+
+struct bench_op {
+	const char *name;
+	void (*setup)(struct bench *bench);
+	void (*run)(struct bench *bench);
+	void (*teardown)(struct bench *bench);
+};
+
+static const struct wlr_pointer_impl pointer_impl = {
+	.name = "bench-pointer",
+};
+
+static const struct wlr_keyboard_impl keyboard_impl = {
+	.name = "bench-keyboard",
+};
+
+static uint32_t rng_state = 0x2545f491;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/*
+ * The cursor is moved by writing its position, so that only the grab
+ * handlers are measured and not wlr_cursor's output layout clamping.
+ */
+static void set_cursor(struct bench *bench, double x, double y)
+{
+	bench->server->seat.cursor->x = x;
+	bench->server->seat.cursor->y = y;
+}
+
+static void view_at_run(struct bench *bench)
+{
+	struct wlr_surface *surface = NULL;
+	double sx, sy;
+
+	desktop_view_at(bench->server, rng() % LAYOUT_WIDTH,
+			rng() % LAYOUT_HEIGHT, &surface, &sx, &sy);
+}
+
+static void move_setup(struct bench *bench)
+{
+	struct wlrston_server *server = bench->server;
+
+	server->grabbed_view = bench->views[0];
+	server->cursor_mode = WLRSTON_CURSOR_MOVE;
+	server->grab_x = VIEW_WIDTH / 2;
+	server->grab_y = VIEW_HEIGHT / 2;
+}
+
+static void move_run(struct bench *bench)
+{
+	set_cursor(bench, rng() % LAYOUT_WIDTH, rng() % LAYOUT_HEIGHT);
+	process_cursor_move(bench->server);
+}
+
+static void resize_setup(struct bench *bench)
+{
+	struct wlrston_server *server = bench->server;
+	struct wlrston_view *view = bench->views[1];
+
+	server->grabbed_view = view;
+	server->cursor_mode = WLRSTON_CURSOR_RESIZE;
+	server->resize_edges = WLR_EDGE_BOTTOM | WLR_EDGE_RIGHT;
+	server->grab_geobox = (struct wlr_box){
+		.x = view->x, .y = view->y,
+		.width = VIEW_WIDTH, .height = VIEW_HEIGHT,
+	};
+	server->grab_x = 0;
+	server->grab_y = 0;
+}
+
+static void resize_run(struct bench *bench)
+{
+	struct wlr_box *box = &bench->server->grab_geobox;
+
+	set_cursor(bench, box->x + VIEW_WIDTH + (int)(rng() % 64) - 32,
+		   box->y + VIEW_HEIGHT + (int)(rng() % 64) - 32);
+	process_cursor_resize(bench->server);
+}
+
+static void grab_teardown(struct bench *bench)
+{
+	if (bench->server->cursor_mode == WLRSTON_CURSOR_RESIZE)
+		view_resize_reset(bench->server->grabbed_view);
+	reset_cursor_mode(bench->server);
+}
+
+static void focus_run(struct bench *bench)
+{
+	struct wlrston_view *view = bench->views[rng() % bench->n_views];
+
+	focus_view(view, view->impl->get_surface(view));
+}
+
+static void keybinding_setup(struct bench *bench)
+{
+	wlr_keyboard_notify_modifiers(&bench->keyboards[0], WLR_MODIFIER_ALT,
+				      0, 0, 0);
+}
+
+static void keybinding_run(struct bench *bench)
+{
+	struct wlrston_seat *seat = &bench->server->seat;
+
+	handle_keybinding(seat, &bench->keyboards[0], KEY_F1,
+			  WL_KEYBOARD_KEY_STATE_PRESSED);
+	handle_keybinding(seat, &bench->keyboards[0], KEY_F1,
+			  WL_KEYBOARD_KEY_STATE_RELEASED);
+}
+
+static void keybinding_teardown(struct bench *bench)
+{
+	wlr_keyboard_notify_modifiers(&bench->keyboards[0], 0, 0, 0, 0);
+}
+
+static void capabilities_run(struct bench *bench)
+{
+	seat_update_capabilities(&bench->server->seat);
+}
+
+static const struct bench_op ops[] = {
+	{ "desktop_view_at", NULL, view_at_run, NULL },
+	{ "process_cursor_move", move_setup, move_run, grab_teardown },
+	{ "process_cursor_resize", resize_setup, resize_run, grab_teardown },
+	{ "focus_view", NULL, focus_run, NULL },
+	{ "handle_keybinding", keybinding_setup, keybinding_run,
+	  keybinding_teardown },
+	{ "seat_update_capabilities", NULL, capabilities_run, NULL },
+};
+
+/* Returns nsec per call. Client servicing is left out of the timing. */
+static int64_t time_op(struct bench *bench, const struct bench_op *op,
+		       int iterations)
+{
+	int64_t elapsed = 0, start;
+	int i, j;
+
+	if (op->setup)
+		op->setup(bench);
+	for (i = 0; i < iterations; i += BATCH) {
+		start = bench_now_nsec();
+		for (j = 0; j < BATCH; j++)
+			op->run(bench);
+		elapsed += bench_now_nsec() - start;
+		bench_harness_dispatch(&bench->harness, 0);
+	}
+	if (op->teardown)
+		op->teardown(bench);
+
+	return elapsed / (((iterations + BATCH - 1) / BATCH) * BATCH);
+}
+
+static void report_op(struct bench *bench, const struct bench_op *op,
+		      int runs, int iterations, bool last)
+{
+	int64_t *samples;
+	int i;
+
+	samples = calloc(runs, sizeof(*samples));
+	if (!samples)
+		return;
+
+	time_op(bench, op, iterations); /* warm-up */
+	for (i = 0; i < runs; i++)
+		samples[i] = time_op(bench, op, iterations);
+	qsort(samples, runs, sizeof(*samples), bench_compare_int64);
+
+	printf("    \"%s\": {\"median_ns\": %" PRId64 ", \"min_ns\": %" PRId64
+	       ", \"max_ns\": %" PRId64 "}%s\n", op->name, samples[runs / 2],
+	       samples[0], samples[runs - 1], last ? "" : ",");
+	free(samples);
+}
+
+static void add_devices(struct bench *bench)
+{
+	struct wl_signal *new_input = &bench->server->backend->events.new_input;
+	int i;
+
+	for (i = 0; i < N_DEVICES; i++) {
+		wlr_pointer_init(&bench->pointers[i], &pointer_impl,
+				 pointer_impl.name);
+		wl_signal_emit(new_input, &bench->pointers[i].base);
+		wlr_keyboard_init(&bench->keyboards[i], &keyboard_impl,
+				  keyboard_impl.name);
+		wl_signal_emit(new_input, &bench->keyboards[i].base);
+	}
+}
+
+static void remove_devices(struct bench *bench)
+{
+	int i;
+
+	for (i = 0; i < N_DEVICES; i++) {
+		wlr_keyboard_finish(&bench->keyboards[i]);
+		wlr_pointer_finish(&bench->pointers[i]);
+	}
+}
+
+static bool map_views(struct bench *bench, int n_views)
+{
+	struct wlrston_server *server = bench->server;
+	struct wlrston_view *view;
+	int i = 0;
+
+	bench->client = bench_harness_connect(&bench->harness, n_views,
+					      VIEW_WIDTH, VIEW_HEIGHT, 0);
+	if (!bench->client ||
+	    !bench_harness_wait_views(&bench->harness, n_views))
+		return false;
+
+	bench->views = calloc(n_views, sizeof(*bench->views));
+	if (!bench->views)
+		return false;
+	wl_list_for_each(view, &server->view_list, link) {
+		view_set_position(view, rng() % (LAYOUT_WIDTH - VIEW_WIDTH),
+				  rng() % (LAYOUT_HEIGHT - VIEW_HEIGHT));
+		bench->views[i++] = view;
+	}
+	bench->n_views = i;
+
+	return true;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	       "  -n, --views=N              mapped views (default: 2000)\n"
+	       "  -r, --runs=N               timed runs per operation (default: 7)\n"
+	       "  -i, --iterations=N         calls per run (default: 20000)\n"
+	       "  -h, --help                 show this help\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "views", required_argument, NULL, 'n' },
+		{ "runs", required_argument, NULL, 'r' },
+		{ "iterations", required_argument, NULL, 'i' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct bench bench = { 0 };
+	struct bench_client_stats stats;
+	int n_views = 2000, runs = 7, iterations = 20000;
+	size_t i;
+	int ret = 1;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "n:r:i:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			n_views = atoi(optarg);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+	if (n_views < 2 || runs < 1 || iterations < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	bench_harness_setup_env(false);
+
+	if (!bench_harness_create(&bench.harness))
+		return 1;
+	bench.server = bench.harness.server;
+	if (!bench_harness_start(&bench.harness, N_OUTPUTS, OUTPUT_WIDTH,
+				 OUTPUT_HEIGHT))
+		goto out_harness;
+	add_devices(&bench);
+
+	if (!map_views(&bench, n_views))
+		goto out_client;
+
+	printf("{\n  \"views\": %d, \"runs\": %d, \"iterations\": %d,\n"
+	       "  \"ops\": {\n", bench.n_views, runs, iterations);
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+		report_op(&bench, &ops[i], runs, iterations,
+			  i == sizeof(ops) / sizeof(ops[0]) - 1);
+	printf("  }\n}\n");
+	ret = 0;
+
+out_client:
+	if (bench.client) {
+		bench_client_stop(bench.client, &stats);
+		if (stats.failed)
+			ret = 1;
+	}
+	free(bench.views);
+	remove_devices(&bench);
+out_harness:
+	bench_harness_destroy(&bench.harness);
+
+	return ret;
+}
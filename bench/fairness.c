@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+/*
+ * Dispatch fairness. A client floods a headless server with buffer commits
+ * to many windows while a 1 ms timer on the server's loop stands in for an
+ * input device. How late the timer runs shows how long one iteration keeps
+ * other sources waiting, without a commit budget and with the budgets
+ * given on the command line.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-server-core.h>
+
+#include <wlrston.h>
+
+#include "client.h"
+#include "harness.h"
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define VIEW_WIDTH 256
+#define VIEW_HEIGHT 256
+#define FLOOD_RATE 1000 /* frames per second the client tries to draw */
+#define PROBE_MSEC 1
+#define MAX_SAMPLES 100000
+
+struct probe {
+	struct wl_event_source *timer;
+	int64_t deadline_nsec;
+	int64_t *samples;
+	int n_samples;
+};
+
+static int probe_fire(void *data)
+{
+	struct probe *probe = data;
+	int64_t now = bench_now_nsec();
+
+	if (probe->n_samples < MAX_SAMPLES)
+		probe->samples[probe->n_samples++] = now - probe->deadline_nsec;
+	probe->deadline_nsec = now + (int64_t)PROBE_MSEC * 1000000;
+	wl_event_source_timer_update(probe->timer, PROBE_MSEC);
+	return 0;
+}
+
+static int run(int budget, int windows, int duration, bool last)
+{
+	struct bench_harness harness = { 0 };
+	struct bench_client_stats stats = { 0 };
+	struct bench_client *client = NULL;
+	struct client_account *account;
+	struct wlrston_server *server;
+	struct probe probe = { 0 };
+	uint64_t applied = 0, deferred = 0;
+	int ret = 1;
+
+	probe.samples = calloc(MAX_SAMPLES, sizeof(*probe.samples));
+	if (!probe.samples)
+		return 1;
+	if (!bench_harness_create(&harness))
+		goto out;
+	server = harness.server;
+	server->clients.limits.commits_per_iteration = budget;
+	if (!bench_harness_start(&harness, 1, OUTPUT_WIDTH, OUTPUT_HEIGHT))
+		goto out_harness;
+
+	client = bench_harness_connect(&harness, windows, VIEW_WIDTH,
+				       VIEW_HEIGHT, FLOOD_RATE);
+	if (!client || !bench_harness_wait_views(&harness, windows))
+		goto out_harness;
+
+	probe.timer = wl_event_loop_add_timer(harness.loop, probe_fire, &probe);
+	if (!probe.timer)
+		goto out_harness;
+	probe.deadline_nsec = bench_now_nsec() + (int64_t)PROBE_MSEC * 1000000;
+	wl_event_source_timer_update(probe.timer, PROBE_MSEC);
+
+	bench_harness_run(&harness, (int64_t)duration * 1000);
+
+	wl_list_for_each(account, &server->clients.accounts, link) {
+		applied += account->commits;
+		deferred += account->commits_deferred;
+	}
+	bench_client_stop(client, &stats);
+	client = NULL;
+	if (stats.failed || probe.n_samples == 0)
+		goto out_probe;
+
+	qsort(probe.samples, probe.n_samples, sizeof(*probe.samples),
+	      bench_compare_int64);
+	printf("    {\"budget\": %d, \"probe_p50_us\": %" PRId64
+	       ", \"probe_p99_us\": %" PRId64 ", \"probe_max_us\": %" PRId64
+	       ", \"probes\": %d, \"commits_sent\": %" PRIu64
+	       ", \"commits_applied\": %" PRIu64 ", \"commits_deferred\": %"
+	       PRIu64 "}%s\n", budget,
+	       probe.samples[probe.n_samples / 2] / 1000,
+	       probe.samples[probe.n_samples * 99 / 100] / 1000,
+	       probe.samples[probe.n_samples - 1] / 1000, probe.n_samples,
+	       stats.commits, applied, deferred, last ? "" : ",");
+	ret = 0;
+
+out_probe:
+	wl_event_source_remove(probe.timer);
+out_harness:
+	if (client)
+		bench_client_stop(client, &stats);
+	bench_harness_destroy(&harness);
+out:
+	free(probe.samples);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options] [BUDGET...]\n"
+	       "  -w, --windows=N            windows the client floods (default: 32)\n"
+	       "  -d, --duration=SEC         seconds per budget (default: 3)\n"
+	       "  -h, --help                 show this help\n"
+	       "Runs without a budget, then with each BUDGET commits per client\n"
+	       "and iteration (default: 1 4 16).\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "windows", required_argument, NULL, 'w' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	static const int default_budgets[] = { 1, 4, 16 };
+	int budgets[16] = { 0 };
+	int n_budgets = 1; /* the first run has none */
+	int windows = 32, duration = 3;
+	int i, c, ret = 0;
+
+	while ((c = getopt_long(argc, argv, "w:d:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'w':
+			windows = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+	if (windows < 1 || duration < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (i = optind; i < argc && n_budgets < 16; i++)
+		budgets[n_budgets++] = atoi(argv[i]);
+	if (optind == argc) {
+		for (i = 0; i < 3; i++)
+			budgets[n_budgets++] = default_budgets[i];
+	}
+
+	bench_harness_setup_env(false);
+
+	printf("{\n  \"windows\": %d,\n  \"runs\": [\n", windows);
+	for (i = 0; i < n_budgets; i++) {
+		if (run(budgets[i], windows, duration, i == n_budgets - 1) != 0)
+			ret = 1;
+	}
+	printf("  ]\n}\n");
+
+	return ret;
+}
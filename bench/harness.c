@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
+#include <wlr/util/log.h>
+
+#include <wlrston.h>
+
+#include "client.h"
+#include "harness.h"
+
+#define MAP_TIMEOUT_MSEC 30000
+
+int64_t bench_now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int bench_compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+void bench_harness_setup_env(bool keep_backends)
+{
+	wlr_log_init(WLR_ERROR, NULL);
+
+	setenv("WLR_BACKENDS", "headless", !keep_backends);
+	setenv("WLR_RENDERER", "pixman", false);
+	setenv("WLR_HEADLESS_OUTPUTS", "0", true);
+	setenv("WLR_LIBINPUT_NO_DEVICES", "1", true);
+}
+
+static void find_headless(struct wlr_backend *backend, void *data)
+{
+	struct wlr_backend **headless = data;
+
+	if (wlr_backend_is_headless(backend))
+		*headless = backend;
+}
+
+bool bench_harness_create(struct bench_harness *harness)
+{
+	harness->display = wl_display_create();
+	if (!harness->display)
+		return false;
+	harness->loop = wl_display_get_event_loop(harness->display);
+
+	harness->server = server_create(harness->display);
+	if (!harness->server) {
+		wl_display_destroy(harness->display);
+		harness->display = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool bench_harness_start(struct bench_harness *harness, int outputs,
+			 int width, int height)
+{
+	int i;
+
+	if (!server_start(harness->server))
+		return false;
+	wlr_multi_for_each_backend(harness->server->backend, find_headless,
+				   &harness->headless);
+	if (!harness->headless) {
+		fprintf(stderr, "no headless backend, check WLR_BACKENDS\n");
+		return false;
+	}
+	for (i = 0; i < outputs; i++)
+		wlr_headless_add_output(harness->headless, width, height);
+	return true;
+}
+
+void bench_harness_destroy(struct bench_harness *harness)
+{
+	if (!harness->display)
+		return;
+	wl_display_destroy_clients(harness->display);
+	server_destory(harness->server);
+	wl_display_destroy(harness->display);
+	harness->display = NULL;
+	harness->server = NULL;
+}
+
+struct bench_client *bench_harness_connect(struct bench_harness *harness,
+					   int windows, int width, int height,
+					   int rate)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+		return NULL;
+	if (!wl_client_create(harness->display, fds[0])) {
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	}
+	return bench_client_start(fds[1], windows, width, height, rate);
+}
+
+void bench_harness_dispatch(struct bench_harness *harness, int timeout_msec)
+{
+	wl_display_flush_clients(harness->display);
+	wl_event_loop_dispatch(harness->loop, timeout_msec);
+}
+
+bool bench_harness_wait_views(struct bench_harness *harness, int n_views)
+{
+	struct wl_list *views = &harness->server->view_list;
+	int64_t deadline = bench_now_nsec() +
+		(int64_t)MAP_TIMEOUT_MSEC * 1000000;
+
+	while (wl_list_length(views) != n_views) {
+		if (bench_now_nsec() > deadline) {
+			fprintf(stderr, "%d views instead of %d\n",
+				wl_list_length(views), n_views);
+			return false;
+		}
+		bench_harness_dispatch(harness, 100);
+	}
+	return true;
+}
+
+void bench_harness_run(struct bench_harness *harness, int64_t duration_msec)
+{
+	int64_t end = bench_now_nsec() + duration_msec * 1000000;
+
+	while (bench_now_nsec() < end)
+		bench_harness_dispatch(harness, 100);
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-server-core.h>
+
+struct bench_client;
+struct wlr_backend;
+struct wlrston_server;
+
+/*
+ * What the benches running the compositor share: a server on the headless
+ * backend in the same process, headless outputs, and synthetic clients
+ * connected over socket pairs. The server is created and started in two
+ * steps, so that limits and listeners can be set in between.
+ */
+struct bench_harness {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wlrston_server *server;
+	struct wlr_backend *headless;
+};
+
+int64_t bench_now_nsec(void);
+
+/* qsort() comparison of int64_t samples. */
+int bench_compare_int64(const void *a, const void *b);
+
+/*
+ * Logs errors only and selects the headless backend with pixman. With
+ * keep_backends, a WLR_BACKENDS the user set wins.
+ */
+void bench_harness_setup_env(bool keep_backends);
+
+bool bench_harness_create(struct bench_harness *harness);
+
+/* Starts the server and adds outputs of the given size. */
+bool bench_harness_start(struct bench_harness *harness, int outputs,
+			 int width, int height);
+
+/* Disconnects the clients and destroys the server and display. */
+void bench_harness_destroy(struct bench_harness *harness);
+
+/* Connects a bench client, see client.h for the arguments. */
+struct bench_client *bench_harness_connect(struct bench_harness *harness,
+					   int windows, int width, int height,
+					   int rate);
+
+/* Flushes the clients and dispatches the loop once. */
+void bench_harness_dispatch(struct bench_harness *harness, int timeout_msec);
+
+/* Dispatches until the server maps exactly n_views, false on timeout. */
+bool bench_harness_wait_views(struct bench_harness *harness, int n_views);
+
+/* Dispatches for duration_msec. */
+void bench_harness_run(struct bench_harness *harness, int64_t duration_msec);
+
+#endif
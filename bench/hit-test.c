@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+/*
+ * Compares hit-testing by walking the whole scene graph against looking
+ * up candidate views in the spatial index first. Also checks the index
+ * against a linear scan where far more views overlap than it keeps
+ * candidates for, with some of them too large for the grid.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <wlr/types/wlr_scene.h>
+
+#include <spatial.h>
+
+#define LAYOUT_WIDTH 3840
+#define LAYOUT_HEIGHT 2160
+#define QUERIES 200000
+#define STACK_QUERIES 20000
+
+struct bench_view {
+	struct wlr_scene_tree *tree;
+	struct spatial_entry spatial;
+	bool solid; /* accepts the point, for the stacked run */
+};
+
+static uint32_t rng_state = 0x2545f491;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool subtree_at(struct spatial_entry *entry, double x, double y,
+		       void *data)
+{
+	struct bench_view *view = entry->data;
+	struct wlr_scene_node **node = data;
+	double nx, ny;
+
+	*node = wlr_scene_node_at(&view->tree->node, x, y, &nx, &ny);
+	return *node != NULL;
+}
+
+static int run(int n_views)
+{
+	static const float color[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	struct spatial_index index;
+	struct bench_view *views;
+	struct wlr_scene *scene;
+	double (*points)[2];
+	int64_t start, scene_nsec, index_nsec;
+	int mismatches = 0;
+	int i;
+
+	scene = wlr_scene_create();
+	views = calloc(n_views, sizeof(*views));
+	points = calloc(QUERIES, sizeof(*points));
+	if (!scene || !views || !points) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	spatial_index_init(&index);
+
+	/* Later views are stacked on top, like newly mapped windows. */
+	for (i = 0; i < n_views; i++) {
+		struct wlr_box box = {
+			.x = (int)(rng() % LAYOUT_WIDTH) - 200,
+			.y = (int)(rng() % LAYOUT_HEIGHT) - 150,
+			.width = 200 + rng() % 1000,
+			.height = 150 + rng() % 750,
+		};
+
+		views[i].tree = wlr_scene_tree_create(&scene->tree);
+		wlr_scene_node_set_position(&views[i].tree->node, box.x, box.y);
+		wlr_scene_rect_create(views[i].tree, box.width, box.height, color);
+
+		views[i].spatial.data = &views[i];
+		views[i].spatial.z = i;
+		spatial_index_insert(&index, &views[i].spatial, &box);
+	}
+
+	for (i = 0; i < QUERIES; i++) {
+		points[i][0] = (rng() % (LAYOUT_WIDTH * 16)) / 16.0;
+		points[i][1] = (rng() % (LAYOUT_HEIGHT * 16)) / 16.0;
+	}
+
+	start = now_nsec();
+	for (i = 0; i < QUERIES; i++) {
+		double nx, ny;
+
+		wlr_scene_node_at(&scene->tree.node, points[i][0], points[i][1],
+				  &nx, &ny);
+	}
+	scene_nsec = now_nsec() - start;
+
+	start = now_nsec();
+	for (i = 0; i < QUERIES; i++) {
+		struct wlr_scene_node *node = NULL;
+
+		spatial_index_at(&index, points[i][0], points[i][1],
+				 subtree_at, &node);
+	}
+	index_nsec = now_nsec() - start;
+
+	/* Both paths must agree on the node that was hit. */
+	for (i = 0; i < QUERIES; i += 97) {
+		struct wlr_scene_node *expected, *node = NULL;
+		double nx, ny;
+
+		expected = wlr_scene_node_at(&scene->tree.node, points[i][0],
+					     points[i][1], &nx, &ny);
+		if (!spatial_index_at(&index, points[i][0], points[i][1],
+				      subtree_at, &node))
+			node = NULL;
+		if (node != expected)
+			mismatches++;
+	}
+
+	printf("{\"views\": %d, \"queries\": %d, "
+	       "\"scene_ns_per_query\": %.1f, \"index_ns_per_query\": %.1f, "
+	       "\"speedup\": %.2f, \"mismatches\": %d}\n",
+	       n_views, QUERIES, (double)scene_nsec / QUERIES,
+	       (double)index_nsec / QUERIES,
+	       index_nsec ? (double)scene_nsec / index_nsec : 0.0, mismatches);
+
+	spatial_index_finish(&index);
+	wlr_scene_node_destroy(&scene->tree.node);
+	free(points);
+	free(views);
+
+	return mismatches ? 1 : 0;
+}
+
+static bool view_solid(struct spatial_entry *entry, double x, double y,
+		       void *data)
+{
+	struct bench_view *view = entry->data;
+
+	return view->solid;
+}
+
+/*
+ * Every view covers the area the queries go to and a third of them are
+ * larger than the grid takes. Later views are stacked on top. The top 100
+ * reject the point, half of the others at random.
+ */
+static int run_stacked(int n_views)
+{
+	struct spatial_index index;
+	struct bench_view *views;
+	struct bench_view *expected;
+	struct spatial_entry *entry;
+	int mismatches = 0;
+	int i, j;
+
+	views = calloc(n_views, sizeof(*views));
+	if (!views) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	spatial_index_init(&index);
+
+	for (i = 0; i < n_views; i++) {
+		struct wlr_box box = {
+			.x = 1000 - (int)(rng() % 500),
+			.y = 1000 - (int)(rng() % 500),
+			.width = 600 + rng() % 1000,
+			.height = 600 + rng() % 1000,
+		};
+
+		if (i % 3 == 0) {
+			box.x = -5000;
+			box.y = -5000;
+			box.width = box.height = 20000;
+		}
+		views[i].solid = i < n_views - 100 && rng() % 2;
+		views[i].spatial.data = &views[i];
+		views[i].spatial.z = i;
+		spatial_index_insert(&index, &views[i].spatial, &box);
+	}
+
+	for (i = 0; i < STACK_QUERIES; i++) {
+		double x = 1000 + (rng() % (100 * 16)) / 16.0;
+		double y = 1000 + (rng() % (100 * 16)) / 16.0;
+
+		expected = NULL;
+		for (j = 0; j < n_views; j++) {
+			const struct wlr_box *box = &views[j].spatial.box;
+
+			if (!views[j].solid || x < box->x ||
+			    x >= box->x + box->width || y < box->y ||
+			    y >= box->y + box->height)
+				continue;
+			if (!expected ||
+			    views[j].spatial.z > expected->spatial.z)
+				expected = &views[j];
+		}
+
+		entry = spatial_index_at(&index, x, y, view_solid, NULL);
+		if ((entry ? entry->data : NULL) != expected)
+			mismatches++;
+	}
+
+	printf("{\"stacked_views\": %d, \"queries\": %d, "
+	       "\"mismatches\": %d}\n", n_views, STACK_QUERIES, mismatches);
+
+	spatial_index_finish(&index);
+	free(views);
+
+	return mismatches ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int sizes[] = { 10, 100, 1000 };
+	int ret = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		ret |= run(sizes[i]);
+	ret |= run_stacked(300);
+
+	return ret;
+}
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+/*
+ * Measures how late the main loop gets to a 1 ms timer while headless
+ * outputs are being rendered with pixman, once on the main loop and once
+ * on render worker threads.
+ *
+ * A translucent backdrop and an opaque marker per output are stacked over
+ * the buffers, like the window switcher does. Every committed frame must
+ * show the marker on top.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <drm_fourcc.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/pixman.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#include <render.h>
+
+#define N_OUTPUTS 2
+#define OUTPUT_WIDTH 3840
+#define OUTPUT_HEIGHT 2160
+#define N_BUFFERS 12
+#define BUFFER_WIDTH 1600
+#define BUFFER_HEIGHT 1000
+#define PROBE_MSEC 1
+#define DURATION_MSEC 3000
+#define MARKER_SIZE 64
+/* magenta reads the same in any channel order */
+#define MARKER_PIXEL 0xff00ff
+
+struct bench {
+	struct wl_display *display;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_scene *scene;
+	struct wlr_output_layout *layout;
+	struct wlr_scene_buffer *buffers[N_BUFFERS];
+	int rect_checks, rect_misses;
+	struct wl_listener new_output;
+	bool threaded;
+	int frames;
+
+	int64_t probe_deadline;
+	int64_t *lateness;
+	size_t n_lateness, cap_lateness;
+	struct wl_event_source *probe;
+	struct wl_event_source *stop;
+};
+
+struct bench_output {
+	struct bench *bench;
+	struct wlr_output *wlr_output;
+	struct render_worker *worker;
+	struct wl_listener frame;
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void output_frame(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output = wl_container_of(listener, output, frame);
+	struct bench *bench = output->bench;
+	struct wlr_scene_output *scene_output;
+	int i;
+
+	/* keep everything damaged, like a busy desktop */
+	bench->frames++;
+	for (i = 0; i < N_BUFFERS; i++)
+		wlr_scene_node_set_position(&bench->buffers[i]->node,
+					    (i * 577 + bench->frames * 7) %
+					    (N_OUTPUTS * OUTPUT_WIDTH),
+					    (i * 211) % OUTPUT_HEIGHT);
+
+	if (output->worker && render_worker_submit(output->worker))
+		return;
+
+	scene_output = wlr_scene_get_scene_output(bench->scene,
+						  output->wlr_output);
+	wlr_scene_output_commit(scene_output);
+}
+
+static void output_commit(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output = wl_container_of(listener, output, commit);
+	struct wlr_output_event_commit *event = data;
+	struct bench *bench = output->bench;
+	uint32_t drm_format, pixel;
+	size_t stride;
+	void *bits;
+
+	if (!event->buffer)
+		return;
+	if (!wlr_buffer_begin_data_ptr_access(event->buffer,
+					      WLR_BUFFER_DATA_PTR_ACCESS_READ,
+					      &bits, &drm_format, &stride))
+		return;
+	pixel = *(uint32_t *)((char *)bits + MARKER_SIZE / 2 * stride +
+			      MARKER_SIZE / 2 * 4);
+	wlr_buffer_end_data_ptr_access(event->buffer);
+
+	bench->rect_checks++;
+	if ((pixel & 0xffffff) != MARKER_PIXEL)
+		bench->rect_misses++;
+}
+
+static void output_destroy(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output = wl_container_of(listener, output, destroy);
+
+	render_worker_destroy(output->worker);
+	wl_list_remove(&output->frame.link);
+	wl_list_remove(&output->commit.link);
+	wl_list_remove(&output->destroy.link);
+	free(output);
+}
+
+static void new_output(struct wl_listener *listener, void *data)
+{
+	struct bench *bench = wl_container_of(listener, bench, new_output);
+	struct wlr_output *wlr_output = data;
+	struct bench_output *output;
+
+	wlr_output_init_render(wlr_output, bench->allocator, bench->renderer);
+	wlr_output_enable(wlr_output, true);
+	if (!wlr_output_commit(wlr_output))
+		return;
+
+	output = calloc(1, sizeof(*output));
+	if (!output)
+		return;
+	output->bench = bench;
+	output->wlr_output = wlr_output;
+	output->frame.notify = output_frame;
+	wl_signal_add(&wlr_output->events.frame, &output->frame);
+	output->commit.notify = output_commit;
+	wl_signal_add(&wlr_output->events.commit, &output->commit);
+	output->destroy.notify = output_destroy;
+	wl_signal_add(&wlr_output->events.destroy, &output->destroy);
+
+	wlr_output_layout_add_auto(bench->layout, wlr_output);
+
+	if (bench->threaded) {
+		output->worker = render_worker_create(wlr_output, bench->scene,
+						      bench->allocator,
+						      wl_display_get_event_loop(bench->display),
+						      NULL, NULL);
+	}
+}
+
+static struct wlr_buffer *create_buffer(struct bench *bench, int index)
+{
+	struct wlr_drm_format *format;
+	struct wlr_buffer *buffer;
+	uint32_t drm_format;
+	size_t stride;
+	void *data;
+	int x, y;
+
+	format = calloc(1, sizeof(*format) + sizeof(uint64_t));
+	if (!format)
+		return NULL;
+	format->format = DRM_FORMAT_ARGB8888;
+	format->len = 1;
+	format->capacity = 1;
+	format->modifiers[0] = DRM_FORMAT_MOD_LINEAR;
+
+	buffer = wlr_allocator_create_buffer(bench->allocator, BUFFER_WIDTH,
+					     BUFFER_HEIGHT, format);
+	free(format);
+	if (!buffer)
+		return NULL;
+
+	if (wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_WRITE,
+					     &data, &drm_format, &stride)) {
+		/* translucent gradients, so that blending is not skipped */
+		for (y = 0; y < BUFFER_HEIGHT; y++) {
+			uint32_t *row = (uint32_t *)((char *)data + y * stride);
+
+			for (x = 0; x < BUFFER_WIDTH; x++)
+				row[x] = (0xc0u << 24) | ((x + index * 40) & 0xff) << 16 |
+					(y & 0xff) << 8 | (index * 20 & 0xff);
+		}
+		wlr_buffer_end_data_ptr_access(buffer);
+	}
+	return buffer;
+}
+
+static int probe_timer(void *data)
+{
+	struct bench *bench = data;
+	int64_t now = now_nsec();
+	int64_t *lateness;
+
+	if (bench->n_lateness == bench->cap_lateness) {
+		size_t cap = bench->cap_lateness ? bench->cap_lateness * 2 : 4096;
+
+		lateness = realloc(bench->lateness, cap * sizeof(*lateness));
+		if (!lateness)
+			return 0;
+		bench->lateness = lateness;
+		bench->cap_lateness = cap;
+	}
+	bench->lateness[bench->n_lateness++] =
+		now > bench->probe_deadline ? now - bench->probe_deadline : 0;
+
+	bench->probe_deadline = now + PROBE_MSEC * 1000000;
+	wl_event_source_timer_update(bench->probe, PROBE_MSEC);
+	return 0;
+}
+
+static int stop_timer(void *data)
+{
+	struct bench *bench = data;
+
+	wl_display_terminate(bench->display);
+	return 0;
+}
+
+static void report(struct bench *bench)
+{
+	int64_t sum = 0;
+	size_t i, n = bench->n_lateness;
+
+	if (n == 0)
+		return;
+
+	qsort(bench->lateness, n, sizeof(*bench->lateness), compare_int64);
+	for (i = 0; i < n; i++)
+		sum += bench->lateness[i];
+
+	printf("{\"mode\": \"%s\", \"outputs\": %d, \"frames\": %d, "
+	       "\"probes\": %zu, \"late_avg_us\": %.1f, \"late_p99_us\": %.1f, "
+	       "\"late_max_us\": %.1f, \"rect_misses\": %d}\n",
+	       bench->threaded ? "threaded" : "main-loop", N_OUTPUTS,
+	       bench->frames, n, sum / 1000.0 / n,
+	       bench->lateness[n * 99 / 100] / 1000.0,
+	       bench->lateness[n - 1] / 1000.0, bench->rect_misses);
+}
+
+static int run(bool threaded)
+{
+	static const float backdrop[4] = { 0.0f, 0.0f, 0.0f, 0.5f };
+	static const float marker[4] = { 1.0f, 0.0f, 1.0f, 1.0f };
+	struct bench bench = { .threaded = threaded };
+	struct wl_event_loop *loop;
+	int i, ret = 1;
+
+	wl_list_init(&bench.new_output.link);
+	bench.display = wl_display_create();
+	if (!bench.display)
+		return 1;
+	loop = wl_display_get_event_loop(bench.display);
+
+	bench.backend = wlr_headless_backend_create(bench.display);
+	bench.renderer = wlr_pixman_renderer_create();
+	if (!bench.backend || !bench.renderer)
+		goto out;
+	bench.allocator = wlr_allocator_autocreate(bench.backend, bench.renderer);
+	bench.scene = wlr_scene_create();
+	bench.layout = wlr_output_layout_create();
+	if (!bench.allocator || !bench.scene || !bench.layout)
+		goto out;
+	wlr_scene_attach_output_layout(bench.scene, bench.layout);
+
+	for (i = 0; i < N_BUFFERS; i++) {
+		struct wlr_buffer *buffer = create_buffer(&bench, i);
+
+		if (!buffer)
+			goto out;
+		bench.buffers[i] = wlr_scene_buffer_create(&bench.scene->tree,
+							   buffer);
+		wlr_buffer_drop(buffer);
+		if (!bench.buffers[i])
+			goto out;
+	}
+	if (!wlr_scene_rect_create(&bench.scene->tree, N_OUTPUTS * OUTPUT_WIDTH,
+				   OUTPUT_HEIGHT, backdrop))
+		goto out;
+	for (i = 0; i < N_OUTPUTS; i++) {
+		struct wlr_scene_rect *rect;
+
+		rect = wlr_scene_rect_create(&bench.scene->tree, MARKER_SIZE,
+					     MARKER_SIZE, marker);
+		if (!rect)
+			goto out;
+		/* outputs are laid out left to right */
+		wlr_scene_node_set_position(&rect->node, i * OUTPUT_WIDTH, 0);
+	}
+
+	bench.new_output.notify = new_output;
+	wl_signal_add(&bench.backend->events.new_output, &bench.new_output);
+	if (!wlr_backend_start(bench.backend))
+		goto out;
+	for (i = 0; i < N_OUTPUTS; i++)
+		wlr_headless_add_output(bench.backend, OUTPUT_WIDTH, OUTPUT_HEIGHT);
+
+	bench.probe = wl_event_loop_add_timer(loop, probe_timer, &bench);
+	bench.stop = wl_event_loop_add_timer(loop, stop_timer, &bench);
+	if (!bench.probe || !bench.stop)
+		goto out;
+	bench.probe_deadline = now_nsec() + PROBE_MSEC * 1000000;
+	wl_event_source_timer_update(bench.probe, PROBE_MSEC);
+	wl_event_source_timer_update(bench.stop, DURATION_MSEC);
+
+	wl_display_run(bench.display);
+	report(&bench);
+	if (bench.rect_checks == 0 || bench.rect_misses > 0)
+		fprintf(stderr, "%d of %d frames lost the rects\n",
+			bench.rect_misses, bench.rect_checks);
+	else
+		ret = 0;
+
+out:
+	if (bench.probe)
+		wl_event_source_remove(bench.probe);
+	if (bench.stop)
+		wl_event_source_remove(bench.stop);
+	wl_list_remove(&bench.new_output.link);
+	if (bench.backend)
+		wlr_backend_destroy(bench.backend);
+	if (bench.scene)
+		wlr_scene_node_destroy(&bench.scene->tree.node);
+	if (bench.layout)
+		wlr_output_layout_destroy(bench.layout);
+	if (bench.allocator)
+		wlr_allocator_destroy(bench.allocator);
+	if (bench.renderer)
+		wlr_renderer_destroy(bench.renderer);
+	wl_display_destroy(bench.display);
+	free(bench.lateness);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+
+	wlr_log_init(WLR_ERROR, NULL);
+
+	ret |= run(false);
+	ret |= run(true);
+
+	return ret;
+}
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+/*
+ * Fullscreen transactions with a client that only draws when it gets a
+ * frame callback, like a video player. Its view is toggled in and out of
+ * fullscreen on a headless server. Each transaction has to complete on
+ * the client's commit, none may wait for the timeout, and each toggle
+ * should cost the client a single configure.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <wayland-server-core.h>
+
+#include <wlrston.h>
+#include <view.h>
+
+#include "client.h"
+#include "harness.h"
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define VIEW_WIDTH 640
+#define VIEW_HEIGHT 480
+
+struct toggler {
+	struct wlrston_server *server;
+	struct wl_event_source *timer;
+	int interval_msec;
+	int toggles;
+};
+
+static int toggle_fullscreen(void *data)
+{
+	struct toggler *toggler = data;
+	struct wlrston_view *view;
+
+	if (!wl_list_empty(&toggler->server->view_list)) {
+		view = wl_container_of(toggler->server->view_list.next, view,
+				       link);
+		view_set_fullscreen(view, !view->fullscreen, NULL);
+		toggler->toggles++;
+	}
+	wl_event_source_timer_update(toggler->timer, toggler->interval_msec);
+	return 0;
+}
+
+static int run(int interval, int duration)
+{
+	struct bench_harness harness = { 0 };
+	struct bench_client_stats stats = { 0 };
+	struct bench_client *client = NULL;
+	struct toggler toggler = { .interval_msec = interval };
+	struct wlrston_server *server;
+	uint64_t transactions, timed_out;
+	int ret = 1;
+
+	if (!bench_harness_create(&harness))
+		return 1;
+	server = harness.server;
+	if (!bench_harness_start(&harness, 1, OUTPUT_WIDTH, OUTPUT_HEIGHT))
+		goto out;
+
+	client = bench_harness_connect(&harness, 1, VIEW_WIDTH, VIEW_HEIGHT,
+				       BENCH_CLIENT_FRAME_PACED);
+	if (!client || !bench_harness_wait_views(&harness, 1))
+		goto out;
+
+	toggler.server = server;
+	toggler.timer = wl_event_loop_add_timer(harness.loop, toggle_fullscreen,
+						&toggler);
+	if (!toggler.timer)
+		goto out;
+	wl_event_source_timer_update(toggler.timer, interval);
+
+	transactions = server->stats.transactions;
+	timed_out = server->stats.transactions_timed_out;
+	bench_harness_run(&harness, (int64_t)duration * 1000);
+	transactions = server->stats.transactions - transactions;
+	timed_out = server->stats.transactions_timed_out - timed_out;
+
+	wl_event_source_remove(toggler.timer);
+	bench_client_stop(client, &stats);
+	client = NULL;
+	if (stats.failed || toggler.toggles == 0)
+		goto out;
+
+	printf("{\n  \"toggles\": %d,\n  \"transactions\": %" PRIu64
+	       ",\n  \"transactions_timed_out\": %" PRIu64
+	       ",\n  \"client_commits\": %" PRIu64
+	       ",\n  \"client_configures\": %" PRIu64 "\n}\n",
+	       toggler.toggles, transactions, timed_out, stats.commits,
+	       stats.configures);
+	if (timed_out > 0)
+		fprintf(stderr, "%" PRIu64 " transactions timed out\n",
+			timed_out);
+	else
+		ret = 0;
+
+out:
+	if (client)
+		bench_client_stop(client, &stats);
+	bench_harness_destroy(&harness);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	       "  -i, --interval=MS          time between toggles (default: 100)\n"
+	       "  -d, --duration=SEC         seconds to toggle for (default: 3)\n"
+	       "  -h, --help                 show this help\n"
+	       "Fails when a transaction timed out.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "interval", required_argument, NULL, 'i' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int interval = 100, duration = 3;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "i:d:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+	if (interval < 1 || duration < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	bench_harness_setup_env(false);
+	return run(interval, duration);
+}
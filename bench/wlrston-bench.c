@@ -0,0 +1,583 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+/*
+ * Runs the compositor in-process on the headless backend, with synthetic
+ * xdg-shell clients committing shm buffers on threads of their own and
+ * fake pointer and keyboard devices, and prints frame statistics as JSON.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+#include <wlr/render/pixman.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+#include <wlrston.h>
+
+#include "client.h"
+#include "harness.h"
+
+#define KEY_EVERY_N_MOTIONS 8
+#define KEY_A 30
+
+struct series {
+	int64_t *values;
+	size_t len, cap;
+};
+
+struct bench_options {
+	int outputs;
+	int output_width, output_height;
+	int clients;
+	int client_width, client_height;
+	int rate;
+	int input_rate;
+	int duration;
+};
+
+struct bench {
+	struct bench_options options;
+	struct bench_harness harness;
+	struct wlrston_server *server; /* harness.server */
+
+	struct wlr_pointer pointer;
+	struct wlr_keyboard keyboard;
+	struct wl_event_source *input_timer;
+	struct wl_event_source *stop_timer;
+	uint32_t input_ticks;
+	int64_t pending_input;
+
+	struct wl_listener new_xdg_surface;
+	struct wl_list surfaces; /* bench_surface::link */
+
+	struct bench_client **clients;
+
+	uint64_t frames;
+	struct series frame_time;
+	struct series commit_to_present;
+	struct series input_to_frame;
+};
+
+struct bench_output {
+	struct bench *bench;
+	struct wlr_output *wlr_output;
+	struct wl_listener rendered;
+	struct wl_listener commit;
+	struct wl_listener present;
+	struct wl_listener destroy;
+	struct series in_flight; /* client commit times shown by the last commit */
+	uint32_t in_flight_seq;
+
+	/* headless presents a frame before its commit event */
+	bool presented;
+	uint32_t presented_seq;
+	int64_t presented_nsec;
+};
+
+struct bench_surface {
+	struct bench *bench;
+	struct wlr_surface *surface;
+	int64_t pending_commit; /* 0 until the next client commit */
+	struct wl_listener commit;
+	struct wl_listener destroy;
+	struct wl_list link;
+};
+
+static const struct wlr_pointer_impl pointer_impl = {
+	.name = "bench-pointer",
+};
+
+static const struct wlr_keyboard_impl keyboard_impl = {
+	.name = "bench-keyboard",
+};
+
+static int64_t cpu_nsec(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void series_add(struct series *series, int64_t value)
+{
+	int64_t *values;
+
+	if (series->len == series->cap) {
+		size_t cap = series->cap ? series->cap * 2 : 1024;
+
+		values = realloc(series->values, cap * sizeof(*values));
+		if (!values)
+			return;
+		series->values = values;
+		series->cap = cap;
+	}
+	series->values[series->len++] = value;
+}
+
+static void series_print(const char *name, struct series *series, bool last)
+{
+	size_t n = series->len;
+
+	printf("  \"%s\": {\"count\": %zu", name, n);
+	if (n > 0) {
+		qsort(series->values, n, sizeof(*series->values), bench_compare_int64);
+		printf(", \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+		       "\"max_us\": %.1f",
+		       series->values[n / 2] / 1000.0,
+		       series->values[n * 90 / 100] / 1000.0,
+		       series->values[n * 99 / 100] / 1000.0,
+		       series->values[n - 1] / 1000.0);
+	}
+	printf("}%s\n", last ? "" : ",");
+}
+
+static void surface_commit(struct wl_listener *listener, void *data)
+{
+	struct bench_surface *surface = wl_container_of(listener, surface, commit);
+
+	/* the oldest commit not yet on screen is the one that waits longest */
+	if (!surface->pending_commit)
+		surface->pending_commit = bench_now_nsec();
+}
+
+static void surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct bench_surface *surface = wl_container_of(listener, surface, destroy);
+
+	wl_list_remove(&surface->commit.link);
+	wl_list_remove(&surface->destroy.link);
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static void new_xdg_surface(struct wl_listener *listener, void *data)
+{
+	struct bench *bench = wl_container_of(listener, bench, new_xdg_surface);
+	struct wlr_xdg_surface *xdg_surface = data;
+	struct bench_surface *surface;
+
+	surface = calloc(1, sizeof(*surface));
+	if (!surface)
+		return;
+	surface->bench = bench;
+	surface->surface = xdg_surface->surface;
+	surface->commit.notify = surface_commit;
+	wl_signal_add(&xdg_surface->surface->events.commit, &surface->commit);
+	surface->destroy.notify = surface_destroy;
+	wl_signal_add(&xdg_surface->surface->events.destroy, &surface->destroy);
+	wl_list_insert(&bench->surfaces, &surface->link);
+}
+
+static void collect_commit_iterator(struct wlr_scene_buffer *buffer,
+				    int sx, int sy, void *data)
+{
+	struct bench_output *output = data;
+	struct wlr_scene_surface *scene_surface;
+	struct bench_surface *surface;
+
+	scene_surface = wlr_scene_surface_from_buffer(buffer);
+	if (!scene_surface)
+		return;
+
+	wl_list_for_each(surface, &output->bench->surfaces, link) {
+		if (surface->surface != scene_surface->surface)
+			continue;
+		if (surface->pending_commit) {
+			series_add(&output->in_flight, surface->pending_commit);
+			surface->pending_commit = 0;
+		}
+		break;
+	}
+}
+
+static void output_resolve(struct bench_output *output, int64_t when)
+{
+	size_t i;
+
+	for (i = 0; when && i < output->in_flight.len; i++)
+		series_add(&output->bench->commit_to_present,
+			   when - output->in_flight.values[i]);
+	output->in_flight.len = 0;
+}
+
+static void output_rendered(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output = wl_container_of(listener, output, rendered);
+	int64_t *duration = data;
+
+	output->bench->frames++;
+	series_add(&output->bench->frame_time, *duration);
+}
+
+static void output_commit(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output = wl_container_of(listener, output, commit);
+	struct wlr_output_event_commit *event = data;
+	struct bench *bench = output->bench;
+	struct wlr_scene_output *scene_output;
+
+	if (!(event->committed & WLR_OUTPUT_STATE_BUFFER))
+		return;
+
+	if (bench->pending_input) {
+		series_add(&bench->input_to_frame, bench_now_nsec() - bench->pending_input);
+		bench->pending_input = 0;
+	}
+
+	scene_output = wlr_scene_get_scene_output(bench->server->scene,
+						  output->wlr_output);
+	if (scene_output)
+		wlr_scene_output_for_each_buffer(scene_output,
+						 collect_commit_iterator, output);
+	output->in_flight_seq = output->wlr_output->commit_seq;
+
+	if (output->presented && output->presented_seq == output->in_flight_seq)
+		output_resolve(output, output->presented_nsec);
+}
+
+static void output_present(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output = wl_container_of(listener, output, present);
+	struct wlr_output_event_present *event = data;
+	int64_t when = 0;
+
+	if (event->presented && event->when)
+		when = (int64_t)event->when->tv_sec * 1000000000 +
+			event->when->tv_nsec;
+
+	output->presented = when != 0;
+	output->presented_seq = event->commit_seq;
+	output->presented_nsec = when;
+	if (event->commit_seq == output->in_flight_seq)
+		output_resolve(output, when);
+}
+
+static void output_destroy(struct wl_listener *listener, void *data)
+{
+	struct bench_output *output = wl_container_of(listener, output, destroy);
+
+	wl_list_remove(&output->rendered.link);
+	wl_list_remove(&output->commit.link);
+	wl_list_remove(&output->present.link);
+	wl_list_remove(&output->destroy.link);
+	free(output->in_flight.values);
+	free(output);
+}
+
+static bool watch_outputs(struct bench *bench)
+{
+	struct wlrston_output *wlrston_output;
+	struct bench_output *output;
+
+	wl_list_for_each(wlrston_output, &bench->server->output_list, link) {
+		output = calloc(1, sizeof(*output));
+		if (!output)
+			return false;
+		output->bench = bench;
+		output->wlr_output = wlrston_output->wlr_output;
+
+		output->rendered.notify = output_rendered;
+		wl_signal_add(&wlrston_output->events.rendered, &output->rendered);
+		output->commit.notify = output_commit;
+		wl_signal_add(&output->wlr_output->events.commit, &output->commit);
+		output->present.notify = output_present;
+		wl_signal_add(&output->wlr_output->events.present, &output->present);
+		output->destroy.notify = output_destroy;
+		wl_signal_add(&output->wlr_output->events.destroy, &output->destroy);
+	}
+	return true;
+}
+
+static int input_timer(void *data)
+{
+	struct bench *bench = data;
+	struct wlr_pointer_motion_absolute_event motion = { 0 };
+	struct wlr_keyboard_key_event key = { 0 };
+	uint32_t time_msec = bench_now_nsec() / 1000000;
+	double angle;
+
+	wl_event_source_timer_update(bench->input_timer,
+				     1000 / bench->options.input_rate);
+
+	if (!bench->pending_input)
+		bench->pending_input = bench_now_nsec();
+
+	/* circle across all outputs, passing over every client */
+	bench->input_ticks++;
+	angle = bench->input_ticks * 0.05;
+	motion.pointer = &bench->pointer;
+	motion.time_msec = time_msec;
+	motion.x = 0.5 + 0.4 * cos(angle);
+	motion.y = 0.5 + 0.4 * sin(angle);
+	wl_signal_emit(&bench->pointer.events.motion_absolute, &motion);
+	wl_signal_emit(&bench->pointer.events.frame, &bench->pointer);
+
+	if (bench->input_ticks % KEY_EVERY_N_MOTIONS == 0) {
+		key.time_msec = time_msec;
+		key.keycode = KEY_A;
+		key.update_state = true;
+		key.state = WL_KEYBOARD_KEY_STATE_PRESSED;
+		wlr_keyboard_notify_key(&bench->keyboard, &key);
+		key.state = WL_KEYBOARD_KEY_STATE_RELEASED;
+		wlr_keyboard_notify_key(&bench->keyboard, &key);
+	}
+
+	return 0;
+}
+
+static int stop_timer(void *data)
+{
+	struct bench *bench = data;
+
+	wl_display_terminate(bench->harness.display);
+	return 0;
+}
+
+static bool start_clients(struct bench *bench)
+{
+	int i;
+
+	bench->clients = calloc(bench->options.clients, sizeof(*bench->clients));
+	if (!bench->clients)
+		return false;
+
+	for (i = 0; i < bench->options.clients; i++) {
+		bench->clients[i] = bench_harness_connect(&bench->harness, 1,
+							  bench->options.client_width,
+							  bench->options.client_height,
+							  bench->options.rate);
+		if (!bench->clients[i])
+			return false;
+	}
+	return true;
+}
+
+static void stop_clients(struct bench *bench, struct bench_client_stats *total)
+{
+	struct bench_client_stats stats;
+	int i;
+
+	if (!bench->clients)
+		return;
+
+	for (i = 0; i < bench->options.clients; i++) {
+		if (!bench->clients[i])
+			continue;
+		bench_client_stop(bench->clients[i], &stats);
+		total->commits += stats.commits;
+		total->skipped += stats.skipped;
+		total->failed |= stats.failed;
+	}
+	free(bench->clients);
+	bench->clients = NULL;
+}
+
+static void report(struct bench *bench, struct bench_client_stats *clients,
+		   int64_t thread_cpu, int64_t process_cpu)
+{
+	uint64_t frames = bench->frames ? bench->frames : 1;
+
+	printf("{\n");
+	printf("  \"outputs\": %d, \"output_size\": \"%dx%d\", \"clients\": %d, "
+	       "\"client_rate\": %d, \"input_rate\": %d, \"duration_s\": %d,\n",
+	       bench->options.outputs, bench->options.output_width,
+	       bench->options.output_height, bench->options.clients,
+	       bench->options.rate, bench->options.input_rate,
+	       bench->options.duration);
+	printf("  \"frames\": %" PRIu64 ", \"client_commits\": %" PRIu64
+	       ", \"client_skipped\": %" PRIu64 ",\n",
+	       bench->frames, clients->commits, clients->skipped);
+	printf("  \"cpu_per_frame_us\": {\"main_thread\": %.1f, \"process\": %.1f},\n",
+	       thread_cpu / 1000.0 / frames, process_cpu / 1000.0 / frames);
+	series_print("frame_time", &bench->frame_time, false);
+	series_print("commit_to_present", &bench->commit_to_present, false);
+	series_print("input_to_frame", &bench->input_to_frame, true);
+	printf("}\n");
+}
+
+static bool parse_size(const char *arg, int *width, int *height)
+{
+	return sscanf(arg, "%dx%d", width, height) == 2 &&
+		*width > 0 && *height > 0;
+}
+
+static bool parse_int(const char *arg, int *value, int min)
+{
+	char *end;
+	long v;
+
+	v = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || v < min || v > 100000)
+		return false;
+
+	*value = v;
+	return true;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	       "  -o, --outputs=N            headless outputs (default: 2)\n"
+	       "  -O, --output-size=WxH      output size (default: 1920x1080)\n"
+	       "  -c, --clients=N            synthetic clients (default: 4)\n"
+	       "  -C, --client-size=WxH      client buffer size (default: 800x600)\n"
+	       "  -r, --rate=HZ              client commit rate (default: 60)\n"
+	       "  -i, --input-rate=HZ        pointer event rate (default: 250)\n"
+	       "  -d, --duration=SEC         run time (default: 5)\n"
+	       "  -h, --help                 show this help\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "outputs", required_argument, NULL, 'o' },
+		{ "output-size", required_argument, NULL, 'O' },
+		{ "clients", required_argument, NULL, 'c' },
+		{ "client-size", required_argument, NULL, 'C' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "input-rate", required_argument, NULL, 'i' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct bench bench = {
+		.options = {
+			.outputs = 2,
+			.output_width = 1920, .output_height = 1080,
+			.clients = 4,
+			.client_width = 800, .client_height = 600,
+			.rate = 60,
+			.input_rate = 250,
+			.duration = 5,
+		},
+	};
+	struct bench_options *options = &bench.options;
+	struct bench_client_stats clients = { 0 };
+	struct wl_event_loop *loop;
+	int64_t thread_cpu, process_cpu;
+	bool ok = true;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "o:O:c:C:r:i:d:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			ok = parse_int(optarg, &options->outputs, 1);
+			break;
+		case 'O':
+			ok = parse_size(optarg, &options->output_width,
+					&options->output_height);
+			break;
+		case 'c':
+			ok = parse_int(optarg, &options->clients, 0);
+			break;
+		case 'C':
+			ok = parse_size(optarg, &options->client_width,
+					&options->client_height);
+			break;
+		case 'r':
+			ok = parse_int(optarg, &options->rate, 1);
+			break;
+		case 'i':
+			ok = parse_int(optarg, &options->input_rate, 1);
+			break;
+		case 'd':
+			ok = parse_int(optarg, &options->duration, 1);
+			break;
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+		if (!ok) {
+			fprintf(stderr, "invalid value '%s'\n", optarg);
+			return 1;
+		}
+	}
+	if (options->input_rate > 1000)
+		options->input_rate = 1000;
+
+	/* a user's setting wins, so that other renderers can be measured */
+	bench_harness_setup_env(true);
+
+	wl_list_init(&bench.surfaces);
+	wl_list_init(&bench.new_xdg_surface.link);
+
+	if (!bench_harness_create(&bench.harness))
+		return 1;
+	bench.server = bench.harness.server;
+	loop = bench.harness.loop;
+
+	bench.new_xdg_surface.notify = new_xdg_surface;
+	wl_signal_add(&bench.server->xdg_shell->events.new_surface,
+		      &bench.new_xdg_surface);
+
+	if (!bench_harness_start(&bench.harness, options->outputs,
+				 options->output_width, options->output_height))
+		goto out_server;
+	if (!watch_outputs(&bench))
+		goto out_server;
+
+	wlr_pointer_init(&bench.pointer, &pointer_impl, pointer_impl.name);
+	wlr_keyboard_init(&bench.keyboard, &keyboard_impl, keyboard_impl.name);
+	wl_signal_emit(&bench.server->backend->events.new_input,
+		       &bench.pointer.base);
+	wl_signal_emit(&bench.server->backend->events.new_input,
+		       &bench.keyboard.base);
+
+	if (!start_clients(&bench))
+		goto out_clients;
+
+	bench.input_timer = wl_event_loop_add_timer(loop, input_timer, &bench);
+	bench.stop_timer = wl_event_loop_add_timer(loop, stop_timer, &bench);
+	if (!bench.input_timer || !bench.stop_timer)
+		goto out_clients;
+	wl_event_source_timer_update(bench.input_timer,
+				     1000 / options->input_rate);
+	wl_event_source_timer_update(bench.stop_timer, options->duration * 1000);
+
+	thread_cpu = cpu_nsec(CLOCK_THREAD_CPUTIME_ID);
+	process_cpu = cpu_nsec(CLOCK_PROCESS_CPUTIME_ID);
+	wl_display_run(bench.harness.display);
+	thread_cpu = cpu_nsec(CLOCK_THREAD_CPUTIME_ID) - thread_cpu;
+	process_cpu = cpu_nsec(CLOCK_PROCESS_CPUTIME_ID) - process_cpu;
+
+	stop_clients(&bench, &clients);
+	report(&bench, &clients, thread_cpu, process_cpu);
+
+out_clients:
+	stop_clients(&bench, &clients);
+	if (bench.input_timer)
+		wl_event_source_remove(bench.input_timer);
+	if (bench.stop_timer)
+		wl_event_source_remove(bench.stop_timer);
+	wlr_keyboard_finish(&bench.keyboard);
+	wlr_pointer_finish(&bench.pointer);
+out_server:
+	wl_list_remove(&bench.new_xdg_surface.link);
+	bench_harness_destroy(&bench.harness);
+	free(bench.frame_time.values);
+	free(bench.commit_to_present.values);
+	free(bench.input_to_frame.values);
+
+	return bench.frames > 0 && !clients.failed ? 0 : 1;
+}
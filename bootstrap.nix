@@ -12,8 +12,10 @@ pkgs.mkShell {
     pkgs.wayland-scanner
     pkgs.libxkbcommon.dev
     pkgs.pixman
+    pkgs.libdrm.dev
     pkgs.wayland-protocols
     pkgs.ninja
     pkgs.udev.dev
+    pkgs.xwayland
   ];
 }
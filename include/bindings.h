@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef BINDINGS_H
+#define BINDINGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Key bindings, compiled into one open-addressing hash table keyed on
+ * (mode, keysym or keycode, modifiers), so that a key event costs a
+ * single probe however many keys are bound.
+ *
+ * Config file lines, '#' starts a comment:
+ *
+ *   mode NAME [--grab]
+ *   bind [--release] [--mode NAME] MODS+KEYSYM ACTION [ARGS]
+ *   bindcode [--release] [--mode NAME] MODS+KEYCODE ACTION [ARGS]
+ *
+ * MODS are Shift, Ctrl, Alt, Super, Mod3 and Mod5, joined by '+'. Keysyms
+ * match the key's unshifted symbol, so Shift is given as a modifier.
+ * Keycodes are evdev codes. Actions are exit, focus-next, close,
+ * exec CMD and mode NAME. focus-next opens the window switcher, pressed
+ * again it selects the next view, which is focused once the modifiers
+ * are let go. A --grab mode swallows the keys it does not
+ * bind, the default mode passes them on to clients.
+ */
+
+enum binding_action {
+	BINDING_EXIT,
+	BINDING_FOCUS_NEXT,
+	BINDING_CLOSE,
+	BINDING_EXEC,
+	BINDING_MODE,
+};
+
+struct binding {
+	uint64_t key; /* 0 for an empty slot */
+	enum binding_action action;
+	bool release; /* runs when the key is released */
+	int mode; /* target of BINDING_MODE */
+	char *command; /* BINDING_EXEC */
+};
+
+struct binding_mode {
+	char *name;
+	bool grab;
+};
+
+struct bindings {
+	struct binding *slots;
+	size_t n_slots; /* power of two */
+	size_t n_bindings;
+	size_t n_keycodes; /* bindcode entries, skips a probe when zero */
+
+	struct binding_mode *modes; /* modes[0] is "default" */
+	int n_modes;
+};
+
+/* Evdev keycodes that can be tracked, KEY_MAX + 1. */
+#define BINDING_KEYCODES 768
+#define BINDING_MAX_RELEASES 8
+
+/* Per-seat progress through the bindings. */
+struct binding_state {
+	int mode;
+	uint8_t swallowed[BINDING_KEYCODES / 8]; /* release is not forwarded */
+	struct {
+		uint32_t keycode;
+		const struct binding *binding;
+	} releases[BINDING_MAX_RELEASES];
+	int n_releases;
+};
+
+/* Starts out with the default mode and no bindings. */
+bool bindings_init(struct bindings *bindings);
+
+/* The built-in bindings, used when there is no config file. */
+bool bindings_add_defaults(struct bindings *bindings);
+
+/*
+ * Replaces the bindings with those of the file at path. Returns false and
+ * keeps the current bindings if the file cannot be read. Bad lines are
+ * logged and skipped.
+ */
+bool bindings_load(struct bindings *bindings, const char *path);
+
+void bindings_finish(struct bindings *bindings);
+
+/* modifiers are WLR_MODIFIER_* bits, lock modifiers are ignored. */
+const struct binding *bindings_lookup_keysym(const struct bindings *bindings,
+					     int mode, uint32_t modifiers,
+					     uint32_t keysym);
+
+const struct binding *bindings_lookup_keycode(const struct bindings *bindings,
+					      int mode, uint32_t modifiers,
+					      uint32_t keycode);
+
+#endif
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef CLIENTS_H
+#define CLIENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <wayland-server-core.h>
+
+struct wlrston_server;
+
+/*
+ * What each client costs: its surfaces and popups, its commits and damage
+ * over the last second, and the memory its current buffers hold. Shm
+ * buffers count twice, once for the client's pool and once for the texture
+ * they are uploaded to. Clients going over the limits are disconnected
+ * with a protocol error.
+ *
+ * With a commit budget, each client gets its surface state applied at
+ * most that many times per event loop iteration. Commits over the budget
+ * are held back as cached surface state and applied at the end of later
+ * iterations, after the input and output sources of those iterations ran.
+ *
+ * Exempt clients are accounted but never limited. Xwayland is one client
+ * for all X11 applications, limits meant for one application would hit
+ * them all at once.
+ */
+
+struct client_limits {
+	uint64_t memory_bytes; /* shm and textures, 0 is unlimited */
+	bool buffer_output_size; /* no buffer larger than the largest output */
+	int commits_per_iteration; /* 0 is unbounded */
+};
+
+struct client_account {
+	struct client_tracker *tracker;
+	struct wl_client *client;
+	struct wl_list link; /* client_tracker::accounts */
+	struct wl_list surfaces; /* client_surface::link */
+	struct wl_listener destroy;
+
+	pid_t pid;
+	char name[16]; /* from /proc, may be empty */
+	bool disconnecting;
+	bool exempt; /* from the limits */
+
+	int n_surfaces;
+	int n_popups;
+	uint64_t shm_bytes;
+	uint64_t texture_bytes;
+
+	uint64_t commits;
+	uint64_t damage_px;
+
+	/* commit budget of the iteration */
+	int iteration_commits;
+	struct wl_list deferred; /* client_deferred::link, oldest first */
+	int n_deferred;
+	uint64_t commits_deferred;
+
+	/* the current second, and the last full one */
+	int64_t window_start_msec;
+	uint64_t window_commits, window_damage_px;
+	uint64_t commits_per_sec, damage_px_per_sec;
+};
+
+struct client_tracker {
+	struct wlrston_server *server;
+	struct client_limits limits;
+	struct wl_list accounts; /* client_account::link */
+	struct wl_listener new_surface;
+	struct wl_listener new_xdg_surface;
+
+	struct wl_event_source *release_idle; /* end of the iteration */
+	struct wl_event_source *wakeup; /* deferred commits are left */
+	int wakeup_fd;
+};
+
+bool client_tracker_init(struct client_tracker *tracker,
+			 struct wlrston_server *server);
+
+void client_tracker_finish(struct client_tracker *tracker);
+
+void client_tracker_exempt(struct client_tracker *tracker,
+			   struct wl_client *client);
+
+/* Rates of the last full second, 0 once a client went quiet. */
+void client_account_rates(struct client_account *account,
+			  uint64_t *commits_per_sec, uint64_t *damage_px_per_sec);
+
+#endif
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef CURSOR_THEME_H
+#define CURSOR_THEME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-server-core.h>
+
+struct wlr_cursor;
+
+/*
+ * XCursor theme loaded once per output scale, on a thread so that reading
+ * the theme files never blocks the main loop. Images are looked up by name
+ * on first use and remembered per scale.
+ */
+struct cursor_theme;
+
+/* Called on the main thread when another scale becomes usable. */
+typedef void (*cursor_theme_loaded_func_t)(void *data);
+
+struct cursor_theme *
+cursor_theme_create(const char *name, uint32_t size, struct wl_event_loop *loop,
+		    cursor_theme_loaded_func_t loaded, void *data);
+
+void cursor_theme_destroy(struct cursor_theme *theme);
+
+/* Starts loading the theme for scale, unless it is loaded or queued. */
+void cursor_theme_load(struct cursor_theme *theme, float scale);
+
+/*
+ * Shows the named image at every loaded scale. Returns false if no scale
+ * is loaded yet or the theme lacks the image. The name is remembered
+ * as is, it must outlive the theme.
+ */
+bool cursor_theme_set_image(struct cursor_theme *theme,
+			    struct wlr_cursor *cursor, const char *name);
+
+#endif
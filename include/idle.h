@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-server-core.h>
+
+struct wlrston_server;
+
+/*
+ * Input activity for ext-idle-notify clients and for powering the outputs
+ * down. After timeout_msec without input every output is disabled, which
+ * also stops its frames, and the next input turns them back on. Visible
+ * idle inhibitors hold the timeout off. wlr-output-power-management lets
+ * other tools switch outputs on and off too.
+ */
+struct idle_tracker {
+	struct wlrston_server *server;
+	struct wlr_idle_notifier_v1 *notifier;
+	struct wlr_idle_inhibit_manager_v1 *inhibit_manager;
+	struct wlr_output_power_manager_v1 *power_manager;
+	struct wl_listener new_inhibitor;
+	struct wl_listener set_power_mode;
+
+	struct wl_event_source *timer;
+	int timeout_msec; /* 0 never powers down */
+	int64_t activity_msec; /* last input, CLOCK_MONOTONIC */
+	bool idle; /* outputs powered down by the timeout */
+};
+
+bool idle_tracker_init(struct idle_tracker *tracker,
+		       struct wlrston_server *server);
+
+void idle_tracker_finish(struct idle_tracker *tracker);
+
+void idle_tracker_set_timeout(struct idle_tracker *tracker, int timeout_msec);
+
+/* Called by the seat for every input event. */
+void idle_tracker_activity(struct idle_tracker *tracker);
+
+/* Called once views were shown, hidden or covered. */
+void idle_tracker_update_inhibited(struct idle_tracker *tracker);
+
+#endif
@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef INPUT_THREAD_H
+#define INPUT_THREAD_H
+
+struct wlrston_server;
+
+/*
+ * Reads libinput devices on a thread of their own, so that input is read
+ * and timestamped on time while the main loop is busy. Events reach the
+ * main loop through a single-producer single-consumer ring and are replayed
+ * on stand-in devices, which the seat handles like any other.
+ */
+struct input_thread;
+
+/* Takes over from the backend's libinput, call before the backend starts. */
+struct input_thread *input_thread_create(struct wlrston_server *server);
+
+void input_thread_destroy(struct input_thread *thread);
+
+#endif
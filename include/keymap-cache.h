@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef KEYMAP_CACHE_H
+#define KEYMAP_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct wlr_keyboard;
+struct xkb_context;
+struct xkb_keymap;
+
+/*
+ * The seat's XKB keymap. Compiling it from RMLVO names is slow, so the
+ * compiled text is cached on disk, keyed by the names and the xkbcommon
+ * version. The text is kept in one sealed memfd that every keyboard hands
+ * out to clients.
+ */
+struct keymap_cache {
+	struct xkb_keymap *keymap;
+	int fd;
+	size_t size; /* including the terminating NUL */
+};
+
+/* Uses the XKB_DEFAULT_* environment like xkb_keymap_new_from_names(). */
+bool keymap_cache_init(struct keymap_cache *cache, struct xkb_context *context);
+
+void keymap_cache_finish(struct keymap_cache *cache);
+
+/* Sets the keymap on keyboard, sharing the cache's fd with it. */
+bool keymap_cache_apply(struct keymap_cache *cache,
+			struct wlr_keyboard *keyboard);
+
+#endif
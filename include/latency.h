@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-server-core.h>
+
+struct wlr_compositor;
+struct wlr_output_event_present;
+struct wlr_scene_output;
+
+/*
+ * Input-to-photon tracing. An input event delivered to a client is taken
+ * as answered by the next buffer that client commits. That commit is shown
+ * by the next output frame that contains the surface, and the latency runs
+ * from the input's device timestamp to that frame's presentation.
+ */
+
+/* 1 ms buckets, the last one also holds everything slower. */
+#define LATENCY_BUCKETS 101
+
+struct latency_histogram {
+	uint64_t buckets[LATENCY_BUCKETS];
+	uint64_t count;
+	int64_t sum_nsec;
+	int64_t max_nsec;
+};
+
+/* Inputs waiting for an answer, by client. */
+#define LATENCY_MAX_PENDING 8
+
+struct latency_tracker {
+	struct wl_listener new_surface;
+	struct {
+		struct wl_client *client;
+		int64_t input_nsec; /* oldest unanswered input */
+	} pending[LATENCY_MAX_PENDING];
+	int n_pending;
+};
+
+struct latency_output {
+	struct latency_histogram histogram;
+
+	/* answered inputs shown by committed frames, waiting for present */
+	struct latency_frame_input {
+		int64_t input_nsec;
+		uint32_t commit_seq;
+	} *in_flight;
+	size_t n_in_flight, cap_in_flight;
+
+	/* backends may present a frame before its commit event */
+	bool presented;
+	uint32_t presented_seq;
+	int64_t presented_nsec;
+};
+
+void latency_tracker_init(struct latency_tracker *tracker,
+			  struct wlr_compositor *compositor);
+
+void latency_tracker_finish(struct latency_tracker *tracker);
+
+/* Records an input event sent to client, time_msec from the device. */
+void latency_input(struct latency_tracker *tracker, struct wl_client *client,
+		   uint32_t time_msec);
+
+/* Collects the answered commits shown by the frame just committed. */
+void latency_output_commit(struct latency_output *output,
+			   struct wlr_scene_output *scene_output,
+			   uint32_t commit_seq);
+
+void latency_output_present(struct latency_output *output,
+			    const struct wlr_output_event_present *event);
+
+void latency_output_finish(struct latency_output *output);
+
+/* Upper bound of the bucket holding the percentile, in nsec. */
+int64_t latency_histogram_percentile(const struct latency_histogram *histogram,
+				     int percent);
+
+#endif
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wlr/util/log.h>
+
+/*
+ * wlr_log() sink that formats messages into a lock-free ring, written out
+ * to stderr by a thread of its own. Any thread may log. A full ring drops
+ * the message and counts it, logging never waits. What is still in the
+ * ring is lost if the process crashes; --sync-log writes directly instead.
+ */
+
+/* Slots in the ring, a power of two. */
+#define LOGGER_SLOTS 4096
+/* Longer messages are cut. */
+#define LOGGER_LINE 240
+
+/* Starts the thread and takes over wlr_log() at the given level. */
+bool logger_init(enum wlr_log_importance level);
+
+/* Writes out what is left and goes back to logging directly. */
+void logger_finish(void);
+
+/* Takes effect at once, with or without the thread. */
+void logger_set_level(enum wlr_log_importance level);
+
+const char *logger_level_name(enum wlr_log_importance level);
+
+bool logger_parse_level(const char *name, enum wlr_log_importance *level);
+
+uint64_t logger_dropped(void);
+
+#endif
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_CACHE_LINE 64
+
+/*
+ * Fixed-size objects of one type, carved out of cache line aligned slabs.
+ * Freed objects go on a free list and are handed out again most recent
+ * first, so allocation costs the same however long the compositor runs
+ * and windows coming and going do not scatter small holes over the heap.
+ * Slabs are kept until pool_finish(), memory stays at the peak count.
+ */
+struct pool_slab;
+
+struct pool {
+	const char *name;
+	size_t size; /* object size */
+	size_t stride; /* object size rounded up to a cache line */
+	size_t per_slab;
+	void *free_list;
+	struct pool_slab *slabs;
+
+	size_t n_slabs;
+	size_t live, peak;
+};
+
+void pool_init(struct pool *pool, const char *name, size_t size);
+
+/* Frees the slabs, unless objects are still alive. */
+void pool_finish(struct pool *pool);
+
+/* Returns a zeroed object, NULL when out of memory. */
+void *pool_zalloc(struct pool *pool);
+
+void pool_free(struct pool *pool, void *object);
+
+#endif
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct wlrston_server;
+
+/*
+ * Opt-in timing of event loop callbacks. Each listener starts with
+ * PROFILE_LISTENER(), which times the call when profiling is on and costs
+ * a branch when it is off. Sites are named <file>.<function>, static
+ * listeners of the same name in different files are kept apart. Times include nested dispatches, e.g.
+ * output_frame includes the listeners it signals. An event loop iteration
+ * spends from the first callback it runs until its idle sources ran; one
+ * that spends more than the shortest refresh interval is logged.
+ */
+
+/* buckets[N] counts calls under 2^N us not in N - 1, the last is open */
+#define PROFILE_BUCKETS 16
+
+/* slowest recent dispatches kept */
+#define PROFILE_SLOW_RING 32
+
+#define PROFILE_NAME_MAX 64
+
+struct profile_site {
+	char name[PROFILE_NAME_MAX]; /* empty until registered */
+	struct profile_site *next; /* registered on its first call */
+	uint64_t calls;
+	int64_t total_nsec;
+	int64_t max_nsec;
+	uint64_t buckets[PROFILE_BUCKETS];
+};
+
+struct profile_scope {
+	struct profile_site *site; /* NULL when not profiling */
+	int64_t start_nsec;
+};
+
+extern bool profile_enabled;
+
+struct profile_scope profile_start(struct profile_site *site,
+				   const char *file, const char *func);
+
+void profile_stop(struct profile_scope *scope);
+
+static inline struct profile_scope
+profile_begin(struct profile_site *site, const char *file, const char *func)
+{
+	struct profile_scope scope = { NULL, 0 };
+
+	if (profile_enabled)
+		scope = profile_start(site, file, func);
+	return scope;
+}
+
+static inline void profile_end(struct profile_scope *scope)
+{
+	if (scope->site)
+		profile_stop(scope);
+}
+
+#define PROFILE_LISTENER() \
+	static struct profile_site profile_site_; \
+	struct profile_scope profile_scope_ \
+		__attribute__((cleanup(profile_end), unused)) = \
+		profile_begin(&profile_site_, __FILE__, __func__)
+
+void profile_init(struct wlrston_server *server);
+
+void profile_finish(void);
+
+/* Writes the counters as stats lines, see stats_write(). */
+void profile_dump(FILE *f);
+
+#endif
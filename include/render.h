@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-server-core.h>
+
+struct wlr_allocator;
+struct wlr_output;
+struct wlr_scene;
+
+/*
+ * Renders one output with pixman on a thread of its own. The main thread
+ * snapshots the buffers and rects the scene shows on the output, the worker
+ * composites them into a buffer of its own, and the main thread commits
+ * that buffer once the worker is done. Client buffers stay locked while
+ * the worker reads them.
+ */
+struct render_worker;
+
+/* Called on the main thread after the frame has been committed. */
+typedef void (*render_done_func_t)(void *data, int64_t duration_nsec);
+
+struct render_worker *
+render_worker_create(struct wlr_output *output, struct wlr_scene *scene,
+		     struct wlr_allocator *allocator, struct wl_event_loop *loop,
+		     render_done_func_t done, void *data);
+
+void render_worker_destroy(struct render_worker *worker);
+
+/*
+ * Starts rendering the next frame. If the worker cannot draw it, for
+ * example because of a rotated output or buffer, this returns false and
+ * the caller renders the frame on the main thread.
+ */
+bool render_worker_submit(struct render_worker *worker);
+
+#endif
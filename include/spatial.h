@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wlr/util/box.h>
+
+/*
+ * Uniform grid over layout coordinates. Each entry is stored in every cell
+ * its box touches, so a point query only looks at the entries of one cell.
+ * Entries covering too many cells are kept on a separate list that every
+ * query checks.
+ */
+struct spatial_entry {
+	struct wlr_box box;
+	uint64_t z; /* stacking order, higher is on top, unique */
+	void *data;
+
+	/* private state */
+	bool indexed;
+	bool oversized;
+};
+
+struct spatial_cell;
+
+struct spatial_index {
+	struct spatial_cell *cells;
+	size_t n_cells; /* power of two */
+	size_t n_used;
+
+	struct spatial_entry **oversized;
+	size_t n_oversized, cap_oversized;
+};
+
+typedef bool (*spatial_accept_func_t)(struct spatial_entry *entry,
+				      double x, double y, void *data);
+
+void spatial_index_init(struct spatial_index *index);
+
+void spatial_index_finish(struct spatial_index *index);
+
+void spatial_index_insert(struct spatial_index *index,
+			  struct spatial_entry *entry,
+			  const struct wlr_box *box);
+
+void spatial_index_remove(struct spatial_index *index,
+			  struct spatial_entry *entry);
+
+void spatial_index_update(struct spatial_index *index,
+			  struct spatial_entry *entry,
+			  const struct wlr_box *box);
+
+/*
+ * Returns the topmost entry containing (x, y) for which accept returns
+ * true, or NULL. A NULL accept takes the topmost entry.
+ */
+struct spatial_entry *
+spatial_index_at(struct spatial_index *index, double x, double y,
+		 spatial_accept_func_t accept, void *data);
+
+#endif
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef SWITCHER_H
+#define SWITCHER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-server-core.h>
+
+struct wlr_drm_format;
+struct wlr_output;
+struct wlr_scene_buffer;
+struct wlr_scene_rect;
+struct wlr_scene_tree;
+struct wlrston_server;
+struct wlrston_view;
+
+/*
+ * Window switcher showing the views in most recently focused order, each
+ * with a thumbnail. Thumbnails are cached downscaled snapshots of the
+ * view, taken again only once the view has been damaged by a good part of
+ * its area. Snapshots are taken after the frames of one output, the one
+ * the switcher is or would be on, a few per frame, so opening the switcher
+ * only lays out what is cached. Each view has two thumbnail buffers, a
+ * snapshot goes into the one not on screen.
+ */
+
+/* Size a thumbnail fits into. */
+#define THUMBNAIL_WIDTH 256
+#define THUMBNAIL_HEIGHT 160
+
+struct view_thumbnail {
+	struct wlr_buffer *buffer; /* NULL until the first snapshot */
+	struct wlr_buffer *back; /* the previous snapshot, drawn over next */
+	int src_width, src_height; /* geometry the snapshot was taken at */
+	uint64_t damage; /* damaged pixels since the snapshot */
+	bool queued;
+	struct wl_list link; /* switcher::queue */
+};
+
+struct switcher_entry {
+	struct wlrston_view *view;
+	int x, y; /* cell origin, layout coords */
+	struct wlr_scene_buffer *thumbnail; /* NULL while there is none */
+	struct wlr_scene_rect *placeholder;
+};
+
+struct switcher {
+	struct wlrston_server *server;
+	struct wlr_scene_tree *layer; /* above fullscreen views */
+	struct wl_list queue; /* view_thumbnail::link, snapshots to take */
+	struct wlr_drm_format *format;
+
+	/* the open switcher, tree is NULL when closed */
+	struct wlr_scene_tree *tree;
+	struct wlr_output *output;
+	struct wlr_scene_rect *highlight;
+	struct switcher_entry *entries;
+	int n_entries;
+	int selected;
+};
+
+bool switcher_init(struct switcher *switcher, struct wlrston_server *server);
+
+void switcher_finish(struct switcher *switcher);
+
+/* Opens the switcher, or selects the next view if it is open. */
+void switcher_next(struct switcher *switcher);
+
+/* Closes the switcher, focusing the selected view if focus is set. */
+void switcher_end(struct switcher *switcher, bool focus);
+
+/*
+ * Called after each output frame, takes queued snapshots for up to a
+ * frame's share of time if the switcher is on that output.
+ */
+void switcher_refresh(struct switcher *switcher, struct wlr_output *output);
+
+void switcher_view_map(struct wlrston_view *view);
+
+/* Called when the toplevel commits, accounts its damage. */
+void switcher_view_commit(struct wlrston_view *view);
+
+void switcher_view_unmap(struct wlrston_view *view);
+
+#endif
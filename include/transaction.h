@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include <wlr/util/box.h>
+
+struct wlrston_server;
+struct wlrston_view;
+
+/*
+ * Layout changes that touch several views at once, such as a view going
+ * fullscreen over others, are applied as one transaction: every view is
+ * sent its configure, the scene keeps showing the old buffers, and all
+ * views move together once each client has committed the new size or the
+ * transaction timed out. Changes made while dispatching one batch of
+ * events end up in the same transaction.
+ */
+struct transaction;
+
+/* Moves the view to box, layout coords of its window geometry. */
+void transaction_add_view(struct wlrston_view *view, const struct wlr_box *box);
+
+/* Called when the toplevel commits, with the new buffer already in place. */
+void transaction_view_commit(struct wlrston_view *view);
+
+/* Drops the view from any transaction, for unmap. */
+void transaction_remove_view(struct wlrston_view *view);
+
+void transaction_finish(struct wlrston_server *server);
+
+#endif
@@ -6,25 +6,170 @@
 #ifndef VIEW_H
 #define VIEW_H
 
+#include <time.h>
+
 #include <wayland-server-core.h>
 
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/util/box.h>
+
+#include <spatial.h>
+#include <switcher.h>
+
+struct transaction_instruction;
 struct wlr_surface;
+struct wlr_xdg_popup;
+struct wlrston_view;
+
+/*
+ * What a view needs from the shell its surface comes from. configure()
+ * returns the serial the client acks the new size with, or 0 when there is
+ * nothing to wait for; acked() says whether the current state has caught
+ * up with a serial. set_position may be NULL.
+ */
+struct view_impl {
+	struct wlr_surface *(*get_surface)(struct wlrston_view *view);
+	/* window geometry, relative to the surface */
+	void (*get_geometry)(struct wlrston_view *view, struct wlr_box *box);
+	void (*for_each_surface)(struct wlrston_view *view,
+				 wlr_surface_iterator_func_t iterator,
+				 void *data);
+	struct wlrston_view *(*get_parent)(struct wlrston_view *view);
+	void (*set_activated)(struct wlrston_view *view, bool activated);
+	void (*set_fullscreen)(struct wlrston_view *view, bool fullscreen);
+	uint32_t (*configure)(struct wlrston_view *view, int width, int height);
+	bool (*acked)(struct wlrston_view *view, uint32_t serial);
+	void (*set_position)(struct wlrston_view *view, int x, int y);
+	void (*close)(struct wlrston_view *view);
+};
 
+/*
+ * Allocated from server::pools.views. What hit-testing, focus and the
+ * visibility passes read comes first, so it shares the first cache lines.
+ */
 struct wlrston_view {
 	struct wl_list link;
 	struct wlrston_server *server;
-	struct wlr_xdg_toplevel *xdg_toplevel;
+	const struct view_impl *impl;
+	struct wlr_xdg_toplevel *xdg_toplevel; /* NULL for X11 windows */
 	struct wlr_scene_tree *scene_tree;
+	int x, y;
+	bool mapped;
+	bool fullscreen;
+	bool culled; /* covered by a fullscreen view, scene node disabled */
+	bool occluded; /* nothing of it shows on any output */
+	struct spatial_entry spatial; /* server::view_index */
+
 	struct wl_listener map;
 	struct wl_listener unmap;
+	struct wl_listener commit;
 	struct wl_listener destroy;
 	struct wl_listener request_move;
 	struct wl_listener request_resize;
 	struct wl_listener request_maximize;
 	struct wl_listener request_fullscreen;
-	int x, y;
+
+	struct wlr_box saved_geometry; /* layout geometry before fullscreen */
+	struct wlrston_output *fullscreen_output;
+	int64_t hidden_frame_nsec; /* last frame callback while occluded */
+	struct wl_list popups;
+
+	/* see transaction.h */
+	struct transaction_instruction *instruction; /* latest, NULL if none */
+	struct wlr_scene_tree *saved_tree; /* old buffers shown meanwhile */
+
+	struct view_thumbnail thumbnail;
+
+	/*
+	 * Interactive resize, at most one configure in flight. The view stays
+	 * at the last geometry the client acked, saved_tree shows its buffers
+	 * stretched to the requested box meanwhile.
+	 */
+	struct {
+		uint32_t serial; /* configure in flight, 0 if none */
+		struct wl_event_source *timer; /* gives up on the ack */
+		bool pending; /* box has not been sent yet */
+		bool saved; /* saved_tree is the stretched copy */
+		uint32_t edges;
+		struct wlr_box box; /* latest requested geometry, layout coords */
+		struct wlr_box sent; /* geometry of the configure in flight */
+	} resize;
+};
+
+struct wlrston_popup {
+	struct wlrston_server *server;
+	struct wlr_xdg_popup *xdg_popup;
+	struct wlrston_view *view; /* NULL once the view is gone */
+	struct wl_list link; /* view::popups */
+	struct wl_listener commit;
+	struct wl_listener destroy;
 };
 
 void focus_view(struct wlrston_view *view, struct wlr_surface *surface);
 
+/* Called by the shells once the view has something to show, and before it goes. */
+void view_map(struct wlrston_view *view, bool fullscreen,
+	      struct wlr_output *fullscreen_output);
+
+void view_unmap(struct wlrston_view *view);
+
+/* Called when the view's surface commits while mapped. */
+void view_commit(struct wlrston_view *view);
+
+/* Starts a move or resize grab, if the pointer is on the view. */
+void view_begin_interactive(struct wlrston_view *view,
+			    enum wlrston_cursor_mode mode, uint32_t edges);
+
+struct wlrston_view *
+desktop_view_at(struct wlrston_server *server, double lx, double ly,
+		struct wlr_surface **surface, double *sx, double *sy);
+
+void view_raise(struct wlrston_view *view);
+
+struct wlrston_output *view_get_output(struct wlrston_view *view);
+
+void view_set_fullscreen(struct wlrston_view *view, bool fullscreen,
+			 struct wlr_output *wlr_output);
+
+void view_update_visibility(struct wlrston_view *view);
+
+void server_update_visibility(struct wlrston_server *server);
+
+void server_update_occlusion(struct wlrston_server *server);
+
+/*
+ * Shows a copy of the view's buffers in saved_tree, at the view's
+ * position, and hides the live tree while the client draws a new size.
+ */
+void view_save_buffers(struct wlrston_view *view);
+
+void view_drop_saved(struct wlrston_view *view);
+
+/*
+ * The scene sends the surfaces of a hidden live tree no frame callbacks.
+ * This sends them along with the output's, or clients drawing on frame
+ * callbacks would never commit the new size.
+ */
+void server_send_saved_frame_done(struct wlrston_server *server,
+				  struct wlrston_output *output,
+				  const struct timespec *now);
+
+void view_set_position(struct wlrston_view *view, int x, int y);
+
+void view_update_bounds(struct wlrston_view *view);
+
+void view_resize(struct wlrston_view *view, uint32_t edges,
+		 const struct wlr_box *box);
+
+void view_resize_commit(struct wlrston_view *view);
+
+/* Called when the grab ends, the last size goes out right away. */
+void view_resize_end(struct wlrston_view *view);
+
+void view_resize_reset(struct wlrston_view *view);
+
+void view_index_add(struct wlrston_view *view);
+
+void view_index_remove(struct wlrston_view *view);
+
 #endif
@@ -6,9 +6,22 @@
 #ifndef WLRSTON_H
 #define WLRSTON_H
 
+#include <stdio.h>
+#include <time.h>
 #include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include <bindings.h>
+#include <clients.h>
+#include <idle.h>
+#include <keymap-cache.h>
+#include <latency.h>
+#include <pool.h>
+#include <spatial.h>
+#include <switcher.h>
 
 /* For brevity's sake, struct members are annotated where they are used. */
 enum wlrston_cursor_mode {
@@ -24,13 +37,34 @@ struct wlrston_input {
 	struct wl_list link; /* seat::input_list */
 };
 
+/* Pointer motion accumulated until the next pointer frame. */
+struct wlrston_motion {
+	bool pending;
+	bool absolute;
+	struct wlr_input_device *device;
+	double dx, dy; /* relative motion */
+	double x, y; /* absolute motion */
+	uint32_t time_msec;
+	uint32_t first_time_msec; /* oldest event in the frame, for latency */
+};
+
 struct wlrston_seat {
 	struct wlrston_server *server;
 	struct wlr_seat *seat;
-	struct wlr_keyboard_group *keyboard_group;
+	struct wl_list keyboard_groups; /* wlrston_keyboard_group.link */
+	struct keymap_cache keymap;
+	struct binding_state bindings;
 
 	struct wlr_cursor *cursor;
-	struct wlr_xcursor_manager *xcursor_mgr;
+	struct cursor_theme *cursor_theme;
+	const char *cursor_image; /* theme image shown, NULL for client cursors */
+	struct wlr_relative_pointer_manager_v1 *relative_pointer_mgr;
+
+	struct wlrston_motion motion;
+	struct {
+		uint64_t motion_events;
+		uint64_t motion_updates;
+	} stats;
 
 	struct wl_list input_list;
 	struct wl_listener new_input;
@@ -51,10 +85,29 @@ struct wlrston_server {
 	struct wlr_renderer *renderer;
 	struct wlr_allocator *allocator;
 	struct wlr_scene *scene;
+	struct wlr_scene_tree *view_tree;
+	struct wlr_scene_tree *fullscreen_tree;
+	struct wlr_scene_tree *unmanaged_tree; /* override-redirect X11 windows */
+	struct wlr_compositor *compositor;
+	struct wlr_presentation *presentation;
+	struct latency_tracker latency;
+	struct bindings bindings;
+	struct idle_tracker idle;
+	struct client_tracker clients;
 
 	struct wlr_xdg_shell *xdg_shell;
 	struct wl_listener new_xdg_surface;
 	struct wl_list view_list;
+	struct wlrston_view *focused_view; /* activated, NULL if none */
+	struct spatial_index view_index;
+	uint64_t view_stack_seq;
+	bool occlusion_dirty; /* see server_update_occlusion() */
+	struct switcher switcher;
+
+	/* see transaction.h */
+	struct transaction *transaction_open; /* collecting changes */
+	struct transaction *transaction_inflight; /* waiting for clients */
+	struct wl_event_source *transaction_idle;
 
 	struct wlrston_seat seat;
 
@@ -67,24 +120,82 @@ struct wlrston_server {
 	struct wlr_output_layout *output_layout;
 	struct wl_list output_list;
 	struct wl_listener new_output;
+
+	/* milliseconds before vblank to start rendering, see output_frame() */
+	int max_render_time;
+	bool render_threads; /* render each output on a thread, pixman only */
+
+	/* objects that come and go with clients and devices */
+	struct {
+		struct pool views;
+		struct pool popups;
+		struct pool outputs;
+		struct pool inputs;
+		struct pool keyboards;
+		struct pool x11_windows; /* set up by xwayland_create() */
+	} pools;
+
+	char *stats_path;
+
+	struct {
+		uint64_t frames_sent;
+		uint64_t frames_throttled;
+		uint64_t transactions;
+		uint64_t transactions_timed_out;
+		uint64_t thumbnails_rendered;
+	} stats;
 };
 
+/* max_render_time value that derives the budget from measured render times */
+#define WLRSTON_RENDER_TIME_AUTO -1
+
 struct wlrston_output {
 	struct wl_list link;
 	struct wlrston_server *server;
 	struct wlr_output *wlr_output;
 	struct wl_listener frame;
+	struct wl_listener commit;
+	struct wl_listener present;
 	struct wl_listener destroy;
+
+	struct wl_event_source *repaint_timer;
+	bool repaint_scheduled;
+	struct render_worker *render_worker; /* NULL when rendering inline */
+
+	struct wlrston_view *fullscreen_view;
+	bool idle_off; /* powered off by the idle timeout */
+
+	struct timespec last_present;
+	int refresh_nsec;
+	int64_t render_time_nsec; /* decaying peak of measured render times */
+
+	struct latency_output latency; /* input-to-photon */
+
+	struct {
+		struct wl_signal rendered; /* int64_t *, render time in nsec */
+	} events;
 };
 
-struct wlrston_keyboard {
-	struct wlrston_input base;
-	struct wlr_keyboard *wlr_keyboard;
+/*
+ * Keyboards with the same keymap and repeat info act as one, so clients
+ * only see the keymap change when typing moves to a different one.
+ */
+struct wlrston_keyboard_group {
+	struct wlrston_seat *seat;
+	struct wlr_keyboard_group *wlr_group;
+	struct wl_list link; /* wlrston_seat.keyboard_groups */
+	int n_keyboards;
 
 	struct wl_listener modifiers;
 	struct wl_listener key;
 };
 
+struct wlrston_keyboard {
+	struct wlrston_input base;
+	struct wlr_keyboard *wlr_keyboard;
+	struct wlrston_keyboard_group *group;
+};
+
 struct wlrston_server *server_create(struct wl_display *display);
 
 void server_destory(struct wlrston_server *server);
@@ -95,30 +206,47 @@ void reset_cursor_mode(struct wlrston_server *server);
 
 void output_new(struct wl_listener *listener, void *data);
 
+void output_set_power(struct wlrston_output *output, bool on);
+
 void xdg_surface_new(struct wl_listener *listener, void *data);
 
 void seat_init(struct wlrston_server *server);
 
 void seat_finish(struct wlrston_server *server);
 
+void seat_update_capabilities(struct wlrston_seat *seat);
+
 void cursor_init(struct wlrston_seat *seat);
 
 void cursor_finish(struct wlrston_seat *seat);
 
+void cursor_flush_motion(struct wlrston_seat *seat);
+
+void cursor_set_image(struct wlrston_seat *seat, const char *name);
+
+void process_cursor_move(struct wlrston_server *server);
+
+void process_cursor_resize(struct wlrston_server *server);
+
 void seat_request_cursor(struct wl_listener *listener, void *data);
 
 void seat_request_set_selection(struct wl_listener *listener, void *data);
 
-void keyboard_modifiers_notify(struct wl_listener *listener, void *data);
+void keyboard_add(struct wlrston_seat *seat, struct wlrston_keyboard *keyboard);
 
-void keyboard_key_notify(struct wl_listener *listener, void *data);
+void keyboard_remove(struct wlrston_keyboard *keyboard);
 
 void keyboard_handle_destroy(struct wl_listener *listener, void *data);
 
+bool handle_keybinding(struct wlrston_seat *seat, struct wlr_keyboard *keyboard,
+		       uint32_t keycode, enum wl_keyboard_key_state state);
+
 void keyboard_init(struct wlrston_seat *seat);
 
 void keyboard_finish(struct wlrston_seat *seat);
 
+void stats_write(struct wlrston_server *server);
+
 int wlrston_shell_init(struct wlrston_server *server, int *argc, char *argv[]);
 
 #endif
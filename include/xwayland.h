@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#ifndef XWAYLAND_H
+#define XWAYLAND_H
+
+struct wlrston_server;
+
+/*
+ * X11 clients through Xwayland. The X11 sockets are opened at startup and
+ * DISPLAY is set, but the Xwayland server is only started once a client
+ * connects to one of them. Once no X11 window is left for the idle
+ * timeout, Xwayland is stopped and waits for the next client the same way.
+ * Managed X11 windows are views like xdg toplevels, override-redirect ones
+ * such as menus go on top of everything in server::unmanaged_tree.
+ */
+struct xwayland;
+
+/* An idle timeout of 0 keeps Xwayland running once it started. */
+struct xwayland *xwayland_create(struct wlrston_server *server,
+				 int idle_timeout_sec);
+
+void xwayland_destroy(struct xwayland *xwayland);
+
+#endif
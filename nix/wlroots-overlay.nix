@@ -30,16 +30,18 @@ self: super: {
       self.wayland
       self.wayland-protocols
       self.xorg.libX11
+      self.xorg.libxcb
       self.xorg.xcbutilerrors
       self.xorg.xcbutilimage
       self.xorg.xcbutilrenderutil
       self.xorg.xcbutilwm
       self.ffmpeg_4
       self.libliftoff
+      self.xwayland
     ];
     depsBuildBuild = [ self.pkg-config ];
     mesonFlags = [
-      "-Dxwayland=disabled"
+      "-Dxwayland=enabled"
     ];
     meta = {
       description = "Modular Wayland compositor library";
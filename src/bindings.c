@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/util/log.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include <bindings.h>
+
+/* Caps Lock and Num Lock must not stop bindings from matching. */
+#define BINDING_IGNORED_MODIFIERS (WLR_MODIFIER_CAPS | WLR_MODIFIER_MOD2)
+
+#define KEY_IS_KEYCODE (1ULL << 40)
+#define KEY_MODE_SHIFT 41
+
+static uint64_t binding_key(int mode, bool keycode, uint32_t modifiers,
+			    uint32_t value)
+{
+	modifiers &= 0xff & ~BINDING_IGNORED_MODIFIERS;
+	return (uint64_t)mode << KEY_MODE_SHIFT |
+		(keycode ? KEY_IS_KEYCODE : 0) |
+		(uint64_t)modifiers << 32 | value;
+}
+
+static size_t binding_hash(uint64_t key, size_t n_slots)
+{
+	/* Fibonacci hashing, n_slots is a power of two */
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32 & (n_slots - 1);
+}
+
+static const struct binding *lookup(const struct bindings *bindings,
+				    uint64_t key)
+{
+	size_t i;
+
+	if (bindings->n_bindings == 0)
+		return NULL;
+
+	/* the table is at most half full, probe sequences stay short */
+	i = binding_hash(key, bindings->n_slots);
+	while (bindings->slots[i].key != 0) {
+		if (bindings->slots[i].key == key)
+			return &bindings->slots[i];
+		i = (i + 1) & (bindings->n_slots - 1);
+	}
+	return NULL;
+}
+
+const struct binding *bindings_lookup_keysym(const struct bindings *bindings,
+					     int mode, uint32_t modifiers,
+					     uint32_t keysym)
+{
+	return lookup(bindings, binding_key(mode, false, modifiers, keysym));
+}
+
+const struct binding *bindings_lookup_keycode(const struct bindings *bindings,
+					      int mode, uint32_t modifiers,
+					      uint32_t keycode)
+{
+	if (bindings->n_keycodes == 0)
+		return NULL;
+	return lookup(bindings, binding_key(mode, true, modifiers, keycode));
+}
+
+static struct binding *slot_for(struct binding *slots, size_t n_slots,
+				uint64_t key)
+{
+	size_t i = binding_hash(key, n_slots);
+
+	while (slots[i].key != 0 && slots[i].key != key)
+		i = (i + 1) & (n_slots - 1);
+	return &slots[i];
+}
+
+static bool bindings_grow(struct bindings *bindings)
+{
+	size_t n_slots = bindings->n_slots ? bindings->n_slots * 2 : 64;
+	struct binding *slots;
+	size_t i;
+
+	slots = calloc(n_slots, sizeof(*slots));
+	if (!slots)
+		return false;
+	for (i = 0; i < bindings->n_slots; i++) {
+		if (bindings->slots[i].key != 0)
+			*slot_for(slots, n_slots, bindings->slots[i].key) =
+				bindings->slots[i];
+	}
+	free(bindings->slots);
+	bindings->slots = slots;
+	bindings->n_slots = n_slots;
+	return true;
+}
+
+/* A later binding for the same key replaces the earlier one. */
+static bool bindings_add(struct bindings *bindings,
+			 const struct binding *binding)
+{
+	struct binding *slot;
+
+	if ((bindings->n_bindings + 1) * 2 > bindings->n_slots &&
+	    !bindings_grow(bindings))
+		return false;
+
+	slot = slot_for(bindings->slots, bindings->n_slots, binding->key);
+	if (slot->key != 0) {
+		free(slot->command);
+	} else {
+		bindings->n_bindings++;
+		if (binding->key & KEY_IS_KEYCODE)
+			bindings->n_keycodes++;
+	}
+	*slot = *binding;
+	return true;
+}
+
+static int mode_find(struct bindings *bindings, const char *name)
+{
+	int i;
+
+	for (i = 0; i < bindings->n_modes; i++) {
+		if (strcmp(bindings->modes[i].name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int mode_add(struct bindings *bindings, const char *name)
+{
+	struct binding_mode *modes;
+	int mode = mode_find(bindings, name);
+
+	if (mode >= 0)
+		return mode;
+
+	modes = realloc(bindings->modes,
+			(bindings->n_modes + 1) * sizeof(*modes));
+	if (!modes)
+		return -1;
+	bindings->modes = modes;
+	modes[bindings->n_modes].name = strdup(name);
+	modes[bindings->n_modes].grab = false;
+	if (!modes[bindings->n_modes].name)
+		return -1;
+	return bindings->n_modes++;
+}
+
+bool bindings_init(struct bindings *bindings)
+{
+	memset(bindings, 0, sizeof(*bindings));
+	return mode_add(bindings, "default") == 0;
+}
+
+void bindings_finish(struct bindings *bindings)
+{
+	size_t i;
+	int m;
+
+	for (i = 0; i < bindings->n_slots; i++)
+		free(bindings->slots[i].command);
+	free(bindings->slots);
+	for (m = 0; m < bindings->n_modes; m++)
+		free(bindings->modes[m].name);
+	free(bindings->modes);
+	memset(bindings, 0, sizeof(*bindings));
+}
+
+bool bindings_add_defaults(struct bindings *bindings)
+{
+	struct binding exit = {
+		.key = binding_key(0, false, WLR_MODIFIER_ALT, XKB_KEY_Escape),
+		.action = BINDING_EXIT,
+	};
+	struct binding focus_next = {
+		.key = binding_key(0, false, WLR_MODIFIER_ALT, XKB_KEY_F1),
+		.action = BINDING_FOCUS_NEXT,
+	};
+
+	return bindings_add(bindings, &exit) &&
+		bindings_add(bindings, &focus_next);
+}
+
+static bool parse_modifier(const char *name, uint32_t *modifier)
+{
+	static const struct {
+		const char *name;
+		uint32_t modifier;
+	} modifiers[] = {
+		{ "Shift", WLR_MODIFIER_SHIFT },
+		{ "Ctrl", WLR_MODIFIER_CTRL },
+		{ "Control", WLR_MODIFIER_CTRL },
+		{ "Alt", WLR_MODIFIER_ALT },
+		{ "Mod1", WLR_MODIFIER_ALT },
+		{ "Mod3", WLR_MODIFIER_MOD3 },
+		{ "Super", WLR_MODIFIER_LOGO },
+		{ "Logo", WLR_MODIFIER_LOGO },
+		{ "Mod4", WLR_MODIFIER_LOGO },
+		{ "Mod5", WLR_MODIFIER_MOD5 },
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(modifiers) / sizeof(modifiers[0]); i++) {
+		if (strcasecmp(name, modifiers[i].name) == 0) {
+			*modifier = modifiers[i].modifier;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Splits "Alt+Shift+a" into a modifier mask and a keysym or keycode. */
+static bool parse_combo(char *combo, bool keycode, uint32_t *modifiers,
+			uint32_t *value)
+{
+	char *token, *next, *end;
+	uint32_t modifier;
+	unsigned long code;
+
+	*modifiers = 0;
+	for (token = combo; (next = strchr(token, '+')) && next[1] != '\0';
+	     token = next + 1) {
+		*next = '\0';
+		if (!parse_modifier(token, &modifier))
+			return false;
+		*modifiers |= modifier;
+	}
+
+	if (keycode) {
+		errno = 0;
+		code = strtoul(token, &end, 10);
+		if (errno || *token == '\0' || *end != '\0' ||
+		    code >= BINDING_KEYCODES)
+			return false;
+		*value = code;
+		return true;
+	}
+
+	/* unshifted symbols are matched, "A" means the same key as "a" */
+	*value = xkb_keysym_from_name(token, XKB_KEYSYM_CASE_INSENSITIVE);
+	return *value != XKB_KEY_NoSymbol;
+}
+
+static bool parse_action(struct bindings *bindings, char *action, char *args,
+			 struct binding *binding)
+{
+	if (strcmp(action, "exit") == 0) {
+		binding->action = BINDING_EXIT;
+	} else if (strcmp(action, "focus-next") == 0) {
+		binding->action = BINDING_FOCUS_NEXT;
+	} else if (strcmp(action, "close") == 0) {
+		binding->action = BINDING_CLOSE;
+	} else if (strcmp(action, "exec") == 0 && args) {
+		binding->action = BINDING_EXEC;
+		binding->command = strdup(args);
+		return binding->command != NULL;
+	} else if (strcmp(action, "mode") == 0 && args) {
+		binding->action = BINDING_MODE;
+		binding->mode = mode_add(bindings, args);
+		return binding->mode >= 0;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static char *next_word(char **line)
+{
+	char *word;
+
+	*line += strspn(*line, " \t");
+	if (**line == '\0')
+		return NULL;
+	word = *line;
+	*line += strcspn(*line, " \t");
+	if (**line != '\0')
+		*(*line)++ = '\0';
+	*line += strspn(*line, " \t");
+	return word;
+}
+
+static bool parse_bind(struct bindings *bindings, char *line, bool keycode)
+{
+	struct binding binding = { 0 };
+	char *word, *combo = NULL;
+	uint32_t modifiers, value;
+	int mode = 0;
+
+	while ((word = next_word(&line))) {
+		if (strcmp(word, "--release") == 0) {
+			binding.release = true;
+		} else if (strcmp(word, "--mode") == 0) {
+			word = next_word(&line);
+			if (!word)
+				return false;
+			mode = mode_add(bindings, word);
+			if (mode < 0)
+				return false;
+		} else {
+			combo = word;
+			break;
+		}
+	}
+	if (!combo || !parse_combo(combo, keycode, &modifiers, &value))
+		return false;
+	binding.key = binding_key(mode, keycode, modifiers, value);
+
+	word = next_word(&line);
+	if (!word || !parse_action(bindings, word, *line ? line : NULL,
+				   &binding))
+		return false;
+
+	if (!bindings_add(bindings, &binding)) {
+		free(binding.command);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_mode(struct bindings *bindings, char *line)
+{
+	char *name = next_word(&line);
+	char *flag = next_word(&line);
+	int mode;
+
+	if (!name || (flag && strcmp(flag, "--grab") != 0))
+		return false;
+	mode = mode_add(bindings, name);
+	if (mode < 0)
+		return false;
+	bindings->modes[mode].grab = flag != NULL;
+	return true;
+}
+
+static bool parse_line(struct bindings *bindings, char *line)
+{
+	char *command;
+
+	line[strcspn(line, "#\n")] = '\0';
+	command = next_word(&line);
+	if (!command)
+		return true;
+
+	if (strcmp(command, "bind") == 0)
+		return parse_bind(bindings, line, false);
+	if (strcmp(command, "bindcode") == 0)
+		return parse_bind(bindings, line, true);
+	if (strcmp(command, "mode") == 0)
+		return parse_mode(bindings, line);
+	return false;
+}
+
+bool bindings_load(struct bindings *bindings, const char *path)
+{
+	struct bindings loaded;
+	char *line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		wlr_log_errno(WLR_ERROR, "failed to open %s", path);
+		return false;
+	}
+	if (!bindings_init(&loaded)) {
+		fclose(f);
+		return false;
+	}
+
+	while (getline(&line, &size, f) != -1) {
+		lineno++;
+		if (!parse_line(&loaded, line))
+			wlr_log(WLR_ERROR, "%s:%d: invalid line, ignored",
+				path, lineno);
+	}
+	free(line);
+	fclose(f);
+
+	bindings_finish(bindings);
+	*bindings = loaded;
+	wlr_log(WLR_INFO, "loaded %zu key bindings from %s",
+		bindings->n_bindings, path);
+	return true;
+}
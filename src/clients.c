@@ -0,0 +1,488 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+#include <wlrston.h>
+#include <clients.h>
+#include <profile.h>
+
+struct client_surface {
+	struct client_account *account; /* NULL once the client is gone */
+	struct wlr_surface *wlr_surface;
+	struct wl_list link; /* client_account::surfaces */
+	uint64_t shm_bytes;
+	uint64_t texture_bytes;
+
+	struct wl_listener client_commit;
+	struct wl_listener commit;
+	struct wl_listener destroy;
+	struct wl_listener popup_destroy; /* notify is set while a popup */
+};
+
+/* A commit held back as cached state, see client_limits. */
+struct client_deferred {
+	struct client_surface *surface;
+	uint32_t seq; /* of the locked state */
+	struct wl_list link; /* client_account::deferred */
+};
+
+static int64_t now_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void read_process_name(pid_t pid, char *name, size_t size)
+{
+	char path[64];
+	FILE *f;
+
+	name[0] = '\0';
+	snprintf(path, sizeof(path), "/proc/%d/comm", (int)pid);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	if (fgets(name, size, f))
+		name[strcspn(name, "\n")] = '\0';
+	fclose(f);
+}
+
+static void account_destroy(struct client_account *account)
+{
+	struct client_deferred *deferred, *tmp_deferred;
+	struct client_surface *surface, *tmp;
+
+	/* the surfaces and their cached state go next */
+	wl_list_for_each_safe(deferred, tmp_deferred, &account->deferred, link) {
+		wl_list_remove(&deferred->link);
+		free(deferred);
+	}
+	/* surfaces are destroyed after their client */
+	wl_list_for_each_safe(surface, tmp, &account->surfaces, link) {
+		surface->account = NULL;
+		wl_list_remove(&surface->link);
+		wl_list_init(&surface->link);
+	}
+	wl_list_remove(&account->destroy.link);
+	wl_list_remove(&account->link);
+	free(account);
+}
+
+static void client_destroy(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct client_account *account =
+		wl_container_of(listener, account, destroy);
+
+	account_destroy(account);
+}
+
+static struct client_account *account_get(struct client_tracker *tracker,
+					  struct wl_client *client)
+{
+	struct client_account *account;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client, client_destroy);
+	if (listener)
+		return wl_container_of(listener, account, destroy);
+
+	account = calloc(1, sizeof(*account));
+	if (!account) {
+		wlr_log(WLR_ERROR, "failed to allocate client account");
+		return NULL;
+	}
+	account->tracker = tracker;
+	account->client = client;
+	wl_list_init(&account->surfaces);
+	wl_list_init(&account->deferred);
+	wl_client_get_credentials(client, &account->pid, NULL, NULL);
+	read_process_name(account->pid, account->name, sizeof(account->name));
+	account->window_start_msec = now_msec();
+	account->destroy.notify = client_destroy;
+	wl_client_add_destroy_listener(client, &account->destroy);
+	wl_list_insert(&tracker->accounts, &account->link);
+	return account;
+}
+
+void client_tracker_exempt(struct client_tracker *tracker,
+			   struct wl_client *client)
+{
+	struct client_account *account = account_get(tracker, client);
+
+	if (account)
+		account->exempt = true;
+}
+
+static void account_disconnect(struct client_account *account,
+			       const char *reason)
+{
+	if (account->disconnecting)
+		return;
+	account->disconnecting = true;
+	wlr_log(WLR_ERROR, "disconnecting client %d (%s): %s",
+		(int)account->pid, account->name, reason);
+	wl_client_post_implementation_error(account->client, "%s", reason);
+}
+
+static void account_roll_window(struct client_account *account, int64_t now)
+{
+	int64_t elapsed = now - account->window_start_msec;
+
+	if (elapsed < 1000)
+		return;
+	/* a gap of more than a second had nothing in its last second */
+	if (elapsed < 2000) {
+		account->commits_per_sec = account->window_commits;
+		account->damage_px_per_sec = account->window_damage_px;
+	} else {
+		account->commits_per_sec = 0;
+		account->damage_px_per_sec = 0;
+	}
+	account->window_commits = 0;
+	account->window_damage_px = 0;
+	account->window_start_msec = now;
+}
+
+void client_account_rates(struct client_account *account,
+			  uint64_t *commits_per_sec, uint64_t *damage_px_per_sec)
+{
+	account_roll_window(account, now_msec());
+	*commits_per_sec = account->commits_per_sec;
+	*damage_px_per_sec = account->damage_px_per_sec;
+}
+
+static bool buffer_fits_outputs(struct client_tracker *tracker,
+				struct wlr_surface *wlr_surface)
+{
+	struct wlrston_output *output;
+	int width = 0, height = 0, output_width, output_height;
+
+	/* a rotated output takes buffers in its rotated size */
+	wl_list_for_each(output, &tracker->server->output_list, link) {
+		wlr_output_transformed_resolution(output->wlr_output,
+						  &output_width, &output_height);
+		if (output_width > width)
+			width = output_width;
+		if (output_height > height)
+			height = output_height;
+	}
+	/* nothing to compare with yet */
+	if (width == 0 || height == 0)
+		return true;
+	return wlr_surface->current.buffer_width <= width &&
+		wlr_surface->current.buffer_height <= height;
+}
+
+static void surface_update_memory(struct client_surface *surface)
+{
+	struct client_account *account = surface->account;
+	struct wlr_client_buffer *buffer = surface->wlr_surface->buffer;
+	uint64_t shm_bytes = 0, texture_bytes = 0;
+	uint32_t format;
+	size_t stride;
+	void *ptr;
+
+	if (buffer && buffer->texture)
+		texture_bytes = (uint64_t)buffer->texture->width *
+			buffer->texture->height * 4;
+	/* only shm buffers give out a data pointer */
+	if (buffer && buffer->source &&
+	    wlr_buffer_begin_data_ptr_access(buffer->source,
+					     WLR_BUFFER_DATA_PTR_ACCESS_READ,
+					     &ptr, &format, &stride)) {
+		shm_bytes = (uint64_t)stride * buffer->source->height;
+		wlr_buffer_end_data_ptr_access(buffer->source);
+	}
+
+	account->shm_bytes += shm_bytes - surface->shm_bytes;
+	account->texture_bytes += texture_bytes - surface->texture_bytes;
+	surface->shm_bytes = shm_bytes;
+	surface->texture_bytes = texture_bytes;
+}
+
+static void surface_commit(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct client_surface *surface = wl_container_of(listener, surface, commit);
+	struct client_account *account = surface->account;
+	struct wlr_surface *wlr_surface = surface->wlr_surface;
+	struct client_tracker *tracker;
+	const struct client_limits *limits;
+	pixman_box32_t *rects;
+	uint64_t damage = 0;
+	int i, n_rects;
+
+	if (!account)
+		return;
+	tracker = account->tracker;
+	limits = &tracker->limits;
+
+	account_roll_window(account, now_msec());
+	account->commits++;
+	account->window_commits++;
+	if (!(wlr_surface->current.committed & WLR_SURFACE_STATE_BUFFER))
+		return;
+
+	rects = pixman_region32_rectangles(&wlr_surface->buffer_damage,
+					   &n_rects);
+	for (i = 0; i < n_rects; i++)
+		damage += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+	account->damage_px += damage;
+	account->window_damage_px += damage;
+
+	surface_update_memory(surface);
+
+	if (account->exempt)
+		return;
+	if (limits->buffer_output_size &&
+	    !buffer_fits_outputs(tracker, wlr_surface)) {
+		account_disconnect(account, "buffer larger than any output");
+		return;
+	}
+	if (limits->memory_bytes &&
+	    account->shm_bytes + account->texture_bytes > limits->memory_bytes)
+		account_disconnect(account, "buffers over the memory budget");
+}
+
+/* Applies held back commits, up to the budget of each client. */
+static void release_deferred(void *data)
+{
+	struct client_tracker *tracker = data;
+	int budget = tracker->limits.commits_per_iteration;
+	struct client_account *account;
+	struct client_deferred *deferred;
+	uint64_t one = 1;
+	bool left = false;
+
+	tracker->release_idle = NULL;
+	wl_list_for_each(account, &tracker->accounts, link) {
+		account->iteration_commits = 0;
+		while (!wl_list_empty(&account->deferred) &&
+		       (budget <= 0 || account->iteration_commits < budget)) {
+			deferred = wl_container_of(account->deferred.next,
+						   deferred, link);
+			wl_list_remove(&deferred->link);
+			account->n_deferred--;
+			account->iteration_commits++;
+			wlr_surface_unlock_cached(deferred->surface->wlr_surface,
+						  deferred->seq);
+			free(deferred);
+		}
+		left |= !wl_list_empty(&account->deferred);
+	}
+
+	/* idle sources added now would still run in this iteration */
+	if (left && write(tracker->wakeup_fd, &one, sizeof(one)) < 0)
+		wlr_log_errno(WLR_ERROR, "failed to wake the event loop");
+}
+
+static void schedule_release(struct client_tracker *tracker)
+{
+	struct wl_event_loop *loop;
+
+	if (tracker->release_idle)
+		return;
+	loop = wl_display_get_event_loop(tracker->server->wl_display);
+	tracker->release_idle = wl_event_loop_add_idle(loop, release_deferred,
+						       tracker);
+}
+
+static int handle_wakeup(int fd, uint32_t mask, void *data)
+{
+	PROFILE_LISTENER();
+	struct client_tracker *tracker = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0)
+		wlr_log_errno(WLR_ERROR, "failed to read wakeup");
+	schedule_release(tracker);
+	return 0;
+}
+
+/* Before the commit is applied, holds it back once over the budget. */
+static void surface_client_commit(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct client_surface *surface =
+		wl_container_of(listener, surface, client_commit);
+	struct client_account *account = surface->account;
+	struct client_deferred *deferred;
+	int budget;
+
+	if (!account)
+		return;
+	budget = account->tracker->limits.commits_per_iteration;
+	if (budget <= 0 || account->exempt)
+		return;
+
+	schedule_release(account->tracker);
+	/* earlier commits that were held back go first */
+	if (wl_list_empty(&account->deferred) &&
+	    account->iteration_commits < budget) {
+		account->iteration_commits++;
+		return;
+	}
+
+	deferred = calloc(1, sizeof(*deferred));
+	if (!deferred)
+		return;
+	deferred->surface = surface;
+	deferred->seq = wlr_surface_lock_pending(surface->wlr_surface);
+	wl_list_insert(account->deferred.prev, &deferred->link);
+	account->n_deferred++;
+	account->commits_deferred++;
+}
+
+static void surface_popup_destroy(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct client_surface *surface =
+		wl_container_of(listener, surface, popup_destroy);
+
+	if (surface->account)
+		surface->account->n_popups--;
+	wl_list_remove(&surface->popup_destroy.link);
+	surface->popup_destroy.notify = NULL;
+}
+
+static void surface_destroy(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct client_surface *surface = wl_container_of(listener, surface, destroy);
+	struct client_account *account = surface->account;
+
+	struct client_deferred *deferred, *tmp;
+
+	if (surface->popup_destroy.notify)
+		surface_popup_destroy(&surface->popup_destroy, NULL);
+	if (account) {
+		wl_list_for_each_safe(deferred, tmp, &account->deferred, link) {
+			if (deferred->surface != surface)
+				continue;
+			wl_list_remove(&deferred->link);
+			account->n_deferred--;
+			free(deferred);
+		}
+		account->n_surfaces--;
+		account->shm_bytes -= surface->shm_bytes;
+		account->texture_bytes -= surface->texture_bytes;
+	}
+	wl_list_remove(&surface->link);
+	wl_list_remove(&surface->client_commit.link);
+	wl_list_remove(&surface->commit.link);
+	wl_list_remove(&surface->destroy.link);
+	free(surface);
+}
+
+static void new_surface(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct client_tracker *tracker =
+		wl_container_of(listener, tracker, new_surface);
+	struct wlr_surface *wlr_surface = data;
+	struct client_account *account;
+	struct client_surface *surface;
+
+	account = account_get(tracker, wl_resource_get_client(wlr_surface->resource));
+	if (!account)
+		return;
+	surface = calloc(1, sizeof(*surface));
+	if (!surface) {
+		wlr_log(WLR_ERROR, "failed to allocate client surface");
+		return;
+	}
+	surface->account = account;
+	surface->wlr_surface = wlr_surface;
+	wl_list_insert(&account->surfaces, &surface->link);
+	account->n_surfaces++;
+
+	surface->client_commit.notify = surface_client_commit;
+	wl_signal_add(&wlr_surface->events.client_commit,
+		      &surface->client_commit);
+	surface->commit.notify = surface_commit;
+	wl_signal_add(&wlr_surface->events.commit, &surface->commit);
+	surface->destroy.notify = surface_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &surface->destroy);
+}
+
+static void new_xdg_surface(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlr_xdg_surface *xdg_surface = data;
+	struct wl_listener *destroy;
+	struct client_surface *surface;
+
+	if (xdg_surface->role != WLR_XDG_SURFACE_ROLE_POPUP)
+		return;
+	destroy = wl_signal_get(&xdg_surface->surface->events.destroy,
+				surface_destroy);
+	if (!destroy)
+		return;
+	surface = wl_container_of(destroy, surface, destroy);
+	if (!surface->account || surface->popup_destroy.notify)
+		return;
+
+	surface->account->n_popups++;
+	surface->popup_destroy.notify = surface_popup_destroy;
+	wl_signal_add(&xdg_surface->events.destroy, &surface->popup_destroy);
+}
+
+bool client_tracker_init(struct client_tracker *tracker,
+			 struct wlrston_server *server)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+
+	tracker->server = server;
+	wl_list_init(&tracker->accounts);
+	tracker->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (tracker->wakeup_fd < 0)
+		return false;
+	tracker->wakeup = wl_event_loop_add_fd(loop, tracker->wakeup_fd,
+					       WL_EVENT_READABLE, handle_wakeup,
+					       tracker);
+	if (!tracker->wakeup) {
+		close(tracker->wakeup_fd);
+		return false;
+	}
+
+	tracker->new_surface.notify = new_surface;
+	wl_signal_add(&server->compositor->events.new_surface,
+		      &tracker->new_surface);
+	tracker->new_xdg_surface.notify = new_xdg_surface;
+	wl_signal_add(&server->xdg_shell->events.new_surface,
+		      &tracker->new_xdg_surface);
+	return true;
+}
+
+void client_tracker_finish(struct client_tracker *tracker)
+{
+	struct client_account *account, *tmp;
+
+	wl_list_remove(&tracker->new_surface.link);
+	wl_list_remove(&tracker->new_xdg_surface.link);
+	wl_list_for_each_safe(account, tmp, &tracker->accounts, link)
+		account_destroy(account);
+	if (tracker->release_idle)
+		wl_event_source_remove(tracker->release_idle);
+	wl_event_source_remove(tracker->wakeup);
+	close(tracker->wakeup_fd);
+}
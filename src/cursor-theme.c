@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/util/log.h>
+#include <wlr/xcursor.h>
+
+#include <cursor-theme.h>
+#include <profile.h>
+
+/* Per scale, a handful of names covers everything the compositor shows. */
+#define CURSOR_CACHE_SIZE 8
+
+enum cursor_scale_state {
+	CURSOR_SCALE_QUEUED,
+	CURSOR_SCALE_LOADING,
+	CURSOR_SCALE_DONE,
+};
+
+struct cursor_scale {
+	float scale;
+	struct wl_list link; /* cursor_theme::scales */
+
+	/* guarded by cursor_theme::lock */
+	enum cursor_scale_state state;
+	struct wlr_xcursor_theme *theme;
+
+	/* main thread only */
+	bool ready;
+	struct {
+		const char *name;
+		struct wlr_xcursor *xcursor; /* NULL if the theme lacks it */
+	} cache[CURSOR_CACHE_SIZE];
+	int cache_next;
+};
+
+struct cursor_theme {
+	char *name;
+	uint32_t size;
+	struct wl_list scales; /* cursor_scale::link */
+
+	cursor_theme_loaded_func_t loaded;
+	void *data;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool quit;
+	bool threaded; /* false if the thread could not start */
+
+	int event_fd;
+	struct wl_event_source *event_source;
+};
+
+static struct wlr_xcursor_theme *load_scale(const char *name, uint32_t size,
+					    float scale)
+{
+	struct wlr_xcursor_theme *theme;
+
+	theme = wlr_xcursor_theme_load(name, size * scale);
+	if (!theme)
+		wlr_log(WLR_ERROR, "failed to load cursor theme %s at scale %.2f",
+			name ? name : "default", scale);
+	return theme;
+}
+
+static struct cursor_scale *next_queued(struct cursor_theme *theme)
+{
+	struct cursor_scale *scale;
+
+	wl_list_for_each(scale, &theme->scales, link) {
+		if (scale->state == CURSOR_SCALE_QUEUED)
+			return scale;
+	}
+	return NULL;
+}
+
+static void *loader_thread(void *data)
+{
+	struct cursor_theme *theme = data;
+	struct wlr_xcursor_theme *loaded;
+	struct cursor_scale *scale;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&theme->lock);
+	while (!theme->quit) {
+		scale = next_queued(theme);
+		if (!scale) {
+			pthread_cond_wait(&theme->cond, &theme->lock);
+			continue;
+		}
+		scale->state = CURSOR_SCALE_LOADING;
+		pthread_mutex_unlock(&theme->lock);
+
+		loaded = load_scale(theme->name, theme->size, scale->scale);
+
+		pthread_mutex_lock(&theme->lock);
+		scale->theme = loaded;
+		scale->state = CURSOR_SCALE_DONE;
+		if (write(theme->event_fd, &one, sizeof(one)) < 0)
+			wlr_log_errno(WLR_ERROR, "failed to signal cursor theme");
+	}
+	pthread_mutex_unlock(&theme->lock);
+
+	return NULL;
+}
+
+static int handle_loaded(int fd, uint32_t mask, void *data)
+{
+	PROFILE_LISTENER();
+	struct cursor_theme *theme = data;
+	struct cursor_scale *scale;
+	bool changed = false;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		wlr_log_errno(WLR_ERROR, "failed to read cursor theme event");
+
+	pthread_mutex_lock(&theme->lock);
+	wl_list_for_each(scale, &theme->scales, link) {
+		if (!scale->ready && scale->state == CURSOR_SCALE_DONE &&
+		    scale->theme) {
+			scale->ready = true;
+			changed = true;
+		}
+	}
+	pthread_mutex_unlock(&theme->lock);
+
+	if (changed && theme->loaded)
+		theme->loaded(theme->data);
+
+	return 0;
+}
+
+struct cursor_theme *
+cursor_theme_create(const char *name, uint32_t size, struct wl_event_loop *loop,
+		    cursor_theme_loaded_func_t loaded, void *data)
+{
+	struct cursor_theme *theme;
+
+	theme = calloc(1, sizeof(*theme));
+	if (!theme) {
+		wlr_log(WLR_ERROR, "failed to allocate cursor theme");
+		return NULL;
+	}
+	if (name) {
+		theme->name = strdup(name);
+		if (!theme->name)
+			goto failed_free_theme;
+	}
+	theme->size = size;
+	theme->loaded = loaded;
+	theme->data = data;
+	wl_list_init(&theme->scales);
+
+	theme->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (theme->event_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "failed to create cursor theme eventfd");
+		goto failed_free_name;
+	}
+	theme->event_source = wl_event_loop_add_fd(loop, theme->event_fd,
+						   WL_EVENT_READABLE,
+						   handle_loaded, theme);
+	if (!theme->event_source)
+		goto failed_close_fd;
+
+	pthread_mutex_init(&theme->lock, NULL);
+	pthread_cond_init(&theme->cond, NULL);
+	theme->threaded = pthread_create(&theme->thread, NULL, loader_thread,
+					 theme) == 0;
+	if (!theme->threaded)
+		wlr_log(WLR_ERROR, "loading cursor themes on the main thread");
+
+	return theme;
+
+failed_close_fd:
+	close(theme->event_fd);
+failed_free_name:
+	free(theme->name);
+failed_free_theme:
+	free(theme);
+	return NULL;
+}
+
+void cursor_theme_destroy(struct cursor_theme *theme)
+{
+	struct cursor_scale *scale, *tmp;
+
+	if (!theme)
+		return;
+
+	if (theme->threaded) {
+		pthread_mutex_lock(&theme->lock);
+		theme->quit = true;
+		pthread_cond_signal(&theme->cond);
+		pthread_mutex_unlock(&theme->lock);
+		pthread_join(theme->thread, NULL);
+	}
+
+	wl_list_for_each_safe(scale, tmp, &theme->scales, link) {
+		if (scale->theme)
+			wlr_xcursor_theme_destroy(scale->theme);
+		wl_list_remove(&scale->link);
+		free(scale);
+	}
+
+	wl_event_source_remove(theme->event_source);
+	close(theme->event_fd);
+	pthread_cond_destroy(&theme->cond);
+	pthread_mutex_destroy(&theme->lock);
+	free(theme->name);
+	free(theme);
+}
+
+void cursor_theme_load(struct cursor_theme *theme, float scale)
+{
+	struct cursor_scale *cursor_scale;
+
+	/* only the main thread adds scales, so the list is stable here */
+	wl_list_for_each(cursor_scale, &theme->scales, link) {
+		if (cursor_scale->scale == scale)
+			return;
+	}
+
+	cursor_scale = calloc(1, sizeof(*cursor_scale));
+	if (!cursor_scale) {
+		wlr_log(WLR_ERROR, "failed to allocate cursor scale");
+		return;
+	}
+	cursor_scale->scale = scale;
+
+	if (!theme->threaded) {
+		cursor_scale->theme = load_scale(theme->name, theme->size, scale);
+		cursor_scale->state = CURSOR_SCALE_DONE;
+		cursor_scale->ready = cursor_scale->theme != NULL;
+		wl_list_insert(theme->scales.prev, &cursor_scale->link);
+		if (cursor_scale->ready && theme->loaded)
+			theme->loaded(theme->data);
+		return;
+	}
+
+	pthread_mutex_lock(&theme->lock);
+	cursor_scale->state = CURSOR_SCALE_QUEUED;
+	wl_list_insert(theme->scales.prev, &cursor_scale->link);
+	pthread_cond_signal(&theme->cond);
+	pthread_mutex_unlock(&theme->lock);
+}
+
+static struct wlr_xcursor *scale_get_xcursor(struct cursor_scale *scale,
+					     const char *name)
+{
+	struct wlr_xcursor *xcursor;
+	int i;
+
+	for (i = 0; i < CURSOR_CACHE_SIZE; i++) {
+		if (scale->cache[i].name && strcmp(scale->cache[i].name, name) == 0)
+			return scale->cache[i].xcursor;
+	}
+
+	/* the theme is not written once ready, no lock needed */
+	xcursor = wlr_xcursor_theme_get_cursor(scale->theme, name);
+	scale->cache[scale->cache_next].name = name;
+	scale->cache[scale->cache_next].xcursor = xcursor;
+	scale->cache_next = (scale->cache_next + 1) % CURSOR_CACHE_SIZE;
+
+	return xcursor;
+}
+
+bool cursor_theme_set_image(struct cursor_theme *theme,
+			    struct wlr_cursor *cursor, const char *name)
+{
+	struct wlr_xcursor_image *image;
+	struct wlr_xcursor *xcursor;
+	struct cursor_scale *scale;
+	bool set = false;
+
+	wl_list_for_each(scale, &theme->scales, link) {
+		if (!scale->ready)
+			continue;
+		xcursor = scale_get_xcursor(scale, name);
+		if (!xcursor)
+			continue;
+		image = xcursor->images[0];
+		wlr_cursor_set_image(cursor, image->buffer, image->width * 4,
+				     image->width, image->height,
+				     image->hotspot_x, image->hotspot_y,
+				     scale->scale);
+		set = true;
+	}
+	return set;
+}
@@ -3,51 +3,106 @@
  * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
  */
 
+#include <string.h>
+
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_xdg_shell.h>
-#include <wlr/types/wlr_xcursor_manager.h>
 
+#include <cursor-theme.h>
 #include <wlrston.h>
 #include <view.h>
+#include <profile.h>
 
-static struct wlrston_view *
-desktop_view_at(struct wlrston_server *server, double lx, double ly,
-		struct wlr_surface **surface, double *sx, double *sy)
+struct view_at_data {
+	struct wlr_surface *surface;
+	double sx, sy;
+};
+
+static bool surface_at(struct wlr_scene_node *root, double lx, double ly,
+		       struct view_at_data *at)
 {
 	struct wlr_scene_surface *scene_surface;
 	struct wlr_scene_buffer *scene_buffer;
 	struct wlr_scene_node *node;
-	struct wlr_scene_tree *tree;
 
-	node = wlr_scene_node_at(&server->scene->tree.node, lx, ly, sx, sy);
+	node = wlr_scene_node_at(root, lx, ly, &at->sx, &at->sy);
 	if (node == NULL || node->type != WLR_SCENE_NODE_BUFFER) {
-		return NULL;
+		return false;
 	}
 	scene_buffer = wlr_scene_buffer_from_node(node);
 	scene_surface = wlr_scene_surface_from_buffer(scene_buffer);
 	if (!scene_surface) {
+		return false;
+	}
+
+	at->surface = scene_surface->surface;
+	return true;
+}
+
+static bool view_accepts_point(struct spatial_entry *entry, double lx, double ly,
+			       void *data)
+{
+	struct wlrston_view *view = entry->data;
+
+	return surface_at(&view->scene_tree->node, lx, ly, data);
+}
+
+/*
+ * Only the views whose bounds contain the point are searched, topmost
+ * first, instead of walking the whole scene graph.
+ */
+struct wlrston_view *
+desktop_view_at(struct wlrston_server *server, double lx, double ly,
+		struct wlr_surface **surface, double *sx, double *sy)
+{
+	struct view_at_data at = { 0 };
+	struct spatial_entry *entry;
+
+	/* override-redirect X11 windows are on top and belong to no view */
+	if (!wl_list_empty(&server->unmanaged_tree->children) &&
+	    surface_at(&server->unmanaged_tree->node, lx, ly, &at)) {
+		*surface = at.surface;
+		*sx = at.sx;
+		*sy = at.sy;
+		return NULL;
+	}
+
+	entry = spatial_index_at(&server->view_index, lx, ly,
+				 view_accepts_point, &at);
+	if (entry == NULL) {
 		return NULL;
 	}
 
-	*surface = scene_surface->surface;
+	*surface = at.surface;
+	*sx = at.sx;
+	*sy = at.sy;
+	return entry->data;
+}
+
+/* The focused client answering the event is traced, see latency.h. */
+static void cursor_trace_input(struct wlrston_seat *seat, uint32_t time_msec)
+{
+	struct wlr_seat_client *client = seat->seat->pointer_state.focused_client;
 
-	tree = node->parent;
-	while (tree != NULL && tree->node.data == NULL) {
-		tree = tree->node.parent;
+	if (client) {
+		latency_input(&seat->server->latency, client->client, time_msec);
 	}
-	return tree->node.data;
 }
 
 void reset_cursor_mode(struct wlrston_server *server)
 {
+	if (server->cursor_mode == WLRSTON_CURSOR_RESIZE && server->grabbed_view)
+		view_resize_end(server->grabbed_view);
 	server->cursor_mode = WLRSTON_CURSOR_PASSTHROUGH;
 	server->grabbed_view = NULL;
 }
 
 static void request_set_cursor_notify(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat = wl_container_of(listener, seat, request_set_cursor);
 	struct wlr_seat_pointer_request_set_cursor_event *event = data;
 	struct wlr_seat_client *focused_client =
@@ -56,11 +111,13 @@ static void request_set_cursor_notify(struct wl_listener *listener, void *data)
 	if (focused_client == event->seat_client) {
 		wlr_cursor_set_surface(seat->cursor, event->surface,
 				       event->hotspot_x, event->hotspot_y);
+		seat->cursor_image = NULL;
 	}
 }
 
 static void request_set_selection_notify(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat =
 		wl_container_of(listener, seat, request_set_selection);
 	struct wlr_seat_request_set_selection_event *event = data;
@@ -68,17 +125,16 @@ static void request_set_selection_notify(struct wl_listener *listener, void *dat
 	wlr_seat_set_selection(seat->seat, event->source, event->serial);
 }
 
-static void process_cursor_move(struct wlrston_server *server)
+void process_cursor_move(struct wlrston_server *server)
 {
 	struct wlrston_seat *seat = &server->seat;
 	struct wlrston_view *view = server->grabbed_view;
 
-	view->x = seat->cursor->x - server->grab_x;
-	view->y = seat->cursor->y - server->grab_y;
-	wlr_scene_node_set_position(&view->scene_tree->node, view->x, view->y);
+	view_set_position(view, seat->cursor->x - server->grab_x,
+			  seat->cursor->y - server->grab_y);
 }
 
-static void process_cursor_resize(struct wlrston_server *server)
+void process_cursor_resize(struct wlrston_server *server)
 {
 	struct wlrston_seat *seat = &server->seat;
 	struct wlrston_view *view = server->grabbed_view;
@@ -88,8 +144,7 @@ static void process_cursor_resize(struct wlrston_server *server)
 	int new_right = server->grab_geobox.x + server->grab_geobox.width;
 	int new_top = server->grab_geobox.y;
 	int new_bottom = server->grab_geobox.y + server->grab_geobox.height;
-	int new_width, new_height;
-	struct wlr_box geo_box;
+	struct wlr_box new_box;
 
 	if (server->resize_edges & WLR_EDGE_TOP) {
 		new_top = border_y;
@@ -114,14 +169,11 @@ static void process_cursor_resize(struct wlrston_server *server)
 		}
 	}
 
-	wlr_xdg_surface_get_geometry(view->xdg_toplevel->base, &geo_box);
-	view->x = new_left - geo_box.x;
-	view->y = new_top - geo_box.y;
-	wlr_scene_node_set_position(&view->scene_tree->node, view->x, view->y);
-
-	new_width = new_right - new_left;
-	new_height = new_bottom - new_top;
-	wlr_xdg_toplevel_set_size(view->xdg_toplevel, new_width, new_height);
+	new_box.x = new_left;
+	new_box.y = new_top;
+	new_box.width = new_right - new_left;
+	new_box.height = new_bottom - new_top;
+	view_resize(view, server->resize_edges, &new_box);
 }
 
 static void process_cursor_motion(struct wlrston_seat *seat, uint32_t time)
@@ -144,40 +196,129 @@ static void process_cursor_motion(struct wlrston_seat *seat, uint32_t time)
 	view = desktop_view_at(server, seat->cursor->x, seat->cursor->y,
 			       &surface, &sx, &sy);
 	if (!view) {
-		wlr_xcursor_manager_set_cursor_image(seat->xcursor_mgr, "left_ptr",
-						     seat->cursor);
+		cursor_set_image(seat, "left_ptr");
 	}
 	if (surface) {
 		wlr_seat_pointer_notify_enter(wlr_seat, surface, sx, sy);
 		wlr_seat_pointer_notify_motion(wlr_seat, time, sx, sy);
+		cursor_trace_input(seat, seat->motion.first_time_msec);
 	} else {
 		wlr_seat_pointer_clear_focus(wlr_seat);
 	}
 }
 
+static void apply_cursor_motion(struct wlrston_seat *seat)
+{
+	struct wlrston_motion *motion = &seat->motion;
+
+	if (motion->absolute) {
+		wlr_cursor_warp_absolute(seat->cursor, motion->device,
+					 motion->x, motion->y);
+	} else {
+		wlr_cursor_move(seat->cursor, motion->device,
+				motion->dx, motion->dy);
+	}
+	motion->dx = motion->dy = 0;
+}
+
+/*
+ * Applies the motion accumulated since the last pointer frame: the cursor
+ * moves, the grab or hit-test runs and the client sees one motion event.
+ */
+void cursor_flush_motion(struct wlrston_seat *seat)
+{
+	struct wlrston_motion *motion = &seat->motion;
+
+	if (!motion->pending) {
+		return;
+	}
+
+	apply_cursor_motion(seat);
+	motion->pending = false;
+	motion->device = NULL;
+	seat->stats.motion_updates++;
+
+	process_cursor_motion(seat, motion->time_msec);
+}
+
 static void cursor_motion(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat =
 		wl_container_of(listener, seat, cursor_motion);
 	struct wlr_pointer_motion_event *event = data;
+	struct wlrston_motion *motion = &seat->motion;
 
-	wlr_cursor_move(seat->cursor, &event->pointer->base,
-			event->delta_x, event->delta_y);
-	process_cursor_motion(seat, event->time_msec);
+	/* Relative pointer clients get every event, unaccumulated. */
+	wlr_relative_pointer_manager_v1_send_relative_motion(
+		seat->relative_pointer_mgr, seat->seat,
+		(uint64_t)event->time_msec * 1000, event->delta_x, event->delta_y,
+		event->unaccel_dx, event->unaccel_dy);
+
+	if (motion->pending && (motion->absolute ||
+				motion->device != &event->pointer->base)) {
+		apply_cursor_motion(seat);
+	}
+
+	if (!motion->pending) {
+		motion->first_time_msec = event->time_msec;
+	}
+	motion->pending = true;
+	motion->absolute = false;
+	motion->device = &event->pointer->base;
+	motion->dx += event->delta_x;
+	motion->dy += event->delta_y;
+	motion->time_msec = event->time_msec;
+	seat->stats.motion_events++;
+	idle_tracker_activity(&seat->server->idle);
 }
 
 static void cursor_motion_absolute(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat =
 		wl_container_of(listener, seat, cursor_motion_absolute);
 	struct wlr_pointer_motion_absolute_event *event = data;
+	struct wlrston_motion *motion = &seat->motion;
+	double lx, ly, from_x, from_y;
 
-	wlr_cursor_warp_absolute(seat->cursor, &event->pointer->base, event->x, event->y);
-	process_cursor_motion(seat, event->time_msec);
+	if (motion->pending && !motion->absolute) {
+		apply_cursor_motion(seat);
+	}
+
+	/* The cursor lags behind the absolute motion still pending. */
+	if (motion->pending && motion->absolute) {
+		wlr_cursor_absolute_to_layout_coords(seat->cursor,
+						     motion->device,
+						     motion->x, motion->y,
+						     &from_x, &from_y);
+	} else {
+		from_x = seat->cursor->x;
+		from_y = seat->cursor->y;
+	}
+	wlr_cursor_absolute_to_layout_coords(seat->cursor, &event->pointer->base,
+					     event->x, event->y, &lx, &ly);
+	wlr_relative_pointer_manager_v1_send_relative_motion(
+		seat->relative_pointer_mgr, seat->seat,
+		(uint64_t)event->time_msec * 1000,
+		lx - from_x, ly - from_y, lx - from_x, ly - from_y);
+
+	if (!motion->pending) {
+		motion->first_time_msec = event->time_msec;
+	}
+	motion->pending = true;
+	motion->absolute = true;
+	motion->device = &event->pointer->base;
+	motion->x = event->x;
+	motion->y = event->y;
+	motion->time_msec = event->time_msec;
+	seat->stats.motion_events++;
+	idle_tracker_activity(&seat->server->idle);
 }
 
 static void cursor_button(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat =
 		wl_container_of(listener, seat, cursor_button);
 	struct wlrston_server *server = seat->server;
@@ -186,8 +327,12 @@ static void cursor_button(struct wl_listener *listener, void *data)
 	struct wlrston_view *view;
 	double sx, sy;
 
+	idle_tracker_activity(&server->idle);
+	cursor_flush_motion(seat);
+
 	wlr_seat_pointer_notify_button(seat->seat, event->time_msec,
 				       event->button, event->state);
+	cursor_trace_input(seat, event->time_msec);
 
 	view = desktop_view_at(server, seat->cursor->x, seat->cursor->y,
 			       &surface, &sx, &sy);
@@ -200,27 +345,63 @@ static void cursor_button(struct wl_listener *listener, void *data)
 
 static void cursor_axis(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat =
 		wl_container_of(listener, seat, cursor_axis);
 	struct wlr_pointer_axis_event *event = data;
 
+	idle_tracker_activity(&seat->server->idle);
+	cursor_flush_motion(seat);
+
 	wlr_seat_pointer_notify_axis(seat->seat, event->time_msec,
 				     event->orientation, event->delta,
 				     event->delta_discrete, event->source);
+	cursor_trace_input(seat, event->time_msec);
 }
 
 static void cursor_frame(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat =
 		wl_container_of(listener, seat, cursor_frame);
 
+	cursor_flush_motion(seat);
 	wlr_seat_pointer_notify_frame(seat->seat);
 }
 
+/* Moving over the desktop keeps showing the same image, nothing to do. */
+void cursor_set_image(struct wlrston_seat *seat, const char *name)
+{
+	if (seat->cursor_image && strcmp(seat->cursor_image, name) == 0) {
+		return;
+	}
+
+	seat->cursor_image = name;
+	if (seat->cursor_theme) {
+		cursor_theme_set_image(seat->cursor_theme, seat->cursor, name);
+	}
+}
+
+/* Outputs at the new scale would show nothing or a stale image. */
+static void cursor_theme_loaded(void *data)
+{
+	struct wlrston_seat *seat = data;
+
+	if (seat->cursor_image) {
+		cursor_theme_set_image(seat->cursor_theme, seat->cursor,
+				       seat->cursor_image);
+	}
+}
+
 void cursor_init(struct wlrston_seat *seat)
 {
-	seat->xcursor_mgr = wlr_xcursor_manager_create(NULL, 24);
-	wlr_xcursor_manager_load(seat->xcursor_mgr, 1);
+	/* Scales are loaded as outputs show up, see output_new(). */
+	seat->cursor_theme = cursor_theme_create(NULL, 24,
+		wl_display_get_event_loop(seat->server->wl_display),
+		cursor_theme_loaded, seat);
+
+	seat->relative_pointer_mgr =
+		wlr_relative_pointer_manager_v1_create(seat->server->wl_display);
 
 	seat->cursor_motion.notify = cursor_motion;
 	wl_signal_add(&seat->cursor->events.motion,
@@ -248,6 +429,6 @@ void cursor_init(struct wlrston_seat *seat)
 
 void cursor_finish(struct wlrston_seat *seat)
 {
-	wlr_xcursor_manager_destroy(seat->xcursor_mgr);
+	cursor_theme_destroy(seat->cursor_theme);
 	wlr_cursor_destroy(seat->cursor);
 }
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_idle_inhibit_v1.h>
+#include <wlr/types/wlr_idle_notify_v1.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_power_management_v1.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+#include <wlrston.h>
+#include <view.h>
+#include <idle.h>
+#include <profile.h>
+
+struct idle_inhibitor {
+	struct idle_tracker *tracker;
+	struct wlr_idle_inhibitor_v1 *wlr_inhibitor;
+	struct wl_listener destroy;
+};
+
+static int64_t now_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* An inhibitor only counts while its window can be seen. */
+static bool inhibitor_active(struct wlr_idle_inhibitor_v1 *inhibitor)
+{
+	struct wlr_surface *surface =
+		wlr_surface_get_root_surface(inhibitor->surface);
+	struct wlr_xdg_surface *xdg_surface;
+	struct wlr_scene_tree *tree;
+	struct wlrston_view *view;
+
+	if (!wlr_surface_is_xdg_surface(surface))
+		return true;
+	xdg_surface = wlr_xdg_surface_from_wlr_surface(surface);
+	if (!xdg_surface->mapped)
+		return false;
+	if (xdg_surface->role != WLR_XDG_SURFACE_ROLE_TOPLEVEL)
+		return true;
+
+	tree = xdg_surface->data;
+	view = tree ? tree->node.data : NULL;
+	return !view || (!view->culled && !view->occluded);
+}
+
+static bool idle_inhibited(struct idle_tracker *tracker,
+			   struct wlr_idle_inhibitor_v1 *except)
+{
+	struct wlr_idle_inhibitor_v1 *inhibitor;
+	bool inhibited = false;
+
+	wl_list_for_each(inhibitor, &tracker->inhibit_manager->inhibitors,
+			 link) {
+		if (inhibitor != except && inhibitor_active(inhibitor)) {
+			inhibited = true;
+			break;
+		}
+	}
+	wlr_idle_notifier_v1_set_inhibited(tracker->notifier, inhibited);
+	return inhibited;
+}
+
+static void idle_set_outputs(struct idle_tracker *tracker, bool on)
+{
+	struct wlrston_output *output;
+
+	wl_list_for_each(output, &tracker->server->output_list, link) {
+		if (on && output->idle_off) {
+			output->idle_off = false;
+			output_set_power(output, true);
+		} else if (!on && output->wlr_output->enabled) {
+			output->idle_off = true;
+			output_set_power(output, false);
+		}
+	}
+	tracker->idle = !on;
+}
+
+static int idle_timeout(void *data)
+{
+	PROFILE_LISTENER();
+	struct idle_tracker *tracker = data;
+	int64_t elapsed = now_msec() - tracker->activity_msec;
+
+	if (tracker->timeout_msec <= 0)
+		return 0;
+
+	/* input rearms lazily, only the last one matters */
+	if (elapsed < tracker->timeout_msec) {
+		wl_event_source_timer_update(tracker->timer,
+					     tracker->timeout_msec - elapsed);
+		return 0;
+	}
+	if (idle_inhibited(tracker, NULL)) {
+		wl_event_source_timer_update(tracker->timer,
+					     tracker->timeout_msec);
+		return 0;
+	}
+
+	wlr_log(WLR_DEBUG, "idle for %d ms, powering outputs off",
+		tracker->timeout_msec);
+	idle_set_outputs(tracker, false);
+	return 0;
+}
+
+void idle_tracker_activity(struct idle_tracker *tracker)
+{
+	tracker->activity_msec = now_msec();
+	wlr_idle_notifier_v1_notify_activity(tracker->notifier,
+					     tracker->server->seat.seat);
+
+	if (tracker->idle) {
+		idle_set_outputs(tracker, true);
+		if (tracker->timeout_msec > 0)
+			wl_event_source_timer_update(tracker->timer,
+						     tracker->timeout_msec);
+	}
+}
+
+void idle_tracker_update_inhibited(struct idle_tracker *tracker)
+{
+	idle_inhibited(tracker, NULL);
+}
+
+void idle_tracker_set_timeout(struct idle_tracker *tracker, int timeout_msec)
+{
+	tracker->timeout_msec = timeout_msec;
+	tracker->activity_msec = now_msec();
+	wl_event_source_timer_update(tracker->timer,
+				     timeout_msec > 0 ? timeout_msec : 0);
+}
+
+static void inhibitor_destroy(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct idle_inhibitor *inhibitor =
+		wl_container_of(listener, inhibitor, destroy);
+
+	/* still on the manager's list while it is being destroyed */
+	idle_inhibited(inhibitor->tracker, inhibitor->wlr_inhibitor);
+	wl_list_remove(&inhibitor->destroy.link);
+	free(inhibitor);
+}
+
+static void new_inhibitor(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct idle_tracker *tracker =
+		wl_container_of(listener, tracker, new_inhibitor);
+	struct wlr_idle_inhibitor_v1 *wlr_inhibitor = data;
+	struct idle_inhibitor *inhibitor;
+
+	inhibitor = calloc(1, sizeof(*inhibitor));
+	if (!inhibitor)
+		return;
+	inhibitor->tracker = tracker;
+	inhibitor->wlr_inhibitor = wlr_inhibitor;
+	inhibitor->destroy.notify = inhibitor_destroy;
+	wl_signal_add(&wlr_inhibitor->events.destroy, &inhibitor->destroy);
+
+	idle_inhibited(tracker, NULL);
+}
+
+static void set_power_mode(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct idle_tracker *tracker =
+		wl_container_of(listener, tracker, set_power_mode);
+	struct wlr_output_power_v1_set_mode_event *event = data;
+	struct wlrston_output *output = event->output->data;
+
+	if (!output)
+		return;
+	/* the tool decides now, input no longer turns it back on */
+	output->idle_off = false;
+	output_set_power(output, event->mode == ZWLR_OUTPUT_POWER_V1_MODE_ON);
+}
+
+bool idle_tracker_init(struct idle_tracker *tracker,
+		       struct wlrston_server *server)
+{
+	struct wl_display *display = server->wl_display;
+
+	tracker->server = server;
+	tracker->notifier = wlr_idle_notifier_v1_create(display);
+	tracker->inhibit_manager = wlr_idle_inhibit_v1_create(display);
+	tracker->power_manager = wlr_output_power_manager_v1_create(display);
+	if (!tracker->notifier || !tracker->inhibit_manager ||
+	    !tracker->power_manager)
+		return false;
+
+	tracker->timer = wl_event_loop_add_timer(
+		wl_display_get_event_loop(display), idle_timeout, tracker);
+	if (!tracker->timer)
+		return false;
+
+	tracker->new_inhibitor.notify = new_inhibitor;
+	wl_signal_add(&tracker->inhibit_manager->events.new_inhibitor,
+		      &tracker->new_inhibitor);
+	tracker->set_power_mode.notify = set_power_mode;
+	wl_signal_add(&tracker->power_manager->events.set_mode,
+		      &tracker->set_power_mode);
+	tracker->activity_msec = now_msec();
+	return true;
+}
+
+void idle_tracker_finish(struct idle_tracker *tracker)
+{
+	if (tracker->timer)
+		wl_event_source_remove(tracker->timer);
+	if (tracker->new_inhibitor.notify)
+		wl_list_remove(&tracker->new_inhibitor.link);
+	if (tracker->set_power_mode.notify)
+		wl_list_remove(&tracker->set_power_mode.link);
+	tracker->timer = NULL;
+}
@@ -0,0 +1,899 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <errno.h>
+#include <libinput.h>
+#include <libudev.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <wlr/backend.h>
+#include <wlr/backend/libinput.h>
+#include <wlr/backend/multi.h>
+#include <wlr/backend/session.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+#include <wlr/util/log.h>
+
+#include <input-thread.h>
+#include <wlrston.h>
+#include <profile.h>
+
+/* Powers of two. Events only pile up while the main loop is busy. */
+#define EVENT_RING_SIZE 1024
+#define COMMAND_RING_SIZE 256
+
+/*
+ * Lock-free ring with one producer and one consumer. Each index is only
+ * written by its own side, on separate cache lines.
+ */
+struct ring {
+	uint32_t head __attribute__((aligned(64))); /* next slot to fill */
+	uint32_t tail __attribute__((aligned(64))); /* next slot to read */
+};
+
+static bool ring_reserve(struct ring *ring, uint32_t size, uint32_t *slot)
+{
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (ring->head - tail == size)
+		return false;
+	*slot = ring->head & (size - 1);
+	return true;
+}
+
+static void ring_publish(struct ring *ring)
+{
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static bool ring_peek(struct ring *ring, uint32_t size, uint32_t *slot)
+{
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == ring->tail)
+		return false;
+	*slot = ring->tail & (size - 1);
+	return true;
+}
+
+static void ring_consume(struct ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * A libinput device as the main loop sees it. Allocated by the input
+ * thread, owned by the main loop once announced.
+ */
+struct input_proxy {
+	struct input_thread *thread;
+	struct libinput_device *device; /* dereferenced on the input thread only */
+	bool has_keyboard, has_pointer;
+	struct wlr_keyboard keyboard;
+	struct wlr_pointer pointer;
+	struct wl_list link; /* input_thread.proxies */
+};
+
+enum input_event_type {
+	INPUT_DEVICE_ADDED,
+	INPUT_DEVICE_REMOVED,
+	INPUT_KEY,
+	INPUT_MOTION,
+	INPUT_MOTION_ABSOLUTE,
+	INPUT_BUTTON,
+	INPUT_AXIS,
+};
+
+struct input_event {
+	enum input_event_type type;
+	struct input_proxy *proxy;
+	uint32_t time_msec;
+	union {
+		struct {
+			char name[64];
+			unsigned int vendor, product;
+		} added;
+		struct {
+			uint32_t keycode;
+			bool pressed;
+		} key;
+		struct {
+			double dx, dy;
+			double unaccel_dx, unaccel_dy;
+		} motion;
+		struct {
+			double x, y;
+		} absolute;
+		struct {
+			uint32_t button;
+			bool pressed;
+		} button;
+		struct {
+			enum wlr_axis_source source;
+			enum wlr_axis_orientation orientation;
+			double delta;
+			int32_t delta_discrete;
+		} axis;
+	};
+};
+
+enum input_command_type {
+	INPUT_LEDS,
+	INPUT_RELEASE, /* the main loop is done with the device */
+	INPUT_SUSPEND,
+	INPUT_RESUME,
+};
+
+struct input_command {
+	enum input_command_type type;
+	struct libinput_device *device;
+	uint32_t leds;
+};
+
+enum file_request {
+	FILE_REQUEST_NONE,
+	FILE_REQUEST_OPEN,
+	FILE_REQUEST_CLOSE,
+	FILE_REQUEST_DONE,
+};
+
+struct input_thread {
+	struct wlrston_server *server;
+	struct wlr_session *session;
+	struct wl_list proxies;
+	struct wl_listener session_active;
+
+	struct ring events;
+	struct input_event event_slots[EVENT_RING_SIZE];
+	int event_fd; /* wakes the main loop */
+	struct wl_event_source *event_source;
+
+	struct ring commands;
+	struct input_command command_slots[COMMAND_RING_SIZE];
+	int command_fd; /* wakes the input thread */
+
+	/* device files are opened through the session, on the main loop */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	enum file_request request; /* protected by lock */
+	const char *request_path;
+	int request_fd;
+	bool quit; /* protected by lock, also read atomically */
+
+	pthread_t thread;
+
+	/* only used on the input thread */
+	struct libinput *libinput;
+	struct udev *udev;
+	struct libinput_device **held; /* referenced until released */
+	size_t n_held, cap_held;
+	struct input_event motion; /* relative motion being summed up */
+	bool has_motion;
+	bool published;
+};
+
+static void wake(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		wlr_log_errno(WLR_ERROR, "failed to wake up input thread peer");
+}
+
+static bool thread_quitting(struct input_thread *thread)
+{
+	return __atomic_load_n(&thread->quit, __ATOMIC_ACQUIRE);
+}
+
+/* Runs on the main loop, or on the input thread once the main loop waits. */
+static void serve_file_request(struct input_thread *thread)
+{
+	struct wlr_device *device;
+
+	switch (thread->request) {
+	case FILE_REQUEST_OPEN:
+		device = wlr_session_open_file(thread->session,
+					       thread->request_path);
+		thread->request_fd = device ? device->fd : -1;
+		break;
+	case FILE_REQUEST_CLOSE:
+		wl_list_for_each(device, &thread->session->devices, link) {
+			if (device->fd == thread->request_fd) {
+				wlr_session_close_file(thread->session, device);
+				break;
+			}
+		}
+		break;
+	default:
+		return;
+	}
+	thread->request = FILE_REQUEST_DONE;
+	pthread_cond_signal(&thread->cond);
+}
+
+static int request_file(struct input_thread *thread, enum file_request request,
+			const char *path, int fd)
+{
+	pthread_mutex_lock(&thread->lock);
+	thread->request = request;
+	thread->request_path = path;
+	thread->request_fd = fd;
+	if (thread->quit) {
+		/* the main loop is waiting for this thread to exit */
+		serve_file_request(thread);
+	} else {
+		wake(thread->event_fd);
+		while (thread->request != FILE_REQUEST_DONE)
+			pthread_cond_wait(&thread->cond, &thread->lock);
+	}
+	fd = thread->request_fd;
+	thread->request = FILE_REQUEST_NONE;
+	pthread_mutex_unlock(&thread->lock);
+
+	return fd;
+}
+
+static int open_restricted(const char *path, int flags, void *data)
+{
+	int fd = request_file(data, FILE_REQUEST_OPEN, path, -1);
+
+	return fd < 0 ? -ENODEV : fd;
+}
+
+static void close_restricted(int fd, void *data)
+{
+	request_file(data, FILE_REQUEST_CLOSE, NULL, fd);
+}
+
+static const struct libinput_interface libinput_impl = {
+	.open_restricted = open_restricted,
+	.close_restricted = close_restricted,
+};
+
+static bool push_event(struct input_thread *thread,
+		       const struct input_event *event)
+{
+	uint32_t slot;
+
+	/* rather wait for the main loop than drop a key release */
+	while (!ring_reserve(&thread->events, EVENT_RING_SIZE, &slot)) {
+		if (thread_quitting(thread))
+			return false;
+		wake(thread->event_fd);
+		usleep(1000);
+	}
+	thread->event_slots[slot] = *event;
+	ring_publish(&thread->events);
+	thread->published = true;
+	return true;
+}
+
+static void flush_motion(struct input_thread *thread)
+{
+	if (!thread->has_motion)
+		return;
+	push_event(thread, &thread->motion);
+	thread->has_motion = false;
+}
+
+/* Relative motion read in one go moves the cursor once. */
+static void queue_motion(struct input_thread *thread, struct input_proxy *proxy,
+			 struct libinput_event_pointer *event)
+{
+	struct input_event *motion = &thread->motion;
+
+	if (thread->has_motion && motion->proxy != proxy)
+		flush_motion(thread);
+	if (!thread->has_motion) {
+		*motion = (struct input_event){
+			.type = INPUT_MOTION,
+			.proxy = proxy,
+			/* the oldest event, as latency tracing expects */
+			.time_msec = libinput_event_pointer_get_time_usec(event) / 1000,
+		};
+		thread->has_motion = true;
+	}
+	motion->motion.dx += libinput_event_pointer_get_dx(event);
+	motion->motion.dy += libinput_event_pointer_get_dy(event);
+	motion->motion.unaccel_dx +=
+		libinput_event_pointer_get_dx_unaccelerated(event);
+	motion->motion.unaccel_dy +=
+		libinput_event_pointer_get_dy_unaccelerated(event);
+}
+
+static void device_added(struct input_thread *thread,
+			 struct libinput_device *device)
+{
+	struct input_event event = { .type = INPUT_DEVICE_ADDED };
+	struct libinput_device **held;
+	struct input_proxy *proxy;
+	bool keyboard, pointer;
+	size_t cap;
+
+	/* touch, tablets and switches are not handled by the seat */
+	keyboard = libinput_device_has_capability(device,
+						  LIBINPUT_DEVICE_CAP_KEYBOARD);
+	pointer = libinput_device_has_capability(device,
+						 LIBINPUT_DEVICE_CAP_POINTER);
+	if (!keyboard && !pointer)
+		return;
+
+	if (thread->n_held == thread->cap_held) {
+		cap = thread->cap_held ? thread->cap_held * 2 : 16;
+		held = realloc(thread->held, cap * sizeof(*held));
+		if (!held)
+			return;
+		thread->held = held;
+		thread->cap_held = cap;
+	}
+	proxy = calloc(1, sizeof(*proxy));
+	if (!proxy)
+		return;
+	proxy->thread = thread;
+	proxy->device = libinput_device_ref(device);
+	proxy->has_keyboard = keyboard;
+	proxy->has_pointer = pointer;
+	thread->held[thread->n_held++] = device;
+
+	event.proxy = proxy;
+	snprintf(event.added.name, sizeof(event.added.name), "%s",
+		 libinput_device_get_name(device));
+	event.added.vendor = libinput_device_get_id_vendor(device);
+	event.added.product = libinput_device_get_id_product(device);
+	if (!push_event(thread, &event)) {
+		free(proxy);
+		return;
+	}
+	libinput_device_set_user_data(device, proxy);
+}
+
+static void push_axis(struct input_thread *thread, struct input_proxy *proxy,
+		      struct libinput_event_pointer *event,
+		      enum libinput_pointer_axis axis)
+{
+	struct input_event axis_event = {
+		.type = INPUT_AXIS,
+		.proxy = proxy,
+		.time_msec = libinput_event_pointer_get_time_usec(event) / 1000,
+	};
+
+	if (!libinput_event_pointer_has_axis(event, axis))
+		return;
+
+	switch (libinput_event_pointer_get_axis_source(event)) {
+	case LIBINPUT_POINTER_AXIS_SOURCE_FINGER:
+		axis_event.axis.source = WLR_AXIS_SOURCE_FINGER;
+		break;
+	case LIBINPUT_POINTER_AXIS_SOURCE_CONTINUOUS:
+		axis_event.axis.source = WLR_AXIS_SOURCE_CONTINUOUS;
+		break;
+	case LIBINPUT_POINTER_AXIS_SOURCE_WHEEL_TILT:
+		axis_event.axis.source = WLR_AXIS_SOURCE_WHEEL_TILT;
+		break;
+	default:
+		axis_event.axis.source = WLR_AXIS_SOURCE_WHEEL;
+		break;
+	}
+	axis_event.axis.orientation =
+		axis == LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL ?
+		WLR_AXIS_ORIENTATION_VERTICAL : WLR_AXIS_ORIENTATION_HORIZONTAL;
+	axis_event.axis.delta = libinput_event_pointer_get_axis_value(event, axis);
+	axis_event.axis.delta_discrete =
+		libinput_event_pointer_get_axis_value_discrete(event, axis);
+#ifdef WLR_POINTER_AXIS_DISCRETE_STEP
+	axis_event.axis.delta_discrete *= WLR_POINTER_AXIS_DISCRETE_STEP;
+#endif
+	push_event(thread, &axis_event);
+}
+
+static void handle_libinput_event(struct input_thread *thread,
+				  struct libinput_event *event)
+{
+	struct libinput_device *device = libinput_event_get_device(event);
+	enum libinput_event_type type = libinput_event_get_type(event);
+	struct input_event out = { .proxy = libinput_device_get_user_data(device) };
+	struct libinput_event_keyboard *key;
+	struct libinput_event_pointer *pointer;
+
+	if (type == LIBINPUT_EVENT_DEVICE_ADDED) {
+		device_added(thread, device);
+		return;
+	}
+	if (!out.proxy)
+		return;
+	if (type != LIBINPUT_EVENT_POINTER_MOTION)
+		flush_motion(thread);
+
+	switch (type) {
+	case LIBINPUT_EVENT_DEVICE_REMOVED:
+		libinput_device_set_user_data(device, NULL);
+		out.type = INPUT_DEVICE_REMOVED;
+		push_event(thread, &out);
+		break;
+	case LIBINPUT_EVENT_KEYBOARD_KEY:
+		if (!out.proxy->has_keyboard)
+			break;
+		key = libinput_event_get_keyboard_event(event);
+		out.type = INPUT_KEY;
+		out.time_msec = libinput_event_keyboard_get_time_usec(key) / 1000;
+		out.key.keycode = libinput_event_keyboard_get_key(key);
+		out.key.pressed = libinput_event_keyboard_get_key_state(key) ==
+			LIBINPUT_KEY_STATE_PRESSED;
+		push_event(thread, &out);
+		break;
+	case LIBINPUT_EVENT_POINTER_MOTION:
+		if (out.proxy->has_pointer)
+			queue_motion(thread, out.proxy,
+				     libinput_event_get_pointer_event(event));
+		break;
+	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+		if (!out.proxy->has_pointer)
+			break;
+		pointer = libinput_event_get_pointer_event(event);
+		out.type = INPUT_MOTION_ABSOLUTE;
+		out.time_msec = libinput_event_pointer_get_time_usec(pointer) / 1000;
+		out.absolute.x =
+			libinput_event_pointer_get_absolute_x_transformed(pointer, 1);
+		out.absolute.y =
+			libinput_event_pointer_get_absolute_y_transformed(pointer, 1);
+		push_event(thread, &out);
+		break;
+	case LIBINPUT_EVENT_POINTER_BUTTON:
+		if (!out.proxy->has_pointer)
+			break;
+		pointer = libinput_event_get_pointer_event(event);
+		out.type = INPUT_BUTTON;
+		out.time_msec = libinput_event_pointer_get_time_usec(pointer) / 1000;
+		out.button.button = libinput_event_pointer_get_button(pointer);
+		out.button.pressed =
+			libinput_event_pointer_get_button_state(pointer) ==
+			LIBINPUT_BUTTON_STATE_PRESSED;
+		push_event(thread, &out);
+		break;
+	case LIBINPUT_EVENT_POINTER_AXIS:
+		if (!out.proxy->has_pointer)
+			break;
+		pointer = libinput_event_get_pointer_event(event);
+		push_axis(thread, out.proxy, pointer,
+			  LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
+		push_axis(thread, out.proxy, pointer,
+			  LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL);
+		break;
+	default:
+		break;
+	}
+}
+
+static void dispatch_libinput(struct input_thread *thread)
+{
+	struct libinput_event *event;
+
+	if (libinput_dispatch(thread->libinput) != 0) {
+		wlr_log(WLR_ERROR, "failed to dispatch libinput");
+		return;
+	}
+	while ((event = libinput_get_event(thread->libinput))) {
+		handle_libinput_event(thread, event);
+		libinput_event_destroy(event);
+	}
+	flush_motion(thread);
+
+	/* one wakeup for everything read */
+	if (thread->published) {
+		wake(thread->event_fd);
+		thread->published = false;
+	}
+}
+
+static void release_device(struct input_thread *thread,
+			   struct libinput_device *device)
+{
+	size_t i;
+
+	for (i = 0; i < thread->n_held; i++) {
+		if (thread->held[i] == device) {
+			thread->held[i] = thread->held[--thread->n_held];
+			libinput_device_unref(device);
+			return;
+		}
+	}
+}
+
+static enum libinput_led leds_to_libinput(uint32_t leds)
+{
+	enum libinput_led libinput_leds = 0;
+
+	if (leds & WLR_LED_NUM_LOCK)
+		libinput_leds |= LIBINPUT_LED_NUM_LOCK;
+	if (leds & WLR_LED_CAPS_LOCK)
+		libinput_leds |= LIBINPUT_LED_CAPS_LOCK;
+	if (leds & WLR_LED_SCROLL_LOCK)
+		libinput_leds |= LIBINPUT_LED_SCROLL_LOCK;
+	return libinput_leds;
+}
+
+static void run_commands(struct input_thread *thread)
+{
+	struct input_command *command;
+	uint32_t slot;
+
+	while (ring_peek(&thread->commands, COMMAND_RING_SIZE, &slot)) {
+		command = &thread->command_slots[slot];
+		switch (command->type) {
+		case INPUT_LEDS:
+			libinput_device_led_update(command->device,
+						   leds_to_libinput(command->leds));
+			break;
+		case INPUT_RELEASE:
+			release_device(thread, command->device);
+			break;
+		case INPUT_SUSPEND:
+			libinput_suspend(thread->libinput);
+			break;
+		case INPUT_RESUME:
+			libinput_resume(thread->libinput);
+			break;
+		}
+		ring_consume(&thread->commands);
+	}
+}
+
+static void *input_thread_run(void *data)
+{
+	struct input_thread *thread = data;
+	struct pollfd fds[2];
+	uint64_t count;
+	size_t i;
+
+	thread->udev = udev_new();
+	if (!thread->udev) {
+		wlr_log(WLR_ERROR, "failed to create udev context");
+		return NULL;
+	}
+	thread->libinput = libinput_udev_create_context(&libinput_impl, thread,
+							thread->udev);
+	if (!thread->libinput) {
+		wlr_log(WLR_ERROR, "failed to create libinput context");
+		goto out_udev;
+	}
+	if (libinput_udev_assign_seat(thread->libinput,
+				      thread->session->seat) != 0) {
+		wlr_log(WLR_ERROR, "failed to assign libinput seat");
+		goto out_libinput;
+	}
+
+	fds[0].fd = libinput_get_fd(thread->libinput);
+	fds[0].events = POLLIN;
+	fds[1].fd = thread->command_fd;
+	fds[1].events = POLLIN;
+
+	dispatch_libinput(thread);
+	while (!thread_quitting(thread)) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			wlr_log_errno(WLR_ERROR, "input thread poll failed");
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			if (read(thread->command_fd, &count, sizeof(count)) < 0 &&
+			    errno != EAGAIN)
+				wlr_log_errno(WLR_ERROR, "failed to read commands");
+			run_commands(thread);
+		}
+		if (fds[0].revents & POLLIN)
+			dispatch_libinput(thread);
+	}
+
+	run_commands(thread);
+	for (i = 0; i < thread->n_held; i++)
+		libinput_device_unref(thread->held[i]);
+	thread->n_held = 0;
+out_libinput:
+	libinput_unref(thread->libinput);
+	thread->libinput = NULL;
+out_udev:
+	udev_unref(thread->udev);
+	thread->udev = NULL;
+	return NULL;
+}
+
+static void push_command(struct input_thread *thread,
+			 enum input_command_type type,
+			 struct libinput_device *device, uint32_t leds)
+{
+	uint32_t slot;
+
+	if (!ring_reserve(&thread->commands, COMMAND_RING_SIZE, &slot)) {
+		wlr_log(WLR_ERROR, "input thread is not taking commands");
+		return;
+	}
+	thread->command_slots[slot] = (struct input_command){
+		.type = type,
+		.device = device,
+		.leds = leds,
+	};
+	ring_publish(&thread->commands);
+	wake(thread->command_fd);
+}
+
+static void proxy_led_update(struct wlr_keyboard *keyboard, uint32_t leds)
+{
+	struct input_proxy *proxy = wl_container_of(keyboard, proxy, keyboard);
+
+	push_command(proxy->thread, INPUT_LEDS, proxy->device, leds);
+}
+
+static const struct wlr_keyboard_impl proxy_keyboard_impl = {
+	.name = "wlrston-input-thread-keyboard",
+	.led_update = proxy_led_update,
+};
+
+static const struct wlr_pointer_impl proxy_pointer_impl = {
+	.name = "wlrston-input-thread-pointer",
+};
+
+static void proxy_init(struct input_proxy *proxy,
+		       const struct input_event *event)
+{
+	struct wlrston_server *server = proxy->thread->server;
+	struct wl_signal *new_input = &server->backend->events.new_input;
+
+	wl_list_insert(&proxy->thread->proxies, &proxy->link);
+
+	if (proxy->has_keyboard) {
+		wlr_keyboard_init(&proxy->keyboard, &proxy_keyboard_impl,
+				  event->added.name);
+		proxy->keyboard.base.vendor = event->added.vendor;
+		proxy->keyboard.base.product = event->added.product;
+		wl_signal_emit(new_input, &proxy->keyboard.base);
+	}
+	if (proxy->has_pointer) {
+		wlr_pointer_init(&proxy->pointer, &proxy_pointer_impl,
+				 event->added.name);
+		proxy->pointer.base.vendor = event->added.vendor;
+		proxy->pointer.base.product = event->added.product;
+		wl_signal_emit(new_input, &proxy->pointer.base);
+	}
+}
+
+static void proxy_destroy(struct input_proxy *proxy, bool release)
+{
+	if (proxy->has_keyboard)
+		wlr_keyboard_finish(&proxy->keyboard);
+	if (proxy->has_pointer)
+		wlr_pointer_finish(&proxy->pointer);
+	wl_list_remove(&proxy->link);
+
+	/* queued behind any LED update still pointing at the device */
+	if (release)
+		push_command(proxy->thread, INPUT_RELEASE, proxy->device, 0);
+	free(proxy);
+}
+
+static void replay_event(const struct input_event *event)
+{
+	struct input_proxy *proxy = event->proxy;
+	struct wlr_pointer *pointer = &proxy->pointer;
+
+	switch (event->type) {
+	case INPUT_DEVICE_ADDED:
+		proxy_init(proxy, event);
+		return;
+	case INPUT_DEVICE_REMOVED:
+		proxy_destroy(proxy, true);
+		return;
+	case INPUT_KEY: {
+		struct wlr_keyboard_key_event key = {
+			.time_msec = event->time_msec,
+			.keycode = event->key.keycode,
+			.update_state = true,
+			.state = event->key.pressed ?
+				WL_KEYBOARD_KEY_STATE_PRESSED :
+				WL_KEYBOARD_KEY_STATE_RELEASED,
+		};
+		wlr_keyboard_notify_key(&proxy->keyboard, &key);
+		return;
+	}
+	case INPUT_MOTION: {
+		struct wlr_pointer_motion_event motion = {
+			.pointer = pointer,
+			.time_msec = event->time_msec,
+			.delta_x = event->motion.dx,
+			.delta_y = event->motion.dy,
+			.unaccel_dx = event->motion.unaccel_dx,
+			.unaccel_dy = event->motion.unaccel_dy,
+		};
+		wl_signal_emit(&pointer->events.motion, &motion);
+		break;
+	}
+	case INPUT_MOTION_ABSOLUTE: {
+		struct wlr_pointer_motion_absolute_event motion = {
+			.pointer = pointer,
+			.time_msec = event->time_msec,
+			.x = event->absolute.x,
+			.y = event->absolute.y,
+		};
+		wl_signal_emit(&pointer->events.motion_absolute, &motion);
+		break;
+	}
+	case INPUT_BUTTON: {
+		struct wlr_pointer_button_event button = {
+			.pointer = pointer,
+			.time_msec = event->time_msec,
+			.button = event->button.button,
+			.state = event->button.pressed ?
+				WLR_BUTTON_PRESSED : WLR_BUTTON_RELEASED,
+		};
+		wl_signal_emit(&pointer->events.button, &button);
+		break;
+	}
+	case INPUT_AXIS: {
+		struct wlr_pointer_axis_event axis = {
+			.pointer = pointer,
+			.time_msec = event->time_msec,
+			.source = event->axis.source,
+			.orientation = event->axis.orientation,
+			.delta = event->axis.delta,
+			.delta_discrete = event->axis.delta_discrete,
+		};
+		wl_signal_emit(&pointer->events.axis, &axis);
+		break;
+	}
+	}
+	/* libinput has no frames, every pointer event stands alone */
+	wl_signal_emit(&pointer->events.frame, pointer);
+}
+
+static int handle_input_events(int fd, uint32_t mask, void *data)
+{
+	PROFILE_LISTENER();
+	struct input_thread *thread = data;
+	uint64_t count;
+	uint32_t slot;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		wlr_log_errno(WLR_ERROR, "failed to read input thread eventfd");
+
+	pthread_mutex_lock(&thread->lock);
+	serve_file_request(thread);
+	pthread_mutex_unlock(&thread->lock);
+
+	while (ring_peek(&thread->events, EVENT_RING_SIZE, &slot)) {
+		replay_event(&thread->event_slots[slot]);
+		ring_consume(&thread->events);
+	}
+
+	return 0;
+}
+
+static void handle_session_active(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct input_thread *thread =
+		wl_container_of(listener, thread, session_active);
+
+	push_command(thread, thread->session->active ?
+		     INPUT_RESUME : INPUT_SUSPEND, NULL, 0);
+}
+
+static void find_libinput(struct wlr_backend *backend, void *data)
+{
+	struct wlr_backend **libinput = data;
+
+	if (wlr_backend_is_libinput(backend))
+		*libinput = backend;
+}
+
+struct input_thread *input_thread_create(struct wlrston_server *server)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+	struct wlr_backend *libinput = NULL;
+	struct input_thread *thread;
+	struct wlr_session *session;
+
+	session = wlr_backend_get_session(server->backend);
+	if (!session || !wlr_backend_is_multi(server->backend)) {
+		wlr_log(WLR_ERROR, "the input thread needs a session, "
+			"reading input on the main loop");
+		return NULL;
+	}
+
+	thread = calloc(1, sizeof(*thread));
+	if (!thread) {
+		wlr_log(WLR_ERROR, "failed to allocate input thread");
+		return NULL;
+	}
+	thread->server = server;
+	thread->session = session;
+	wl_list_init(&thread->proxies);
+
+	thread->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->event_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "failed to create input eventfd");
+		goto failed_free_thread;
+	}
+	thread->command_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->command_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "failed to create input eventfd");
+		goto failed_close_event_fd;
+	}
+	thread->event_source = wl_event_loop_add_fd(loop, thread->event_fd,
+						    WL_EVENT_READABLE,
+						    handle_input_events, thread);
+	if (!thread->event_source)
+		goto failed_close_command_fd;
+
+	pthread_mutex_init(&thread->lock, NULL);
+	pthread_cond_init(&thread->cond, NULL);
+	if (pthread_create(&thread->thread, NULL, input_thread_run, thread) != 0) {
+		wlr_log(WLR_ERROR, "failed to start input thread");
+		goto failed_remove_source;
+	}
+
+	/* the backend's own libinput would read the same devices */
+	wlr_multi_for_each_backend(server->backend, find_libinput, &libinput);
+	if (libinput) {
+		wlr_multi_backend_remove(server->backend, libinput);
+		wlr_backend_destroy(libinput);
+	}
+
+	thread->session_active.notify = handle_session_active;
+	wl_signal_add(&session->events.active, &thread->session_active);
+
+	return thread;
+
+failed_remove_source:
+	pthread_cond_destroy(&thread->cond);
+	pthread_mutex_destroy(&thread->lock);
+	wl_event_source_remove(thread->event_source);
+failed_close_command_fd:
+	close(thread->command_fd);
+failed_close_event_fd:
+	close(thread->event_fd);
+failed_free_thread:
+	free(thread);
+	return NULL;
+}
+
+void input_thread_destroy(struct input_thread *thread)
+{
+	struct input_proxy *proxy, *tmp;
+	uint32_t slot;
+
+	if (!thread)
+		return;
+
+	pthread_mutex_lock(&thread->lock);
+	__atomic_store_n(&thread->quit, true, __ATOMIC_RELEASE);
+	/* a request in flight is served here, later ones by the thread */
+	serve_file_request(thread);
+	pthread_mutex_unlock(&thread->lock);
+	wake(thread->command_fd);
+	pthread_join(thread->thread, NULL);
+
+	/* devices announced too late were never set up */
+	while (ring_peek(&thread->events, EVENT_RING_SIZE, &slot)) {
+		if (thread->event_slots[slot].type == INPUT_DEVICE_ADDED)
+			free(thread->event_slots[slot].proxy);
+		ring_consume(&thread->events);
+	}
+	wl_list_for_each_safe(proxy, tmp, &thread->proxies, link)
+		proxy_destroy(proxy, false);
+
+	wl_list_remove(&thread->session_active.link);
+	wl_event_source_remove(thread->event_source);
+	pthread_cond_destroy(&thread->cond);
+	pthread_mutex_destroy(&thread->lock);
+	close(thread->command_fd);
+	close(thread->event_fd);
+	free(thread->held);
+	free(thread);
+}
@@ -3,104 +3,323 @@
  * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
  */
 
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <wayland-util.h>
 
 #include <wlr/types/wlr_keyboard_group.h>
 #include <wlr/types/wlr_seat.h>
-#include <wlr/types/wlr_xdg_shell.h>
 
 #include <wlrston.h>
 #include <view.h>
+#include <profile.h>
 
-void keyboard_modifiers_notify(struct wl_listener *listener, void *data)
+/* Modifiers held down, lock modifiers left out. */
+static uint32_t keyboard_held_modifiers(struct wlr_keyboard *keyboard)
 {
-	struct wlrston_keyboard *keyboard =
-		wl_container_of(listener, keyboard, modifiers);
-	struct wlrston_seat *seat = keyboard->base.seat;
-	struct wlr_seat *wlr_seat = seat->seat;
+	return wlr_keyboard_get_modifiers(keyboard) &
+	       ~(WLR_MODIFIER_CAPS | WLR_MODIFIER_MOD2);
+}
+
+static void keyboard_modifiers_notify(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_keyboard_group *group =
+		wl_container_of(listener, group, modifiers);
+	struct wlr_keyboard *wlr_keyboard = &group->wlr_group->keyboard;
+	struct wlr_seat *wlr_seat = group->seat->seat;
+	struct switcher *switcher = &group->seat->server->switcher;
+
+	/* a no-op unless another group was typed on last */
+	wlr_seat_set_keyboard(wlr_seat, wlr_keyboard);
+	wlr_seat_keyboard_notify_modifiers(wlr_seat, &wlr_keyboard->modifiers);
 
-	wlr_seat_set_keyboard(wlr_seat, keyboard->wlr_keyboard);
-	wlr_seat_keyboard_notify_modifiers(wlr_seat,
-					   &keyboard->wlr_keyboard->modifiers);
+	/* letting go of the switcher's modifiers picks the selected view */
+	if (switcher->tree && !keyboard_held_modifiers(wlr_keyboard))
+		switcher_end(switcher, true);
 }
 
-static bool handle_keybinding(struct wlrston_server *server, xkb_keysym_t sym)
+static void binding_exec(const char *command)
 {
-	switch (sym) {
-	case XKB_KEY_Escape:
+	sigset_t set;
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		wlr_log_errno(WLR_ERROR, "failed to fork for '%s'", command);
+		return;
+	}
+	if (pid == 0) {
+		/* the grandchild is reparented to init, nobody waits for it */
+		setsid();
+		if (fork() == 0) {
+			/* the event loop blocks the signals it handles */
+			sigemptyset(&set);
+			sigprocmask(SIG_SETMASK, &set, NULL);
+			execl("/bin/sh", "/bin/sh", "-c", command, (void *)NULL);
+			_exit(127);
+		}
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+static void binding_run(struct wlrston_seat *seat, struct wlr_keyboard *keyboard,
+			const struct binding *binding)
+{
+	struct wlrston_server *server = seat->server;
+	struct wlrston_view *view;
+
+	switch (binding->action) {
+	case BINDING_EXIT:
 		wl_display_terminate(server->wl_display);
 		break;
-	case XKB_KEY_F1:
-		if (wl_list_length(&server->view_list) < 2) {
+	case BINDING_FOCUS_NEXT:
+		switcher_next(&server->switcher);
+		/* without a modifier to let go of, switch right away */
+		if (!keyboard_held_modifiers(keyboard))
+			switcher_end(&server->switcher, true);
+		break;
+	case BINDING_CLOSE:
+		/* the focused view is kept at the front */
+		if (wl_list_empty(&server->view_list))
 			break;
-		}
-		struct wlrston_view *next_view = wl_container_of(
-			server->view_list.prev, next_view, link);
-		focus_view(next_view, next_view->xdg_toplevel->base->surface);
+		view = wl_container_of(server->view_list.next, view, link);
+		view->impl->close(view);
 		break;
-	default:
+	case BINDING_EXEC:
+		binding_exec(binding->command);
+		break;
+	case BINDING_MODE:
+		seat->bindings.mode = binding->mode;
+		wlr_log(WLR_DEBUG, "binding mode '%s'",
+			server->bindings.modes[binding->mode].name);
+		break;
+	}
+}
+
+static const struct binding *
+binding_find(const struct bindings *bindings, int mode,
+	     struct wlr_keyboard *keyboard, uint32_t keycode)
+{
+	const struct binding *binding;
+	xkb_keycode_t xkb_keycode = keycode + 8;
+	xkb_layout_index_t layout;
+	const xkb_keysym_t *syms;
+	uint32_t modifiers;
+	int nsyms;
+	int i;
+
+	modifiers = wlr_keyboard_get_modifiers(keyboard);
+	binding = bindings_lookup_keycode(bindings, mode, modifiers, keycode);
+	if (binding)
+		return binding;
+
+	/*
+	 * The unshifted symbols keep Shift usable as a modifier, and there is
+	 * only one of them on nearly every key.
+	 */
+	layout = xkb_state_key_get_layout(keyboard->xkb_state, xkb_keycode);
+	nsyms = xkb_keymap_key_get_syms_by_level(keyboard->keymap, xkb_keycode,
+						 layout, 0, &syms);
+	for (i = 0; i < nsyms; i++) {
+		binding = bindings_lookup_keysym(bindings, mode, modifiers,
+						 syms[i]);
+		if (binding)
+			return binding;
+	}
+	return NULL;
+}
+
+/*
+ * Returns true if the key was taken by a binding and must not reach the
+ * client. keycode is the evdev keycode.
+ */
+bool handle_keybinding(struct wlrston_seat *seat, struct wlr_keyboard *keyboard,
+		       uint32_t keycode, enum wl_keyboard_key_state key_state)
+{
+	const struct bindings *bindings = &seat->server->bindings;
+	struct binding_state *state = &seat->bindings;
+	const struct binding *binding;
+	uint8_t bit = 1 << (keycode % 8);
+	int i;
+
+	if (keycode >= BINDING_KEYCODES)
 		return false;
+
+	if (key_state == WL_KEYBOARD_KEY_STATE_RELEASED) {
+		for (i = 0; i < state->n_releases; i++) {
+			if (state->releases[i].keycode != keycode)
+				continue;
+			binding = state->releases[i].binding;
+			state->releases[i] = state->releases[--state->n_releases];
+			binding_run(seat, keyboard, binding);
+			break;
+		}
+		if (!(state->swallowed[keycode / 8] & bit))
+			return false;
+		state->swallowed[keycode / 8] &= ~bit;
+		return true;
+	}
+
+	binding = binding_find(bindings, state->mode, keyboard, keycode);
+	if (!binding) {
+		/* a grab mode keeps every key from the clients */
+		if (!bindings->modes[state->mode].grab)
+			return false;
+	} else if (!binding->release) {
+		binding_run(seat, keyboard, binding);
+	} else if (state->n_releases < BINDING_MAX_RELEASES) {
+		state->releases[state->n_releases].keycode = keycode;
+		state->releases[state->n_releases].binding = binding;
+		state->n_releases++;
 	}
+
+	state->swallowed[keycode / 8] |= bit;
 	return true;
 }
 
-void keyboard_key_notify(struct wl_listener *listener, void *data)
+static void keyboard_key_notify(struct wl_listener *listener, void *data)
 {
-	struct wlrston_keyboard *keyboard =
-		wl_container_of(listener, keyboard, key);
-	struct wlrston_seat *seat = keyboard->base.seat;
+	PROFILE_LISTENER();
+	struct wlrston_keyboard_group *group =
+		wl_container_of(listener, group, key);
+	struct wlr_keyboard *wlr_keyboard = &group->wlr_group->keyboard;
+	struct wlrston_seat *seat = group->seat;
 	struct wlr_seat *wlr_seat = seat->seat;
 	struct wlrston_server *server = seat->server;
 	struct wlr_keyboard_key_event *event = data;
-	uint32_t keycode = event->keycode + 8;
-	bool handled = false;
-	const xkb_keysym_t *syms;
-	uint32_t modifiers;
-	int nsyms;
-	int i;
 
-	nsyms = xkb_state_key_get_syms(keyboard->wlr_keyboard->xkb_state, keycode, &syms);
-	modifiers = wlr_keyboard_get_modifiers(keyboard->wlr_keyboard);
-	if ((modifiers & WLR_MODIFIER_ALT) && event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-		for (i = 0; i < nsyms; i++) {
-			handled = handle_keybinding(server, syms[i]);
+	idle_tracker_activity(&server->idle);
+	if (handle_keybinding(seat, wlr_keyboard, event->keycode, event->state))
+		return;
+
+	wlr_seat_set_keyboard(wlr_seat, wlr_keyboard);
+	wlr_seat_keyboard_notify_key(wlr_seat, event->time_msec,
+				     event->keycode, event->state);
+	if (wlr_seat->keyboard_state.focused_client) {
+		latency_input(&server->latency,
+			      wlr_seat->keyboard_state.focused_client->client,
+			      event->time_msec);
+	}
+}
+
+static struct wlrston_keyboard_group *
+keyboard_group_create(struct wlrston_seat *seat, struct wlr_keyboard *keyboard)
+{
+	struct wlrston_keyboard_group *group;
+	struct wlr_keyboard *group_keyboard;
+
+	group = calloc(1, sizeof(*group));
+	if (!group)
+		return NULL;
+	group->wlr_group = wlr_keyboard_group_create();
+	if (!group->wlr_group) {
+		free(group);
+		return NULL;
+	}
+	group->seat = seat;
+
+	group_keyboard = &group->wlr_group->keyboard;
+	if (keyboard->keymap == seat->keymap.keymap)
+		keymap_cache_apply(&seat->keymap, group_keyboard);
+	else
+		wlr_keyboard_set_keymap(group_keyboard, keyboard->keymap);
+	wlr_keyboard_set_repeat_info(group_keyboard, keyboard->repeat_info.rate,
+				     keyboard->repeat_info.delay);
+
+	group->modifiers.notify = keyboard_modifiers_notify;
+	wl_signal_add(&group_keyboard->events.modifiers, &group->modifiers);
+	group->key.notify = keyboard_key_notify;
+	wl_signal_add(&group_keyboard->events.key, &group->key);
+	wl_list_insert(seat->keyboard_groups.prev, &group->link);
+
+	return group;
+}
+
+static void keyboard_group_destroy(struct wlrston_keyboard_group *group)
+{
+	wl_list_remove(&group->modifiers.link);
+	wl_list_remove(&group->key.link);
+	wl_list_remove(&group->link);
+	wlr_keyboard_group_destroy(group->wlr_group);
+	free(group);
+}
+
+static bool keyboard_group_matches(struct wlrston_keyboard_group *group,
+				   struct wlr_keyboard *keyboard)
+{
+	struct wlr_keyboard *group_keyboard = &group->wlr_group->keyboard;
+
+	return group_keyboard->repeat_info.rate == keyboard->repeat_info.rate &&
+		group_keyboard->repeat_info.delay == keyboard->repeat_info.delay &&
+		wlr_keyboard_keymaps_match(group_keyboard->keymap,
+					   keyboard->keymap);
+}
+
+void keyboard_add(struct wlrston_seat *seat, struct wlrston_keyboard *keyboard)
+{
+	struct wlr_keyboard *wlr_keyboard = keyboard->wlr_keyboard;
+	struct wlrston_keyboard_group *group;
+	bool found = false;
+
+	wl_list_for_each(group, &seat->keyboard_groups, link) {
+		if (keyboard_group_matches(group, wlr_keyboard)) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		group = keyboard_group_create(seat, wlr_keyboard);
+		if (!group) {
+			wlr_log(WLR_ERROR, "failed to create keyboard group");
+			return;
 		}
 	}
 
-	if (!handled) {
-		wlr_seat_set_keyboard(wlr_seat, keyboard->wlr_keyboard);
-		wlr_seat_keyboard_notify_key(wlr_seat, event->time_msec,
-					     event->keycode, event->state);
+	if (!wlr_keyboard_group_add_keyboard(group->wlr_group, wlr_keyboard)) {
+		wlr_log(WLR_ERROR, "failed to add keyboard to its group");
+		if (group->n_keyboards == 0)
+			keyboard_group_destroy(group);
+		return;
 	}
+	keyboard->group = group;
+	group->n_keyboards++;
+
+	if (!wlr_seat_get_keyboard(seat->seat))
+		wlr_seat_set_keyboard(seat->seat, &group->wlr_group->keyboard);
+}
+
+void keyboard_remove(struct wlrston_keyboard *keyboard)
+{
+	struct wlrston_keyboard_group *group = keyboard->group;
+
+	if (!group)
+		return;
+
+	wlr_keyboard_group_remove_keyboard(group->wlr_group,
+					   keyboard->wlr_keyboard);
+	keyboard->group = NULL;
+	if (--group->n_keyboards == 0)
+		keyboard_group_destroy(group);
 }
 
 void keyboard_init(struct wlrston_seat *seat)
 {
-	seat->keyboard_group = wlr_keyboard_group_create();
-	struct wlr_keyboard *kb = &seat->keyboard_group->keyboard;
 	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	struct xkb_keymap *keymap = xkb_keymap_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
 
-	if (keymap) {
-		wlr_keyboard_set_keymap(kb, keymap);
-		xkb_keymap_unref(keymap);
-	} else {
-		wlr_log(WLR_ERROR, "Failed to create xkb keymap");
-	}
+	wl_list_init(&seat->keyboard_groups);
+	keymap_cache_init(&seat->keymap, context);
 	xkb_context_unref(context);
-	wlr_keyboard_set_repeat_info(kb, 25, 600);
-
 }
 
 void keyboard_finish(struct wlrston_seat *seat)
 {
-	/*
-	 * All keyboard listeners must be removed before this to avoid use after
-	 * free
-	 */
-	if (seat->keyboard_group) {
-		wlr_keyboard_group_destroy(seat->keyboard_group);
-		seat->keyboard_group = NULL;
-	}
+	struct wlrston_keyboard_group *group, *tmp;
+
+	/* keyboards leave their groups as they go, this only catches strays */
+	wl_list_for_each_safe(group, tmp, &seat->keyboard_groups, link)
+		keyboard_group_destroy(group);
+	keymap_cache_finish(&seat->keymap);
 }
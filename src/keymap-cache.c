@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/util/log.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include <keymap-cache.h>
+
+/* The largest cached keymap read back, real ones are well below 100 KiB. */
+#define KEYMAP_MAX_SIZE (1024 * 1024)
+
+static const char *env(const char *name)
+{
+	const char *value = getenv(name);
+
+	return value ? value : "";
+}
+
+/* First line of the cache file, a different one means a stale entry. */
+static char *cache_header(void)
+{
+	char *header;
+
+	if (asprintf(&header, "wlrston keymap %s rules=%s model=%s layout=%s "
+		     "variant=%s options=%s\n", XKBCOMMON_VERSION,
+		     env("XKB_DEFAULT_RULES"), env("XKB_DEFAULT_MODEL"),
+		     env("XKB_DEFAULT_LAYOUT"), env("XKB_DEFAULT_VARIANT"),
+		     env("XKB_DEFAULT_OPTIONS")) < 0)
+		return NULL;
+	return header;
+}
+
+static char *cache_dir(void)
+{
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char *dir;
+	int ret;
+
+	if (cache_home && *cache_home)
+		ret = asprintf(&dir, "%s/wlrston", cache_home);
+	else if (home)
+		ret = asprintf(&dir, "%s/.cache/wlrston", home);
+	else
+		return NULL;
+	return ret < 0 ? NULL : dir;
+}
+
+static char *cache_path(const char *dir, const char *header)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const char *c;
+	char *path;
+
+	/* FNV-1a */
+	for (c = header; *c; c++)
+		hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+
+	if (asprintf(&path, "%s/keymap-%016" PRIx64 ".xkb", dir, hash) < 0)
+		return NULL;
+	return path;
+}
+
+/* Returns the cached keymap text, NULL if there is no valid entry. */
+static char *cache_read(const char *path, const char *header)
+{
+	size_t header_len = strlen(header);
+	char *data = NULL;
+	struct stat st;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	if (fstat(fileno(f), &st) < 0 || st.st_size <= (off_t)header_len ||
+	    st.st_size > KEYMAP_MAX_SIZE)
+		goto out;
+
+	data = malloc(st.st_size + 1);
+	if (!data)
+		goto out;
+	if (fread(data, 1, st.st_size, f) != (size_t)st.st_size ||
+	    memcmp(data, header, header_len) != 0) {
+		free(data);
+		data = NULL;
+		goto out;
+	}
+	data[st.st_size] = '\0';
+	memmove(data, data + header_len, st.st_size - header_len + 1);
+
+out:
+	fclose(f);
+	return data;
+}
+
+static void cache_write(const char *dir, const char *path, const char *header,
+			const char *text)
+{
+	char *tmp;
+	FILE *f;
+	char *c;
+
+	/* create the parents too, ~/.cache may not exist yet */
+	for (c = strchr(dir + 1, '/'); c; c = strchr(c + 1, '/')) {
+		*c = '\0';
+		mkdir(dir, 0755);
+		*c = '/';
+	}
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		wlr_log_errno(WLR_DEBUG, "cannot create %s", dir);
+		return;
+	}
+
+	/* written aside and renamed, so a reader never sees half a keymap */
+	if (asprintf(&tmp, "%s.%d", path, (int)getpid()) < 0)
+		return;
+	f = fopen(tmp, "w");
+	if (!f) {
+		wlr_log_errno(WLR_DEBUG, "cannot write %s", tmp);
+		free(tmp);
+		return;
+	}
+	if (fputs(header, f) < 0 || fputs(text, f) < 0) {
+		fclose(f);
+		unlink(tmp);
+	} else if (fclose(f) != 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+static int keymap_memfd(const char *text, size_t size)
+{
+	size_t written = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = memfd_create("wlrston-keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+
+	while (written < size) {
+		ret = write(fd, text + written, size - written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			goto failed;
+		}
+		written += ret;
+	}
+
+	/* clients map it as they like, none of them can change it */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		  F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+		goto failed;
+	return fd;
+
+failed:
+	close(fd);
+	return -1;
+}
+
+bool keymap_cache_init(struct keymap_cache *cache, struct xkb_context *context)
+{
+	char *header, *dir = NULL, *path = NULL, *text = NULL;
+
+	cache->keymap = NULL;
+	cache->fd = -1;
+	cache->size = 0;
+
+	header = cache_header();
+	if (header)
+		dir = cache_dir();
+	if (dir)
+		path = cache_path(dir, header);
+
+	if (path)
+		text = cache_read(path, header);
+	if (text) {
+		cache->keymap = xkb_keymap_new_from_string(context, text,
+			XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+		if (!cache->keymap)
+			wlr_log(WLR_ERROR, "ignoring bad cached keymap %s", path);
+		free(text);
+		text = NULL;
+	}
+
+	if (!cache->keymap) {
+		cache->keymap = xkb_keymap_new_from_names(context, NULL,
+			XKB_KEYMAP_COMPILE_NO_FLAGS);
+		if (!cache->keymap) {
+			wlr_log(WLR_ERROR, "failed to create xkb keymap");
+			goto out;
+		}
+		text = xkb_keymap_get_as_string(cache->keymap,
+						XKB_KEYMAP_FORMAT_TEXT_V1);
+		if (text && path)
+			cache_write(dir, path, header, text);
+	} else {
+		wlr_log(WLR_DEBUG, "loaded keymap from %s", path);
+		/* what clients get is the keymap's own serialization */
+		text = xkb_keymap_get_as_string(cache->keymap,
+						XKB_KEYMAP_FORMAT_TEXT_V1);
+	}
+
+	if (text) {
+		cache->size = strlen(text) + 1;
+		cache->fd = keymap_memfd(text, cache->size);
+		if (cache->fd < 0)
+			wlr_log_errno(WLR_ERROR, "failed to share keymap");
+		free(text);
+	}
+
+out:
+	free(path);
+	free(dir);
+	free(header);
+	return cache->keymap != NULL;
+}
+
+void keymap_cache_finish(struct keymap_cache *cache)
+{
+	if (cache->fd >= 0)
+		close(cache->fd);
+	xkb_keymap_unref(cache->keymap);
+	cache->keymap = NULL;
+	cache->fd = -1;
+}
+
+bool keymap_cache_apply(struct keymap_cache *cache,
+			struct wlr_keyboard *keyboard)
+{
+	int fd;
+
+	if (!wlr_keyboard_set_keymap(keyboard, cache->keymap))
+		return false;
+	if (cache->fd < 0)
+		return true;
+
+	/*
+	 * wlroots hands keymap_fd to every client as is and closes it with
+	 * the keyboard, a duplicate of the shared memfd replaces its own.
+	 */
+	fd = fcntl(cache->fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		return true;
+	close(keyboard->keymap_fd);
+	keyboard->keymap_fd = fd;
+	keyboard->keymap_size = cache->size;
+	return true;
+}
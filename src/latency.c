@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#include <latency.h>
+#include <profile.h>
+
+#define NSEC_PER_MSEC 1000000
+/* Input no answer came for in this long was ignored by the client. */
+#define LATENCY_EXPIRE_NSEC (500 * NSEC_PER_MSEC)
+
+struct latency_surface {
+	struct latency_tracker *tracker;
+	int64_t input_nsec; /* answered input not shown yet, 0 if none */
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Device timestamps are CLOCK_MONOTONIC milliseconds truncated to 32 bits,
+ * the age tells which wrap they belong to.
+ */
+static int64_t input_time_nsec(uint32_t time_msec)
+{
+	int64_t now = now_nsec();
+	uint32_t age = (uint32_t)(now / NSEC_PER_MSEC) - time_msec;
+
+	if ((int64_t)age * NSEC_PER_MSEC > LATENCY_EXPIRE_NSEC)
+		return now;
+	return (now / NSEC_PER_MSEC - age) * NSEC_PER_MSEC;
+}
+
+static void histogram_add(struct latency_histogram *histogram, int64_t nsec)
+{
+	int64_t bucket = nsec / NSEC_PER_MSEC;
+
+	if (nsec < 0)
+		return;
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum_nsec += nsec;
+	if (nsec > histogram->max_nsec)
+		histogram->max_nsec = nsec;
+}
+
+int64_t latency_histogram_percentile(const struct latency_histogram *histogram,
+				     int percent)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (histogram->count == 0)
+		return 0;
+
+	rank = (histogram->count * percent + 99) / 100;
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank)
+			return (int64_t)(i + 1) * NSEC_PER_MSEC;
+	}
+	return histogram->max_nsec;
+}
+
+static void pending_remove(struct latency_tracker *tracker, int i)
+{
+	tracker->pending[i] = tracker->pending[--tracker->n_pending];
+}
+
+static int pending_find(struct latency_tracker *tracker,
+			struct wl_client *client, int64_t now)
+{
+	int i = 0;
+
+	while (i < tracker->n_pending) {
+		if (now - tracker->pending[i].input_nsec > LATENCY_EXPIRE_NSEC) {
+			pending_remove(tracker, i);
+			continue;
+		}
+		if (tracker->pending[i].client == client)
+			return i;
+		i++;
+	}
+	return -1;
+}
+
+void latency_input(struct latency_tracker *tracker, struct wl_client *client,
+		   uint32_t time_msec)
+{
+	int64_t now = now_nsec();
+	int i;
+
+	/* an earlier input still waits, it is the one the answer is late for */
+	i = pending_find(tracker, client, now);
+	if (i >= 0 || tracker->n_pending == LATENCY_MAX_PENDING)
+		return;
+
+	i = tracker->n_pending++;
+	tracker->pending[i].client = client;
+	tracker->pending[i].input_nsec = input_time_nsec(time_msec);
+}
+
+static void surface_commit(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct latency_surface *surface = wl_container_of(listener, surface, commit);
+	struct latency_tracker *tracker = surface->tracker;
+	struct wlr_surface *wlr_surface = data;
+	struct wl_client *client;
+	int i;
+
+	if (tracker->n_pending == 0 ||
+	    !(wlr_surface->current.committed & WLR_SURFACE_STATE_BUFFER))
+		return;
+
+	client = wl_resource_get_client(wlr_surface->resource);
+	i = pending_find(tracker, client, now_nsec());
+	if (i < 0)
+		return;
+
+	if (!surface->input_nsec ||
+	    tracker->pending[i].input_nsec < surface->input_nsec)
+		surface->input_nsec = tracker->pending[i].input_nsec;
+	pending_remove(tracker, i);
+}
+
+static void surface_destroy(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct latency_surface *surface = wl_container_of(listener, surface, destroy);
+
+	wl_list_remove(&surface->commit.link);
+	wl_list_remove(&surface->destroy.link);
+	free(surface);
+}
+
+static void new_surface(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct latency_tracker *tracker =
+		wl_container_of(listener, tracker, new_surface);
+	struct wlr_surface *wlr_surface = data;
+	struct latency_surface *surface;
+
+	surface = calloc(1, sizeof(*surface));
+	if (!surface) {
+		wlr_log(WLR_ERROR, "failed to allocate latency surface");
+		return;
+	}
+	surface->tracker = tracker;
+	surface->commit.notify = surface_commit;
+	wl_signal_add(&wlr_surface->events.commit, &surface->commit);
+	surface->destroy.notify = surface_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &surface->destroy);
+}
+
+void latency_tracker_init(struct latency_tracker *tracker,
+			  struct wlr_compositor *compositor)
+{
+	tracker->n_pending = 0;
+	tracker->new_surface.notify = new_surface;
+	wl_signal_add(&compositor->events.new_surface, &tracker->new_surface);
+}
+
+void latency_tracker_finish(struct latency_tracker *tracker)
+{
+	/* surfaces only look at the tracker when they commit */
+	wl_list_remove(&tracker->new_surface.link);
+}
+
+static void output_add_in_flight(struct latency_output *output,
+				 int64_t input_nsec, uint32_t commit_seq)
+{
+	struct latency_frame_input *in_flight;
+
+	if (output->n_in_flight == output->cap_in_flight) {
+		size_t cap = output->cap_in_flight ? output->cap_in_flight * 2 : 8;
+
+		in_flight = realloc(output->in_flight, cap * sizeof(*in_flight));
+		if (!in_flight)
+			return;
+		output->in_flight = in_flight;
+		output->cap_in_flight = cap;
+	}
+	output->in_flight[output->n_in_flight].input_nsec = input_nsec;
+	output->in_flight[output->n_in_flight].commit_seq = commit_seq;
+	output->n_in_flight++;
+}
+
+/* Resolves the inputs shown by frames up to and including commit_seq. */
+static void output_resolve(struct latency_output *output, uint32_t commit_seq,
+			   int64_t present_nsec)
+{
+	size_t i = 0;
+
+	while (i < output->n_in_flight) {
+		struct latency_frame_input *input = &output->in_flight[i];
+
+		if ((int32_t)(input->commit_seq - commit_seq) > 0) {
+			i++;
+			continue;
+		}
+		if (present_nsec)
+			histogram_add(&output->histogram,
+				      present_nsec - input->input_nsec);
+		*input = output->in_flight[--output->n_in_flight];
+	}
+}
+
+struct commit_data {
+	struct latency_output *output;
+	uint32_t commit_seq;
+};
+
+static void commit_iterator(struct wlr_scene_buffer *buffer, int sx, int sy,
+			    void *data)
+{
+	struct commit_data *commit = data;
+	struct wlr_scene_surface *scene_surface;
+	struct latency_surface *surface;
+	struct wl_listener *listener;
+
+	scene_surface = wlr_scene_surface_from_buffer(buffer);
+	if (!scene_surface)
+		return;
+
+	listener = wl_signal_get(&scene_surface->surface->events.destroy,
+				 surface_destroy);
+	if (!listener)
+		return;
+	surface = wl_container_of(listener, surface, destroy);
+	if (!surface->input_nsec)
+		return;
+
+	output_add_in_flight(commit->output, surface->input_nsec,
+			     commit->commit_seq);
+	surface->input_nsec = 0;
+}
+
+void latency_output_commit(struct latency_output *output,
+			   struct wlr_scene_output *scene_output,
+			   uint32_t commit_seq)
+{
+	struct commit_data commit = {
+		.output = output,
+		.commit_seq = commit_seq,
+	};
+
+	wlr_scene_output_for_each_buffer(scene_output, commit_iterator, &commit);
+
+	if (output->presented && output->presented_seq == commit_seq)
+		output_resolve(output, commit_seq, output->presented_nsec);
+}
+
+void latency_output_present(struct latency_output *output,
+			    const struct wlr_output_event_present *event)
+{
+	int64_t when = 0;
+
+	if (event->presented && event->when)
+		when = (int64_t)event->when->tv_sec * 1000000000 +
+			event->when->tv_nsec;
+
+	output->presented = when != 0;
+	output->presented_seq = event->commit_seq;
+	output->presented_nsec = when;
+
+	/* frames that were not presented are dropped */
+	output_resolve(output, event->commit_seq, when);
+}
+
+void latency_output_finish(struct latency_output *output)
+{
+	free(output->in_flight);
+	output->in_flight = NULL;
+	output->n_in_flight = output->cap_in_flight = 0;
+}
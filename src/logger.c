@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <logger.h>
+
+/* Written out in one go once this full, or when the ring runs empty. */
+#define LOGGER_BUFFER 16384
+
+/*
+ * Bounded ring with many producers and one consumer. A slot's sequence
+ * number says whose turn it is: equal to the position when a producer
+ * may fill it, one past it once filled, LOGGER_SLOTS past it once read.
+ */
+struct log_slot {
+	size_t seq;
+	enum wlr_log_importance importance;
+	int64_t time_nsec;
+	char text[LOGGER_LINE];
+};
+
+static const char *const level_names[] = {
+	[WLR_SILENT] = "silent",
+	[WLR_ERROR] = "error",
+	[WLR_INFO] = "info",
+	[WLR_DEBUG] = "debug",
+};
+
+static const char *const level_tags[] = {
+	[WLR_SILENT] = "",
+	[WLR_ERROR] = "[ERROR]",
+	[WLR_INFO] = "[INFO]",
+	[WLR_DEBUG] = "[DEBUG]",
+};
+
+static struct {
+	struct log_slot *slots;
+	size_t head __attribute__((aligned(64))); /* next slot to reserve */
+	size_t tail __attribute__((aligned(64))); /* consumer only */
+	uint64_t dropped __attribute__((aligned(64)));
+	bool sleeping; /* the consumer waits for event_fd */
+
+	bool running;
+	bool quit;
+	pthread_t thread;
+	int event_fd;
+	int64_t start_nsec;
+} logger = { .event_fd = -1 };
+
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Same prefix as wlroots' own logger, time since start and level. */
+static int format_prefix(char *buf, size_t size,
+			 enum wlr_log_importance importance, int64_t time_nsec)
+{
+	int64_t elapsed = time_nsec - logger.start_nsec;
+	int64_t sec = elapsed / 1000000000;
+
+	return snprintf(buf, size, "%02d:%02d:%02d.%03d %s ",
+			(int)(sec / 3600), (int)(sec / 60 % 60), (int)(sec % 60),
+			(int)(elapsed / 1000000 % 1000),
+			importance < WLR_LOG_IMPORTANCE_LAST ?
+			level_tags[importance] : "");
+}
+
+static void write_all(const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(STDERR_FILENO, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		buf += ret;
+		len -= ret;
+	}
+}
+
+static void log_sync(enum wlr_log_importance importance, const char *fmt,
+		     va_list args)
+{
+	char prefix[64];
+
+	if (importance > wlr_log_get_verbosity())
+		return;
+	format_prefix(prefix, sizeof(prefix), importance, now_nsec());
+	fputs(prefix, stderr);
+	vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+}
+
+static void wake_consumer(void)
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	/* only once per sleep, a busy consumer costs no syscall */
+	if (!__atomic_load_n(&logger.sleeping, __ATOMIC_SEQ_CST) ||
+	    !__atomic_exchange_n(&logger.sleeping, false, __ATOMIC_SEQ_CST))
+		return;
+	/* there is nowhere to report a failure to */
+	ret = write(logger.event_fd, &one, sizeof(one));
+	(void)ret;
+}
+
+static void log_ring(enum wlr_log_importance importance, const char *fmt,
+		     va_list args)
+{
+	size_t pos = __atomic_load_n(&logger.head, __ATOMIC_RELAXED);
+	struct log_slot *slot;
+	size_t seq;
+
+	/* wlroots leaves filtering to the callback */
+	if (importance > wlr_log_get_verbosity())
+		return;
+
+	for (;;) {
+		slot = &logger.slots[pos & (LOGGER_SLOTS - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			/* reloads pos when another producer got there first */
+			if (__atomic_compare_exchange_n(&logger.head, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if ((ptrdiff_t)(seq - pos) < 0) {
+			/* a lap behind, the ring is full */
+			__atomic_fetch_add(&logger.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&logger.head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->importance = importance;
+	slot->time_nsec = now_nsec();
+	vsnprintf(slot->text, sizeof(slot->text), fmt, args);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+	wake_consumer();
+}
+
+/* Appends the filled slots to buf, returns false once the ring is empty. */
+static bool drain(char *buf, size_t *len)
+{
+	struct log_slot *slot;
+	int n;
+
+	for (;;) {
+		slot = &logger.slots[logger.tail & (LOGGER_SLOTS - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) !=
+		    logger.tail + 1)
+			return false;
+		if (LOGGER_BUFFER - *len < LOGGER_LINE + 64)
+			return true;
+
+		n = format_prefix(buf + *len, LOGGER_BUFFER - *len,
+				  slot->importance, slot->time_nsec);
+		*len += n;
+		n = strnlen(slot->text, sizeof(slot->text));
+		memcpy(buf + *len, slot->text, n);
+		*len += n;
+		buf[(*len)++] = '\n';
+
+		__atomic_store_n(&slot->seq, logger.tail + LOGGER_SLOTS,
+				 __ATOMIC_RELEASE);
+		logger.tail++;
+	}
+}
+
+static void *logger_thread(void *data)
+{
+	static char buf[LOGGER_BUFFER];
+	uint64_t dropped_seen = 0, dropped, count;
+	struct pollfd pfd = { .fd = logger.event_fd, .events = POLLIN };
+	bool more;
+	size_t len;
+
+	for (;;) {
+		do {
+			len = 0;
+			more = drain(buf, &len);
+			write_all(buf, len);
+		} while (more);
+
+		dropped = __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+		if (dropped != dropped_seen) {
+			len = snprintf(buf, sizeof(buf),
+				       "[logger] dropped %" PRIu64
+				       " messages, the ring was full\n",
+				       dropped - dropped_seen);
+			write_all(buf, len);
+			dropped_seen = dropped;
+		}
+
+		if (__atomic_load_n(&logger.quit, __ATOMIC_ACQUIRE))
+			break;
+
+		__atomic_store_n(&logger.sleeping, true, __ATOMIC_SEQ_CST);
+		/* a message published before sleeping was set saw us awake */
+		if (__atomic_load_n(&logger.slots[logger.tail &
+						  (LOGGER_SLOTS - 1)].seq,
+				    __ATOMIC_SEQ_CST) == logger.tail + 1) {
+			__atomic_store_n(&logger.sleeping, false,
+					 __ATOMIC_SEQ_CST);
+			continue;
+		}
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			break;
+		if (read(logger.event_fd, &count, sizeof(count)) < 0 &&
+		    errno != EAGAIN)
+			break;
+	}
+
+	return NULL;
+}
+
+bool logger_init(enum wlr_log_importance level)
+{
+	size_t i;
+
+	logger.start_nsec = now_nsec();
+	logger.slots = calloc(LOGGER_SLOTS, sizeof(*logger.slots));
+	if (!logger.slots)
+		return false;
+	for (i = 0; i < LOGGER_SLOTS; i++)
+		logger.slots[i].seq = i;
+
+	logger.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (logger.event_fd < 0)
+		goto failed_free_slots;
+	if (pthread_create(&logger.thread, NULL, logger_thread, NULL) != 0)
+		goto failed_close_event_fd;
+
+	logger.running = true;
+	wlr_log_init(level, log_ring);
+	return true;
+
+failed_close_event_fd:
+	close(logger.event_fd);
+	logger.event_fd = -1;
+failed_free_slots:
+	free(logger.slots);
+	logger.slots = NULL;
+	return false;
+}
+
+void logger_finish(void)
+{
+	if (!logger.running)
+		return;
+
+	/* messages from other threads racing this go out directly */
+	wlr_log_init(wlr_log_get_verbosity(), log_sync);
+	__atomic_store_n(&logger.quit, true, __ATOMIC_RELEASE);
+	__atomic_store_n(&logger.sleeping, true, __ATOMIC_SEQ_CST);
+	wake_consumer();
+	pthread_join(logger.thread, NULL);
+	logger.running = false;
+
+	close(logger.event_fd);
+	logger.event_fd = -1;
+	/* a producer may still be filling a slot, leave the ring allocated */
+}
+
+void logger_set_level(enum wlr_log_importance level)
+{
+	/* keeps the current sink */
+	wlr_log_init(level, NULL);
+}
+
+const char *logger_level_name(enum wlr_log_importance level)
+{
+	return level < WLR_LOG_IMPORTANCE_LAST ? level_names[level] : "?";
+}
+
+bool logger_parse_level(const char *name, enum wlr_log_importance *level)
+{
+	int i;
+
+	for (i = 0; i < WLR_LOG_IMPORTANCE_LAST; i++) {
+		if (strcmp(name, level_names[i]) == 0) {
+			*level = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint64_t logger_dropped(void)
+{
+	return __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+}
@@ -11,6 +11,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
+#include <wlr/render/pixman.h>
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 #include <signal.h>
@@ -18,6 +19,14 @@
 #include <dlfcn.h>
 
 #include <wlrston.h>
+#include <logger.h>
+#include <profile.h>
+#if HAVE_INPUT_THREAD
+#include <input-thread.h>
+#endif
+#if HAVE_XWAYLAND
+#include <xwayland.h>
+#endif
 
 static int on_term_signal(int signal_number, void *data)
 {
@@ -29,11 +38,142 @@ static int on_term_signal(int signal_number, void *data)
 	return 1;
 }
 
+static int on_stats_signal(int signal_number, void *data)
+{
+	struct wlrston_server *server = data;
+
+	stats_write(server);
+
+	return 1;
+}
+
+/* Steps through error, info and debug. */
+static int on_log_level_signal(int signal_number, void *data)
+{
+	enum wlr_log_importance level = wlr_log_get_verbosity();
+
+	level = level >= WLR_DEBUG ? WLR_ERROR : level + 1;
+	logger_set_level(level);
+	wlr_log(WLR_ERROR, "log level is now %s", logger_level_name(level));
+
+	return 1;
+}
+
 static void sigint_helper(int sig)
 {
 	raise(SIGUSR2);
 }
 
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	       "  -s, --startup=CMD          run CMD after startup\n"
+	       "  -r, --max-render-time=MS   start rendering MS milliseconds before\n"
+	       "                             vblank, or 'auto' to learn it (default: off)\n"
+	       "  -t, --render-threads       render each output on its own thread,\n"
+	       "                             needs WLR_RENDERER=pixman\n"
+	       "  -i, --input-thread         read libinput devices on their own thread\n"
+	       "  -I, --idle-timeout=SEC     power outputs off after SEC seconds\n"
+	       "                             without input, 0 never (default: 600)\n"
+	       "  -m, --client-memory=MIB    disconnect clients whose buffers take\n"
+	       "                             more than MIB MiB, 0 never (default: 0)\n"
+	       "  -b, --limit-buffers        disconnect clients attaching buffers\n"
+	       "                             larger than the largest output\n"
+	       "  -f, --fair-dispatch=N      apply at most N commits of a client per\n"
+	       "                             event loop iteration, 0 any (default: 0)\n"
+	       "  -l, --log-level=LEVEL      silent, error, info or debug, SIGHUP\n"
+	       "                             steps through them (default: debug)\n"
+	       "  -S, --sync-log             write log messages before going on,\n"
+	       "                             instead of from a thread\n"
+	       "  -x, --xwayland-idle=SEC    stop Xwayland after SEC seconds without\n"
+	       "                             X11 windows, 0 never (default: 60)\n"
+	       "  -p, --profile              time event loop callbacks, see SIGUSR1\n"
+	       "  -c, --config=FILE          read key bindings from FILE (default:\n"
+	       "                             $XDG_CONFIG_HOME/wlrston/bindings)\n"
+	       "  -h, --help                 show this help\n", name);
+}
+
+static bool parse_render_time(const char *arg, int *value)
+{
+	char *end;
+	long ms;
+
+	if (strcmp(arg, "auto") == 0) {
+		*value = WLRSTON_RENDER_TIME_AUTO;
+		return true;
+	}
+
+	ms = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || ms < 0 || ms > 1000)
+		return false;
+
+	*value = ms;
+	return true;
+}
+
+static bool parse_seconds(const char *arg, int *value)
+{
+	char *end;
+	long sec;
+
+	sec = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || sec < 0 || sec > 24 * 60 * 60)
+		return false;
+
+	*value = sec;
+	return true;
+}
+
+static bool parse_mib(const char *arg, int *value)
+{
+	char *end;
+	long mib;
+
+	mib = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || mib < 0 || mib > 1024 * 1024)
+		return false;
+
+	*value = mib;
+	return true;
+}
+
+static bool parse_commits(const char *arg, int *value)
+{
+	char *end;
+	long commits;
+
+	commits = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || commits < 0 || commits > 1000)
+		return false;
+
+	*value = commits;
+	return true;
+}
+
+/* The user's bindings file, NULL if there is none. */
+static char *default_bindings_path(void)
+{
+	const char *config_home = getenv("XDG_CONFIG_HOME");
+	const char *home = getenv("HOME");
+	char *path;
+	int ret;
+
+	if (config_home && *config_home)
+		ret = asprintf(&path, "%s/wlrston/bindings", config_home);
+	else if (home)
+		ret = asprintf(&path, "%s/.config/wlrston/bindings", home);
+	else
+		return NULL;
+	if (ret < 0)
+		return NULL;
+
+	if (access(path, R_OK) != 0) {
+		free(path);
+		return NULL;
+	}
+	return path;
+}
+
 static size_t
 module_path_from_env(const char *name, char *path, size_t path_len)
 {
@@ -135,10 +275,47 @@ load_shell(struct wlrston_server *server, const char *name, int *argc, char *arg
 
 int main(int argc, char *argv[])
 {
+	static const struct option long_options[] = {
+		{ "startup", required_argument, NULL, 's' },
+		{ "max-render-time", required_argument, NULL, 'r' },
+		{ "render-threads", no_argument, NULL, 't' },
+		{ "input-thread", no_argument, NULL, 'i' },
+		{ "idle-timeout", required_argument, NULL, 'I' },
+		{ "client-memory", required_argument, NULL, 'm' },
+		{ "limit-buffers", no_argument, NULL, 'b' },
+		{ "fair-dispatch", required_argument, NULL, 'f' },
+		{ "log-level", required_argument, NULL, 'l' },
+		{ "sync-log", no_argument, NULL, 'S' },
+		{ "xwayland-idle", required_argument, NULL, 'x' },
+		{ "profile", no_argument, NULL, 'p' },
+		{ "config", required_argument, NULL, 'c' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
 	char *startup_cmd = NULL;
+	char *bindings_path = NULL;
+	int max_render_time = 0;
+	bool render_threads = false;
+	bool use_input_thread = false;
+	int idle_timeout = 600;
+	int client_memory = 0;
+	bool limit_buffers = false;
+	int fair_dispatch = 0;
+	enum wlr_log_importance log_level = WLR_DEBUG;
+	bool sync_log = false;
+	bool profile = false;
+	int xwayland_idle = 60;
+#if HAVE_INPUT_THREAD
+	struct input_thread *input_thread = NULL;
+#endif
+#if HAVE_XWAYLAND
+	struct xwayland *xwayland = NULL;
+#endif
 	struct wlrston_server *server;
 	struct wl_display *display;
-	struct wl_event_source *signals[2];
+	struct wl_event_source *signals[3];
+	struct wl_event_source *stats_signal = NULL;
+	const char *runtime_dir;
 	struct wl_event_loop *loop;
 	struct sigaction action;
 	int i;
@@ -146,21 +323,78 @@ int main(int argc, char *argv[])
 
 	wlr_log_init(WLR_DEBUG, NULL);
 
-	while ((c = getopt(argc, argv, "s:h")) != -1) {
+	while ((c = getopt_long(argc, argv, "s:r:tiI:m:bf:l:Sx:pc:h", long_options, NULL)) != -1) {
 		switch (c) {
 		case 's':
 			startup_cmd = optarg;
 			break;
+		case 'r':
+			if (!parse_render_time(optarg, &max_render_time)) {
+				fprintf(stderr, "invalid max render time '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			render_threads = true;
+			break;
+		case 'i':
+			use_input_thread = true;
+			break;
+		case 'I':
+			if (!parse_seconds(optarg, &idle_timeout)) {
+				fprintf(stderr, "invalid idle timeout '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			if (!parse_mib(optarg, &client_memory)) {
+				fprintf(stderr, "invalid client memory '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b':
+			limit_buffers = true;
+			break;
+		case 'f':
+			if (!parse_commits(optarg, &fair_dispatch)) {
+				fprintf(stderr, "invalid commit budget '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'l':
+			if (!logger_parse_level(optarg, &log_level)) {
+				fprintf(stderr, "invalid log level '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'S':
+			sync_log = true;
+			break;
+		case 'x':
+			if (!parse_seconds(optarg, &xwayland_idle)) {
+				fprintf(stderr, "invalid Xwayland idle time '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			profile = true;
+			break;
+		case 'c':
+			bindings_path = strdup(optarg);
+			break;
 		default:
-			printf("Usage: %s [-s startup command]\n", argv[0]);
+			usage(argv[0]);
 			return 0;
 		}
 	}
 	if (optind < argc) {
-		printf("Usage: %s [-s startup command]\n", argv[0]);
+		usage(argv[0]);
 		return 0;
 	}
 
+	if (sync_log || !logger_init(log_level))
+		logger_set_level(log_level);
+
 	display = wl_display_create();
 	if (display == NULL) {
 		wlr_log(WLR_ERROR,"fatal: failed to create display\n");
@@ -172,18 +406,48 @@ int main(int argc, char *argv[])
 					      display);
 	signals[1] = wl_event_loop_add_signal(loop, SIGUSR2, on_term_signal,
 					      display);
+	signals[2] = wl_event_loop_add_signal(loop, SIGHUP, on_log_level_signal,
+					      NULL);
 
 	action.sa_handler = sigint_helper;
 	sigemptyset(&action.sa_mask);
 	action.sa_flags = 0;
 	sigaction(SIGINT, &action, NULL);
-	if (!signals[0] || !signals[1])
+	if (!signals[0] || !signals[1] || !signals[2])
 		goto out_signals;
 
 	server = server_create(display);
 	if (!server) {
 		goto out_signals;
 	}
+	server->max_render_time = max_render_time;
+	if (render_threads && !wlr_renderer_is_pixman(server->renderer)) {
+		wlr_log(WLR_ERROR, "render threads need the pixman renderer, "
+			"rendering on the main thread");
+		render_threads = false;
+	}
+	server->render_threads = render_threads;
+	if (profile)
+		profile_init(server);
+	idle_tracker_set_timeout(&server->idle, idle_timeout * 1000);
+	server->clients.limits.memory_bytes = (uint64_t)client_memory << 20;
+	server->clients.limits.buffer_output_size = limit_buffers;
+	server->clients.limits.commits_per_iteration = fair_dispatch;
+
+	if (!bindings_path)
+		bindings_path = default_bindings_path();
+	if (bindings_path &&
+	    !bindings_load(&server->bindings, bindings_path))
+		wlr_log(WLR_ERROR, "using the default key bindings");
+	free(bindings_path);
+
+	if (use_input_thread) {
+#if HAVE_INPUT_THREAD
+		input_thread = input_thread_create(server);
+#else
+		wlr_log(WLR_ERROR, "built without libinput, no input thread");
+#endif
+	}
 
 	if (!server_start(server))
 		goto out;
@@ -193,9 +457,24 @@ int main(int argc, char *argv[])
 	if (!socket)
 		goto out;
 
+	runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir) {
+		if (asprintf(&server->stats_path, "%s/wlrston-%s.stats",
+			     runtime_dir, socket) < 0)
+			server->stats_path = NULL;
+	}
+	stats_signal = wl_event_loop_add_signal(loop, SIGUSR1, on_stats_signal,
+						server);
+
 	// load_shell
 	load_shell(server, "desktop-shell.so", &argc, argv);
 
+#if HAVE_XWAYLAND
+	xwayland = xwayland_create(server, xwayland_idle);
+#else
+	(void)xwayland_idle;
+#endif
+
 	setenv("WAYLAND_DISPLAY", socket, true);
 	if (startup_cmd) {
 		if (fork() == 0) {
@@ -208,13 +487,24 @@ int main(int argc, char *argv[])
 	wl_display_run(display);
 
 out:
+#if HAVE_XWAYLAND
+	xwayland_destroy(xwayland);
+#endif
+#if HAVE_INPUT_THREAD
+	input_thread_destroy(input_thread);
+#endif
+	if (stats_signal)
+		wl_event_source_remove(stats_signal);
+	free(server->stats_path);
+	profile_finish();
 	server_destory(server);
 
 out_signals:
-	for (i = 1; i >= 0; i--)
+	for (i = 2; i >= 0; i--)
 		if (signals[i])
 			wl_event_source_remove(signals[i]);
 
 out_display:
+	logger_finish();
 	return 0;
 }
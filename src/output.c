@@ -10,61 +10,372 @@
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_scene.h>
 
+#include <cursor-theme.h>
+#include <render.h>
 #include <wlrston.h>
+#include <view.h>
+#include <profile.h>
 
-static void output_frame(struct wl_listener *listener, void *data)
+/* Margin added on top of the measured render time in auto mode. */
+#define RENDER_TIME_SLACK_NSEC 1000000
+/* Per-frame decay of the render time peak, in 1/1024 units. */
+#define RENDER_TIME_DECAY 1004
+/* Frame callback interval for views that are completely covered. */
+#define HIDDEN_FRAME_INTERVAL_NSEC 1000000000
+
+static int64_t timespec_to_nsec(const struct timespec *ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static int output_refresh_nsec(struct wlrston_output *output)
+{
+	if (output->refresh_nsec > 0)
+		return output->refresh_nsec;
+	if (output->wlr_output->refresh > 0)
+		return 1000000000000LL / output->wlr_output->refresh;
+	return 0;
+}
+
+static int output_render_budget_nsec(struct wlrston_output *output)
+{
+	int max_render_time = output->server->max_render_time;
+
+	if (max_render_time == WLRSTON_RENDER_TIME_AUTO) {
+		if (output->render_time_nsec == 0)
+			return 0;
+		return output->render_time_nsec + RENDER_TIME_SLACK_NSEC;
+	}
+	return max_render_time * 1000000;
+}
+
+/*
+ * Milliseconds to wait after the frame event before rendering, so that
+ * rendering starts the render budget ahead of the predicted vblank.
+ */
+static int output_repaint_delay(struct wlrston_output *output)
+{
+	int64_t refresh, budget, next_vblank, now_nsec;
+	struct timespec now;
+
+	if (output->server->max_render_time == 0)
+		return 0;
+
+	refresh = output_refresh_nsec(output);
+	budget = output_render_budget_nsec(output);
+	if (refresh == 0 || budget == 0 || budget >= refresh)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_nsec = timespec_to_nsec(&now);
+	next_vblank = timespec_to_nsec(&output->last_present);
+	if (next_vblank == 0)
+		return 0;
+	while (next_vblank <= now_nsec)
+		next_vblank += refresh;
+
+	return (next_vblank - budget - now_nsec) / 1000000;
+}
+
+static void output_update_render_time(struct wlrston_output *output,
+				      int64_t duration)
+{
+	int64_t peak = output->render_time_nsec * RENDER_TIME_DECAY / 1024;
+
+	output->render_time_nsec = duration > peak ? duration : peak;
+	wl_signal_emit(&output->events.rendered, &duration);
+}
+
+static void output_render_done(void *data, int64_t duration)
+{
+	struct wlrston_output *output = data;
+
+	output_update_render_time(output, duration);
+}
+
+static void output_render(struct wlrston_output *output)
 {
-	struct wlrston_output *output = wl_container_of(listener, output, frame);
 	struct wlr_scene *scene = output->server->scene;
 	struct wlr_scene_output *scene_output;
-	struct timespec now;
+	struct timespec start, end;
+
+	if (!output->wlr_output->enabled)
+		return;
+
+	/* for pointer devices that never send a frame event */
+	cursor_flush_motion(&output->server->seat);
+
+	/* The worker commits and reports its render time when done. */
+	if (output->render_worker &&
+	    render_worker_submit(output->render_worker))
+		return;
 
 	scene_output = wlr_scene_get_scene_output(scene, output->wlr_output);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	wlr_scene_output_commit(scene_output);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	wlr_scene_output_send_frame_done(scene_output, &now);
+	output_update_render_time(output, timespec_to_nsec(&end) -
+				  timespec_to_nsec(&start));
+}
+
+struct frame_done_data {
+	struct wlrston_server *server;
+	struct wlr_scene_output *scene_output;
+	struct timespec now;
+	int64_t now_nsec;
+};
+
+static struct wlrston_view *view_from_node(struct wlr_scene_node *node)
+{
+	struct wlr_scene_tree *tree = node->parent;
+
+	while (tree != NULL && tree->node.data == NULL)
+		tree = tree->node.parent;
+	return tree ? tree->node.data : NULL;
+}
+
+static void send_frame_done_iterator(struct wlr_scene_buffer *buffer,
+				     int sx, int sy, void *data)
+{
+	struct frame_done_data *frame = data;
+	struct wlrston_view *view;
+
+	if (buffer->primary_output != frame->scene_output)
+		return;
+
+	/*
+	 * A covered view gets one frame callback per interval. All of its
+	 * surfaces are sent theirs in the same pass, recognized by the
+	 * timestamp of the pass.
+	 */
+	view = view_from_node(&buffer->node);
+	if (view && view->occluded &&
+	    view->hidden_frame_nsec != frame->now_nsec) {
+		if (frame->now_nsec - view->hidden_frame_nsec <
+		    HIDDEN_FRAME_INTERVAL_NSEC) {
+			frame->server->stats.frames_throttled++;
+			return;
+		}
+		view->hidden_frame_nsec = frame->now_nsec;
+	}
+
+	wlr_scene_buffer_send_frame_done(buffer, &frame->now);
+	frame->server->stats.frames_sent++;
+}
+
+/*
+ * Like wlr_scene_output_send_frame_done(), except that views nobody can
+ * see are throttled. Culled views are disabled in the scene and get none.
+ */
+static void output_send_frame_done(struct wlrston_output *output)
+{
+	struct wlrston_server *server = output->server;
+	struct frame_done_data frame = { .server = server };
+
+	server_update_occlusion(server);
+
+	frame.scene_output = wlr_scene_get_scene_output(server->scene,
+							output->wlr_output);
+	clock_gettime(CLOCK_MONOTONIC, &frame.now);
+	frame.now_nsec = timespec_to_nsec(&frame.now);
+
+	wlr_scene_output_for_each_buffer(frame.scene_output,
+					 send_frame_done_iterator, &frame);
+	server_send_saved_frame_done(server, output, &frame.now);
+}
+
+static int output_repaint_timer(void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_output *output = data;
+
+	output->repaint_scheduled = false;
+	output_render(output);
+	switcher_refresh(&output->server->switcher, output->wlr_output);
+
+	return 0;
+}
+
+static void output_frame(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_output *output = wl_container_of(listener, output, frame);
+	int delay;
+
+	/* A client commit may trigger another frame while we are waiting. */
+	if (output->repaint_scheduled)
+		return;
+
+	delay = output_repaint_delay(output);
+	if (delay < 1) {
+		output_render(output);
+		output_send_frame_done(output);
+		switcher_refresh(&output->server->switcher, output->wlr_output);
+		return;
+	}
+
+	/*
+	 * Let clients draw now, so that their buffers make it into the
+	 * render that happens just ahead of vblank.
+	 */
+	output_send_frame_done(output);
+	output->repaint_scheduled = true;
+	wl_event_source_timer_update(output->repaint_timer, delay);
+}
+
+static void output_commit(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_output *output = wl_container_of(listener, output, commit);
+	struct wlr_output_event_commit *event = data;
+	struct wlr_scene_output *scene_output;
+
+	if (!(event->committed & WLR_OUTPUT_STATE_BUFFER))
+		return;
+
+	scene_output = wlr_scene_get_scene_output(output->server->scene,
+						  output->wlr_output);
+	if (scene_output)
+		latency_output_commit(&output->latency, scene_output,
+				      output->wlr_output->commit_seq);
+}
+
+static void output_present(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_output *output = wl_container_of(listener, output, present);
+	struct wlr_output_event_present *event = data;
+
+	latency_output_present(&output->latency, event);
+
+	if (!event->presented || event->when == NULL)
+		return;
+
+	output->last_present = *event->when;
+	output->refresh_nsec = event->refresh;
+}
+
+/*
+ * A disabled output sends no frame events, so nothing is rendered and
+ * clients get no frame callbacks until it is enabled again.
+ */
+void output_set_power(struct wlrston_output *output, bool on)
+{
+	struct wlr_output *wlr_output = output->wlr_output;
+
+	if (wlr_output->enabled == on)
+		return;
+
+	if (!on) {
+		output->repaint_scheduled = false;
+		wl_event_source_timer_update(output->repaint_timer, 0);
+	}
+
+	wlr_output_enable(wlr_output, on);
+	if (!wlr_output_commit(wlr_output)) {
+		wlr_log(WLR_ERROR, "failed to power %s %s", wlr_output->name,
+			on ? "on" : "off");
+		return;
+	}
+	if (on)
+		wlr_output_schedule_frame(wlr_output);
 }
 
 static void output_destroy(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_output *output = wl_container_of(listener, output, destroy);
+	struct wlrston_server *server = output->server;
+
+	if (output->fullscreen_view)
+		view_set_fullscreen(output->fullscreen_view, false, NULL);
+	/* it would never be refreshed again */
+	if (server->switcher.output == output->wlr_output)
+		switcher_end(&server->switcher, false);
 
+	render_worker_destroy(output->render_worker);
+	wl_event_source_remove(output->repaint_timer);
 	wl_list_remove(&output->frame.link);
+	wl_list_remove(&output->commit.link);
+	wl_list_remove(&output->present.link);
 	wl_list_remove(&output->destroy.link);
 	wl_list_remove(&output->link);
-	free(output);
+	output->wlr_output->data = NULL;
+	latency_output_finish(&output->latency);
+	pool_free(&server->pools.outputs, output);
+
+	server_update_visibility(server);
 }
 
 void output_new(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_server *server =
 		wl_container_of(listener, server, new_output);
 	struct wlr_output *wlr_output = data;
 	struct wlr_output_mode *mode;
 	struct wlrston_output *output;
+	struct wl_event_loop *loop;
 
 	wlr_output_init_render(wlr_output, server->allocator, server->renderer);
 
+	/* Headless and nested outputs have no modes, but need enabling too. */
+	wlr_output_enable(wlr_output, true);
 	if (!wl_list_empty(&wlr_output->modes)) {
 		mode = wlr_output_preferred_mode(wlr_output);
 		wlr_output_set_mode(wlr_output, mode);
-		wlr_output_enable(wlr_output, true);
-		if (!wlr_output_commit(wlr_output)) {
-			return;
-		}
+	}
+	if (!wlr_output_commit(wlr_output)) {
+		return;
 	}
 
-	output = calloc(1, sizeof(struct wlrston_output));
+	output = pool_zalloc(&server->pools.outputs);
+	if (!output) {
+		wlr_log(WLR_ERROR, "failed to allocate output %s",
+			wlr_output->name);
+		return;
+	}
 	output->wlr_output = wlr_output;
 	output->server = server;
+	wlr_output->data = output;
+	wl_signal_init(&output->events.rendered);
+
+	loop = wl_display_get_event_loop(server->wl_display);
+	output->repaint_timer = wl_event_loop_add_timer(loop,
+							output_repaint_timer,
+							output);
+
 	output->frame.notify = output_frame;
 	wl_signal_add(&wlr_output->events.frame, &output->frame);
 
+	output->commit.notify = output_commit;
+	wl_signal_add(&wlr_output->events.commit, &output->commit);
+
+	output->present.notify = output_present;
+	wl_signal_add(&wlr_output->events.present, &output->present);
+
 	output->destroy.notify = output_destroy;
 	wl_signal_add(&wlr_output->events.destroy, &output->destroy);
 
 	wl_list_insert(&server->output_list, &output->link);
 
 	wlr_output_layout_add_auto(server->output_layout, wlr_output);
+	server_update_visibility(server);
+
+	if (server->seat.cursor_theme)
+		cursor_theme_load(server->seat.cursor_theme, wlr_output->scale);
+
+	if (server->render_threads) {
+		output->render_worker = render_worker_create(wlr_output,
+							     server->scene,
+							     server->allocator,
+							     loop,
+							     output_render_done,
+							     output);
+		if (!output->render_worker)
+			wlr_log(WLR_ERROR, "rendering %s on the main thread",
+				wlr_output->name);
+	}
 }
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wlr/util/log.h>
+
+#include <pool.h>
+
+#define POOL_SLAB_SIZE (16 * 1024)
+
+/* Takes the first cache line of a slab, the objects follow. */
+struct pool_slab {
+	struct pool_slab *next;
+};
+
+struct pool_free {
+	struct pool_free *next;
+};
+
+void pool_init(struct pool *pool, const char *name, size_t size)
+{
+	memset(pool, 0, sizeof(*pool));
+	pool->name = name;
+	pool->size = size;
+	pool->stride = (size + POOL_CACHE_LINE - 1) & ~(size_t)(POOL_CACHE_LINE - 1);
+	pool->per_slab = (POOL_SLAB_SIZE - POOL_CACHE_LINE) / pool->stride;
+	if (pool->per_slab == 0)
+		pool->per_slab = 1;
+}
+
+void pool_finish(struct pool *pool)
+{
+	struct pool_slab *slab, *next;
+
+	/* still referenced, they go away with the process */
+	if (pool->live) {
+		wlr_log(WLR_DEBUG, "%zu %s still alive, keeping their slabs",
+			pool->live, pool->name);
+		return;
+	}
+
+	for (slab = pool->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+	pool->slabs = NULL;
+	pool->free_list = NULL;
+	pool->n_slabs = 0;
+}
+
+static bool pool_grow(struct pool *pool)
+{
+	struct pool_slab *slab;
+	struct pool_free *object;
+	char *objects;
+	size_t i;
+
+	slab = aligned_alloc(POOL_CACHE_LINE,
+			     POOL_CACHE_LINE + pool->per_slab * pool->stride);
+	if (!slab)
+		return false;
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	pool->n_slabs++;
+
+	/* in address order, so a fresh slab is handed out front to back */
+	objects = (char *)slab + POOL_CACHE_LINE;
+	for (i = pool->per_slab; i-- > 0;) {
+		object = (struct pool_free *)(objects + i * pool->stride);
+		object->next = pool->free_list;
+		pool->free_list = object;
+	}
+	return true;
+}
+
+void *pool_zalloc(struct pool *pool)
+{
+	struct pool_free *object;
+
+	if (!pool->free_list && !pool_grow(pool))
+		return NULL;
+
+	object = pool->free_list;
+	pool->free_list = object->next;
+	memset(object, 0, pool->size);
+
+	if (++pool->live > pool->peak)
+		pool->peak = pool->live;
+	return object;
+}
+
+void pool_free(struct pool *pool, void *object)
+{
+	struct pool_free *entry = object;
+
+	if (!object)
+		return;
+	entry->next = pool->free_list;
+	pool->free_list = entry;
+	pool->live--;
+}
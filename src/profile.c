@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include <wlr/types/wlr_output.h>
+
+#include <wlrston.h>
+#include <profile.h>
+
+/* dispatches at least this long go into the slow ring */
+#define PROFILE_SLOW_NSEC 1000000
+
+struct profile_slow {
+	const char *name; /* NULL for a free slot */
+	int64_t nsec;
+	int64_t end_nsec;
+};
+
+bool profile_enabled;
+
+static struct {
+	struct wlrston_server *server;
+	struct wl_event_loop *loop;
+	struct profile_site *sites;
+	int depth;
+
+	/* the iteration being dispatched */
+	struct wl_event_source *iteration_idle;
+	int64_t iteration_start_nsec;
+	struct profile_site *iteration_slowest;
+	int64_t iteration_slowest_nsec;
+
+	uint64_t iterations;
+	uint64_t overruns;
+	int64_t iteration_max_nsec;
+
+	struct profile_slow slow[PROFILE_SLOW_RING];
+	int slow_next;
+} profiler;
+
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucket_for(int64_t nsec)
+{
+	int64_t usec = nsec / 1000;
+	int bucket = 0;
+
+	while (usec > 0 && bucket < PROFILE_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void slow_push(const char *name, int64_t nsec, int64_t end_nsec)
+{
+	struct profile_slow *slow = &profiler.slow[profiler.slow_next];
+
+	slow->name = name;
+	slow->nsec = nsec;
+	slow->end_nsec = end_nsec;
+	profiler.slow_next = (profiler.slow_next + 1) % PROFILE_SLOW_RING;
+}
+
+/* The shortest refresh interval of the enabled outputs. */
+static int64_t frame_budget_nsec(void)
+{
+	struct wlrston_output *output;
+	int64_t budget = 0;
+
+	wl_list_for_each(output, &profiler.server->output_list, link) {
+		if (!output->wlr_output->enabled || output->refresh_nsec <= 0)
+			continue;
+		if (budget == 0 || output->refresh_nsec < budget)
+			budget = output->refresh_nsec;
+	}
+	return budget ? budget : 1000000000 / 60;
+}
+
+/* Runs after the sources and idle callbacks of the iteration. */
+static void iteration_end(void *data)
+{
+	int64_t end = now_nsec();
+	int64_t nsec = end - profiler.iteration_start_nsec;
+	int64_t budget = frame_budget_nsec();
+
+	profiler.iteration_idle = NULL;
+	profiler.iterations++;
+	if (nsec > profiler.iteration_max_nsec)
+		profiler.iteration_max_nsec = nsec;
+	if (nsec <= budget)
+		return;
+
+	profiler.overruns++;
+	slow_push("iteration", nsec, end);
+	wlr_log(WLR_INFO, "event loop iteration took %" PRId64 " us, over "
+		"the %" PRId64 " us refresh interval, slowest was %s at %"
+		PRId64 " us", nsec / 1000, budget / 1000,
+		profiler.iteration_slowest ?
+		profiler.iteration_slowest->name : "?",
+		profiler.iteration_slowest_nsec / 1000);
+}
+
+/* "src/latency.c", "surface_commit" -> "latency.surface_commit" */
+static void site_name(struct profile_site *site, const char *file,
+		      const char *func)
+{
+	const char *base = strrchr(file, '/');
+	const char *ext;
+
+	base = base ? base + 1 : file;
+	ext = strrchr(base, '.');
+	snprintf(site->name, sizeof(site->name), "%.*s.%s",
+		 ext ? (int)(ext - base) : (int)strlen(base), base, func);
+}
+
+struct profile_scope profile_start(struct profile_site *site,
+				   const char *file, const char *func)
+{
+	struct profile_scope scope;
+
+	if (!site->name[0]) {
+		site_name(site, file, func);
+		site->next = profiler.sites;
+		profiler.sites = site;
+	}
+
+	scope.site = site;
+	scope.start_nsec = now_nsec();
+	if (profiler.depth++ == 0 && !profiler.iteration_idle) {
+		profiler.iteration_idle = wl_event_loop_add_idle(
+			profiler.loop, iteration_end, NULL);
+		profiler.iteration_start_nsec = scope.start_nsec;
+		profiler.iteration_slowest = NULL;
+		profiler.iteration_slowest_nsec = 0;
+	}
+	return scope;
+}
+
+void profile_stop(struct profile_scope *scope)
+{
+	struct profile_site *site = scope->site;
+	int64_t end = now_nsec();
+	int64_t nsec = end - scope->start_nsec;
+
+	site->calls++;
+	site->total_nsec += nsec;
+	if (nsec > site->max_nsec)
+		site->max_nsec = nsec;
+	site->buckets[bucket_for(nsec)]++;
+
+	if (--profiler.depth > 0)
+		return;
+	if (nsec > profiler.iteration_slowest_nsec) {
+		profiler.iteration_slowest = site;
+		profiler.iteration_slowest_nsec = nsec;
+	}
+	if (nsec >= PROFILE_SLOW_NSEC)
+		slow_push(site->name, nsec, end);
+}
+
+void profile_init(struct wlrston_server *server)
+{
+	profiler.server = server;
+	profiler.loop = wl_display_get_event_loop(server->wl_display);
+	profile_enabled = true;
+}
+
+void profile_finish(void)
+{
+	profile_enabled = false;
+	if (profiler.iteration_idle)
+		wl_event_source_remove(profiler.iteration_idle);
+	profiler.iteration_idle = NULL;
+}
+
+void profile_dump(FILE *f)
+{
+	int64_t now = now_nsec();
+	struct profile_site *site;
+	int i, n;
+
+	if (!profiler.server)
+		return;
+
+	fprintf(f, "profile.iterations %" PRIu64 "\n", profiler.iterations);
+	fprintf(f, "profile.iterations_over_refresh %" PRIu64 "\n",
+		profiler.overruns);
+	fprintf(f, "profile.iteration_max_us %" PRId64 "\n",
+		profiler.iteration_max_nsec / 1000);
+
+	for (site = profiler.sites; site; site = site->next) {
+		fprintf(f, "profile.%s.calls %" PRIu64 "\n", site->name,
+			site->calls);
+		if (site->calls == 0)
+			continue;
+		fprintf(f, "profile.%s.avg_us %" PRId64 "\n", site->name,
+			site->total_nsec / (int64_t)site->calls / 1000);
+		fprintf(f, "profile.%s.max_us %" PRId64 "\n", site->name,
+			site->max_nsec / 1000);
+		for (i = 0; i < PROFILE_BUCKETS - 1; i++) {
+			if (site->buckets[i])
+				fprintf(f, "profile.%s.lt_%dus %" PRIu64 "\n",
+					site->name, 1 << i, site->buckets[i]);
+		}
+		if (site->buckets[i])
+			fprintf(f, "profile.%s.ge_%dus %" PRIu64 "\n",
+				site->name, 1 << (i - 1), site->buckets[i]);
+	}
+
+	/* newest first: slow_N <name> <duration us> <age ms> */
+	for (i = 0, n = 0; i < PROFILE_SLOW_RING; i++) {
+		int slot = (profiler.slow_next - 1 - i + PROFILE_SLOW_RING) %
+			PROFILE_SLOW_RING;
+		struct profile_slow *slow = &profiler.slow[slot];
+
+		if (!slow->name)
+			break;
+		fprintf(f, "profile.slow_%d %s %" PRId64 " %" PRId64 "\n", n++,
+			slow->name, slow->nsec / 1000,
+			(now - slow->end_nsec) / 1000000);
+	}
+}
@@ -0,0 +1,752 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+#include <pixman.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/pixman.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_damage_ring.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#include <render.h>
+#include <profile.h>
+
+/* Buffers per output: one on screen, one queued, one being drawn. */
+#define RENDER_SLOTS 3
+
+struct render_item {
+	bool solid; /* a rect, filled with color */
+	pixman_color_t color;
+
+	uint32_t *bits;
+	pixman_format_code_t format;
+	int width, height, stride;
+	struct wlr_fbox src; /* part of the source to draw */
+	struct wlr_box dst; /* output buffer coordinates */
+
+	struct wlr_buffer *locked; /* keeps bits alive */
+	bool data_ptr; /* locked is in data pointer access */
+	bool owned; /* bits is a private copy */
+};
+
+struct render_slot {
+	struct render_worker *worker;
+	struct wlr_buffer *buffer;
+	bool acquired; /* until the output releases it */
+	struct wl_listener release;
+};
+
+struct render_worker {
+	struct wlr_output *output;
+	struct wlr_scene *scene;
+	struct wlr_allocator *allocator;
+	struct wlr_drm_format *format;
+	render_done_func_t done;
+	void *data;
+
+	struct render_slot slots[RENDER_SLOTS];
+	int slot_width, slot_height;
+
+	/* The frame in flight, only touched by the worker while busy. */
+	bool busy;
+	bool frame_missed; /* a frame event came in while busy */
+	bool snapshot_failed;
+	struct render_item *items;
+	size_t n_items, cap_items;
+	struct render_slot *target;
+	uint32_t *target_bits;
+	pixman_format_code_t target_format;
+	int target_stride;
+	int64_t submit_nsec;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool queued, finished, quit; /* protected by lock */
+	int event_fd;
+	struct wl_event_source *event_source;
+};
+
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool pixman_format_from_drm(uint32_t drm_format,
+				   pixman_format_code_t *format)
+{
+	switch (drm_format) {
+	case DRM_FORMAT_ARGB8888:
+		*format = PIXMAN_a8r8g8b8;
+		return true;
+	case DRM_FORMAT_XRGB8888:
+		*format = PIXMAN_x8r8g8b8;
+		return true;
+	case DRM_FORMAT_ABGR8888:
+		*format = PIXMAN_a8b8g8r8;
+		return true;
+	case DRM_FORMAT_XBGR8888:
+		*format = PIXMAN_x8b8g8r8;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void render_item(pixman_image_t *target, struct render_item *item)
+{
+	struct pixman_transform transform;
+	pixman_image_t *src;
+
+	if (item->solid) {
+		src = pixman_image_create_solid_fill(&item->color);
+		if (!src)
+			return;
+		pixman_image_composite32(PIXMAN_OP_OVER, src, NULL, target,
+					 0, 0, 0, 0, item->dst.x, item->dst.y,
+					 item->dst.width, item->dst.height);
+		pixman_image_unref(src);
+		return;
+	}
+
+	/* Images are not shared with the main thread, pixman caches in them. */
+	src = pixman_image_create_bits_no_clear(item->format, item->width,
+						item->height, item->bits,
+						item->stride);
+	if (!src)
+		return;
+
+	if (item->src.x != 0 || item->src.y != 0 ||
+	    item->src.width != item->dst.width ||
+	    item->src.height != item->dst.height) {
+		pixman_transform_init_scale(&transform,
+			pixman_double_to_fixed(item->src.width / item->dst.width),
+			pixman_double_to_fixed(item->src.height / item->dst.height));
+		pixman_transform_translate(&transform, NULL,
+					   pixman_double_to_fixed(item->src.x),
+					   pixman_double_to_fixed(item->src.y));
+		pixman_image_set_transform(src, &transform);
+		pixman_image_set_filter(src, PIXMAN_FILTER_BILINEAR, NULL, 0);
+	}
+
+	pixman_image_composite32(PIXMAN_OP_OVER, src, NULL, target, 0, 0, 0, 0,
+				 item->dst.x, item->dst.y,
+				 item->dst.width, item->dst.height);
+	pixman_image_unref(src);
+}
+
+static void render_frame(struct render_worker *worker)
+{
+	static const pixman_color_t black = { 0, 0, 0, 0xffff };
+	pixman_box32_t box = { 0, 0, worker->slot_width, worker->slot_height };
+	pixman_image_t *target;
+	size_t i;
+
+	target = pixman_image_create_bits_no_clear(worker->target_format,
+						   worker->slot_width,
+						   worker->slot_height,
+						   worker->target_bits,
+						   worker->target_stride);
+	if (!target)
+		return;
+
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, target, &black, 1, &box);
+	for (i = 0; i < worker->n_items; i++)
+		render_item(target, &worker->items[i]);
+
+	pixman_image_unref(target);
+}
+
+static void *render_thread(void *data)
+{
+	struct render_worker *worker = data;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&worker->lock);
+	for (;;) {
+		while (!worker->queued && !worker->quit)
+			pthread_cond_wait(&worker->cond, &worker->lock);
+		if (worker->quit)
+			break;
+		worker->queued = false;
+		pthread_mutex_unlock(&worker->lock);
+
+		render_frame(worker);
+
+		pthread_mutex_lock(&worker->lock);
+		worker->finished = true;
+		if (write(worker->event_fd, &one, sizeof(one)) < 0)
+			wlr_log_errno(WLR_ERROR, "failed to signal render completion");
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+static void slot_handle_release(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct render_slot *slot = wl_container_of(listener, slot, release);
+
+	slot->acquired = false;
+}
+
+static void slot_finish(struct render_slot *slot)
+{
+	if (!slot->buffer)
+		return;
+
+	/* The output may still show it, it goes away once released. */
+	wl_list_remove(&slot->release.link);
+	wlr_buffer_drop(slot->buffer);
+	slot->buffer = NULL;
+	slot->acquired = false;
+}
+
+static struct render_slot *worker_acquire_slot(struct render_worker *worker)
+{
+	struct wlr_output *output = worker->output;
+	struct render_slot *slot = NULL;
+	int i;
+
+	if (output->width != worker->slot_width ||
+	    output->height != worker->slot_height) {
+		for (i = 0; i < RENDER_SLOTS; i++)
+			slot_finish(&worker->slots[i]);
+		worker->slot_width = output->width;
+		worker->slot_height = output->height;
+	}
+
+	for (i = 0; i < RENDER_SLOTS; i++) {
+		if (!worker->slots[i].acquired) {
+			slot = &worker->slots[i];
+			break;
+		}
+	}
+	if (!slot)
+		return NULL;
+
+	if (!slot->buffer) {
+		slot->buffer = wlr_allocator_create_buffer(worker->allocator,
+							   worker->slot_width,
+							   worker->slot_height,
+							   worker->format);
+		if (!slot->buffer) {
+			wlr_log(WLR_ERROR, "failed to allocate render buffer");
+			return NULL;
+		}
+		slot->release.notify = slot_handle_release;
+		wl_signal_add(&slot->buffer->events.release, &slot->release);
+	}
+
+	slot->acquired = true;
+	wlr_buffer_lock(slot->buffer);
+	return slot;
+}
+
+static struct render_item *worker_add_item(struct render_worker *worker)
+{
+	struct render_item *items;
+	size_t cap;
+
+	if (worker->n_items == worker->cap_items) {
+		cap = worker->cap_items ? worker->cap_items * 2 : 16;
+		items = realloc(worker->items, cap * sizeof(*items));
+		if (!items)
+			return NULL;
+		worker->items = items;
+		worker->cap_items = cap;
+	}
+
+	items = &worker->items[worker->n_items++];
+	memset(items, 0, sizeof(*items));
+	return items;
+}
+
+static void item_set_dst(struct render_worker *worker, struct render_item *item,
+			 int x, int y, int width, int height)
+{
+	float scale = worker->output->scale;
+
+	item->dst.x = x * scale;
+	item->dst.y = y * scale;
+	item->dst.width = width * scale;
+	item->dst.height = height * scale;
+}
+
+static void snapshot_buffer(struct wlr_scene_buffer *scene_buffer,
+			    int sx, int sy, void *data)
+{
+	struct render_worker *worker = data;
+	struct wlr_client_buffer *client_buffer;
+	struct render_item *item;
+	pixman_image_t *image;
+	uint32_t drm_format;
+	size_t stride;
+	void *bits;
+	int width, height;
+
+	if (worker->snapshot_failed || !scene_buffer->buffer)
+		return;
+	if (scene_buffer->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		worker->snapshot_failed = true;
+		return;
+	}
+
+	item = worker_add_item(worker);
+	if (!item) {
+		worker->snapshot_failed = true;
+		return;
+	}
+
+	client_buffer = wlr_client_buffer_get(scene_buffer->buffer);
+	if (client_buffer && client_buffer->texture &&
+	    wlr_texture_is_pixman(client_buffer->texture)) {
+		image = wlr_pixman_texture_get_image(client_buffer->texture);
+		item->bits = pixman_image_get_data(image);
+		item->format = pixman_image_get_format(image);
+		item->width = pixman_image_get_width(image);
+		item->height = pixman_image_get_height(image);
+		item->stride = pixman_image_get_stride(image);
+	} else if (wlr_buffer_begin_data_ptr_access(scene_buffer->buffer,
+						    WLR_BUFFER_DATA_PTR_ACCESS_READ,
+						    &bits, &drm_format, &stride)) {
+		item->data_ptr = true;
+		item->bits = bits;
+		item->width = scene_buffer->buffer->width;
+		item->height = scene_buffer->buffer->height;
+		item->stride = stride;
+		if (!pixman_format_from_drm(drm_format, &item->format))
+			worker->snapshot_failed = true;
+	} else {
+		worker->n_items--;
+		worker->snapshot_failed = true;
+		return;
+	}
+	/* A locked client buffer is not updated in place by new commits. */
+	item->locked = wlr_buffer_lock(scene_buffer->buffer);
+
+	if (scene_buffer->src_box.width > 0 && scene_buffer->src_box.height > 0) {
+		item->src = scene_buffer->src_box;
+	} else {
+		item->src.width = item->width;
+		item->src.height = item->height;
+	}
+
+	if (scene_buffer->dst_width > 0 && scene_buffer->dst_height > 0) {
+		width = scene_buffer->dst_width;
+		height = scene_buffer->dst_height;
+	} else {
+		width = item->src.width;
+		height = item->src.height;
+	}
+	item_set_dst(worker, item, sx, sy, width, height);
+}
+
+/* Colors are premultiplied, like the pixman renderer takes them. */
+static void snapshot_rect(struct render_worker *worker,
+			  struct wlr_scene_rect *rect, int x, int y)
+{
+	struct render_item *item;
+
+	item = worker_add_item(worker);
+	if (!item) {
+		worker->snapshot_failed = true;
+		return;
+	}
+
+	item->solid = true;
+	item->color.red = rect->color[0] * 0xffff;
+	item->color.green = rect->color[1] * 0xffff;
+	item->color.blue = rect->color[2] * 0xffff;
+	item->color.alpha = rect->color[3] * 0xffff;
+	item_set_dst(worker, item, x, y, rect->width, rect->height);
+}
+
+static bool node_on_output(struct render_worker *worker, int x, int y,
+			   int width, int height)
+{
+	int output_width, output_height;
+
+	wlr_output_effective_resolution(worker->output, &output_width,
+					&output_height);
+	return width > 0 && height > 0 && x < output_width &&
+		y < output_height && x + width > 0 && y + height > 0;
+}
+
+/*
+ * Like wlr_scene_output_for_each_buffer(), but rects are snapshotted too,
+ * in their place in the stacking order. x and y are output coordinates.
+ */
+static void snapshot_node(struct render_worker *worker,
+			  struct wlr_scene_node *node, int x, int y)
+{
+	struct wlr_scene_buffer *scene_buffer;
+	struct wlr_scene_rect *rect;
+	struct wlr_scene_tree *tree;
+	struct wlr_scene_node *child;
+	int width, height;
+
+	if (!node->enabled || worker->snapshot_failed)
+		return;
+	x += node->x;
+	y += node->y;
+
+	switch (node->type) {
+	case WLR_SCENE_NODE_TREE:
+		tree = wl_container_of(node, tree, node);
+		wl_list_for_each(child, &tree->children, link)
+			snapshot_node(worker, child, x, y);
+		break;
+	case WLR_SCENE_NODE_RECT:
+		rect = wl_container_of(node, rect, node);
+		if (rect->color[3] > 0 &&
+		    node_on_output(worker, x, y, rect->width, rect->height))
+			snapshot_rect(worker, rect, x, y);
+		break;
+	case WLR_SCENE_NODE_BUFFER:
+		scene_buffer = wlr_scene_buffer_from_node(node);
+		if (!scene_buffer->buffer)
+			break;
+		if (scene_buffer->dst_width > 0 &&
+		    scene_buffer->dst_height > 0) {
+			width = scene_buffer->dst_width;
+			height = scene_buffer->dst_height;
+		} else if (scene_buffer->src_box.width > 0 &&
+			   scene_buffer->src_box.height > 0) {
+			width = scene_buffer->src_box.width;
+			height = scene_buffer->src_box.height;
+		} else {
+			width = scene_buffer->buffer->width;
+			height = scene_buffer->buffer->height;
+		}
+		if (node_on_output(worker, x, y, width, height))
+			snapshot_buffer(scene_buffer, x, y, worker);
+		break;
+	}
+}
+
+/* Software cursors are copied, their textures change under our feet. */
+static bool snapshot_cursors(struct render_worker *worker)
+{
+	struct wlr_output *output = worker->output;
+	struct wlr_output_cursor *cursor;
+	struct render_item *item;
+	pixman_image_t *image;
+	size_t size;
+
+	wl_list_for_each(cursor, &output->cursors, link) {
+		if (!cursor->enabled || !cursor->visible || !cursor->texture ||
+		    cursor == output->hardware_cursor)
+			continue;
+		if (!wlr_texture_is_pixman(cursor->texture))
+			return false;
+
+		item = worker_add_item(worker);
+		if (!item)
+			return false;
+
+		image = wlr_pixman_texture_get_image(cursor->texture);
+		item->format = pixman_image_get_format(image);
+		item->width = pixman_image_get_width(image);
+		item->height = pixman_image_get_height(image);
+		item->stride = pixman_image_get_stride(image);
+		size = (size_t)item->stride * item->height;
+		item->bits = malloc(size);
+		if (!item->bits) {
+			worker->n_items--;
+			return false;
+		}
+		memcpy(item->bits, pixman_image_get_data(image), size);
+		item->owned = true;
+
+		item->src.width = item->width;
+		item->src.height = item->height;
+		item->dst.x = cursor->x - cursor->hotspot_x;
+		item->dst.y = cursor->y - cursor->hotspot_y;
+		item->dst.width = cursor->width;
+		item->dst.height = cursor->height;
+	}
+
+	return true;
+}
+
+static void worker_release_items(struct render_worker *worker)
+{
+	struct render_item *item;
+	size_t i;
+
+	for (i = 0; i < worker->n_items; i++) {
+		item = &worker->items[i];
+		if (item->data_ptr)
+			wlr_buffer_end_data_ptr_access(item->locked);
+		if (item->locked)
+			wlr_buffer_unlock(item->locked);
+		if (item->owned)
+			free(item->bits);
+	}
+	worker->n_items = 0;
+}
+
+static void worker_release_target(struct render_worker *worker)
+{
+	wlr_buffer_end_data_ptr_access(worker->target->buffer);
+	wlr_buffer_unlock(worker->target->buffer);
+	worker->target = NULL;
+}
+
+static void worker_finish_frame(struct render_worker *worker, bool commit)
+{
+	struct wlr_output *output = worker->output;
+	struct wlr_buffer *buffer = worker->target->buffer;
+	bool committed = false;
+
+	worker->busy = false;
+	worker_release_items(worker);
+
+	/* the output may have been powered off while the worker drew */
+	if (commit && output->enabled) {
+		wlr_buffer_end_data_ptr_access(buffer);
+		wlr_output_attach_buffer(output, buffer);
+		committed = wlr_output_commit(output);
+		if (!committed)
+			wlr_log(WLR_ERROR, "failed to commit rendered frame on %s",
+				output->name);
+		/* the output holds its own lock until it shows another buffer */
+		wlr_buffer_unlock(buffer);
+		worker->target = NULL;
+	} else {
+		worker_release_target(worker);
+	}
+
+	if (committed && worker->done)
+		worker->done(worker->data, now_nsec() - worker->submit_nsec);
+
+	if (worker->frame_missed) {
+		worker->frame_missed = false;
+		wlr_output_schedule_frame(output);
+	}
+}
+
+static int handle_render_done(int fd, uint32_t mask, void *data)
+{
+	PROFILE_LISTENER();
+	struct render_worker *worker = data;
+	uint64_t count;
+	bool finished;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		wlr_log_errno(WLR_ERROR, "failed to read render completion");
+
+	pthread_mutex_lock(&worker->lock);
+	finished = worker->finished;
+	worker->finished = false;
+	pthread_mutex_unlock(&worker->lock);
+
+	if (finished && worker->busy)
+		worker_finish_frame(worker, true);
+
+	return 0;
+}
+
+/*
+ * wlr_scene_output_commit() does this for the frames it draws, surfaces
+ * get presentation feedback from the output they mostly show on.
+ */
+static void sample_buffer(struct wlr_scene_buffer *scene_buffer,
+			  int sx, int sy, void *data)
+{
+	struct wlr_scene_output *scene_output = data;
+	struct wlr_scene_surface *scene_surface;
+
+	if (scene_buffer->primary_output != scene_output)
+		return;
+	scene_surface = wlr_scene_surface_from_buffer(scene_buffer);
+	if (scene_surface)
+		wlr_presentation_surface_sampled_on_output(
+			scene_output->scene->presentation,
+			scene_surface->surface, scene_output->output);
+}
+
+bool render_worker_submit(struct render_worker *worker)
+{
+	struct wlr_output *output = worker->output;
+	struct wlr_scene_output *scene_output;
+	struct render_slot *slot;
+	uint32_t drm_format;
+	size_t stride;
+	void *bits;
+
+	if (worker->busy) {
+		worker->frame_missed = true;
+		return true;
+	}
+
+	scene_output = wlr_scene_get_scene_output(worker->scene, output);
+	if (!scene_output)
+		return true;
+	if (!output->needs_frame &&
+	    !pixman_region32_not_empty(&scene_output->damage_ring.current))
+		return true;
+
+	if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		goto fallback;
+
+	slot = worker_acquire_slot(worker);
+	if (!slot)
+		goto fallback;
+	if (!wlr_buffer_begin_data_ptr_access(slot->buffer,
+					      WLR_BUFFER_DATA_PTR_ACCESS_WRITE,
+					      &bits, &drm_format, &stride)) {
+		wlr_buffer_unlock(slot->buffer);
+		goto fallback;
+	}
+	worker->target = slot;
+	worker->target_bits = bits;
+	worker->target_stride = stride;
+
+	worker->snapshot_failed =
+		!pixman_format_from_drm(drm_format, &worker->target_format);
+	snapshot_node(worker, &worker->scene->tree.node, -scene_output->x,
+		      -scene_output->y);
+	if (worker->snapshot_failed || !snapshot_cursors(worker)) {
+		worker_release_items(worker);
+		worker_release_target(worker);
+		goto fallback;
+	}
+
+	/* Damage is not tracked, every frame is drawn in full. */
+	wlr_damage_ring_rotate(&scene_output->damage_ring);
+
+	if (worker->scene->presentation)
+		wlr_scene_output_for_each_buffer(scene_output, sample_buffer,
+						 scene_output);
+
+	worker->busy = true;
+	worker->submit_nsec = now_nsec();
+	pthread_mutex_lock(&worker->lock);
+	worker->queued = true;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	return true;
+
+fallback:
+	/*
+	 * The damage history of the output's own swapchain does not know
+	 * about frames drawn by the worker.
+	 */
+	wlr_damage_ring_add_whole(&scene_output->damage_ring);
+	return false;
+}
+
+struct render_worker *
+render_worker_create(struct wlr_output *output, struct wlr_scene *scene,
+		     struct wlr_allocator *allocator, struct wl_event_loop *loop,
+		     render_done_func_t done, void *data)
+{
+	struct render_worker *worker;
+	int i;
+
+	worker = calloc(1, sizeof(*worker));
+	if (!worker) {
+		wlr_log(WLR_ERROR, "failed to allocate render worker");
+		return NULL;
+	}
+	worker->output = output;
+	worker->scene = scene;
+	worker->allocator = allocator;
+	worker->done = done;
+	worker->data = data;
+	for (i = 0; i < RENDER_SLOTS; i++)
+		worker->slots[i].worker = worker;
+
+	worker->format = calloc(1, sizeof(*worker->format) + sizeof(uint64_t));
+	if (!worker->format)
+		goto failed_free_worker;
+	worker->format->format = DRM_FORMAT_XRGB8888;
+	worker->format->len = 1;
+	worker->format->capacity = 1;
+	worker->format->modifiers[0] = DRM_FORMAT_MOD_LINEAR;
+
+	worker->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (worker->event_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "failed to create render eventfd");
+		goto failed_free_format;
+	}
+	worker->event_source = wl_event_loop_add_fd(loop, worker->event_fd,
+						    WL_EVENT_READABLE,
+						    handle_render_done, worker);
+	if (!worker->event_source)
+		goto failed_close_fd;
+
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_cond_init(&worker->cond, NULL);
+	if (pthread_create(&worker->thread, NULL, render_thread, worker) != 0) {
+		wlr_log(WLR_ERROR, "failed to start render thread for %s",
+			output->name);
+		goto failed_remove_source;
+	}
+
+	return worker;
+
+failed_remove_source:
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->lock);
+	wl_event_source_remove(worker->event_source);
+failed_close_fd:
+	close(worker->event_fd);
+failed_free_format:
+	free(worker->format);
+failed_free_worker:
+	free(worker);
+	return NULL;
+}
+
+void render_worker_destroy(struct render_worker *worker)
+{
+	int i;
+
+	if (!worker)
+		return;
+
+	pthread_mutex_lock(&worker->lock);
+	worker->quit = true;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+	pthread_join(worker->thread, NULL);
+
+	if (worker->busy) {
+		worker->frame_missed = false;
+		worker_finish_frame(worker, false);
+	}
+
+	for (i = 0; i < RENDER_SLOTS; i++)
+		slot_finish(&worker->slots[i]);
+
+	wl_event_source_remove(worker->event_source);
+	close(worker->event_fd);
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->lock);
+	free(worker->items);
+	free(worker->format);
+	free(worker);
+}
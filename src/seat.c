@@ -11,24 +11,33 @@
 #include <wlr/types/wlr_keyboard_group.h>
 
 #include <wlrston.h>
+#include <profile.h>
 
 static void
 input_device_destroy(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_input *input = wl_container_of(listener, input, destroy);
+	struct wlrston_server *server = input->seat->server;
+
+	if (input->seat->motion.device == input->device) {
+		cursor_flush_motion(input->seat);
+	}
+
 	wl_list_remove(&input->link);
 	wl_list_remove(&input->destroy.link);
 
 	/* `struct keyboard` is derived and has some extra clean up to do */
 	if (input->device->type == WLR_INPUT_DEVICE_KEYBOARD) {
 		struct wlrston_keyboard *keyboard = (struct wlrston_keyboard *)input;
-		wl_list_remove(&keyboard->key.link);
-		wl_list_remove(&keyboard->modifiers.link);
+		keyboard_remove(keyboard);
+		pool_free(&server->pools.keyboards, keyboard);
+	} else {
+		pool_free(&server->pools.inputs, input);
 	}
-	free(input);
 }
 
-static void
+void
 seat_update_capabilities(struct wlrston_seat *seat)
 {
 	struct wlrston_input *input = NULL;
@@ -68,18 +77,16 @@ new_keyboard(struct wlrston_seat *seat, struct wlr_input_device *device)
 
 	wlr_keyboard = wlr_keyboard_from_input_device(device);
 
-	keyboard = calloc(1, sizeof(struct wlrston_keyboard));
+	keyboard = pool_zalloc(&seat->server->pools.keyboards);
+	if (!keyboard)
+		return NULL;
 	keyboard->base.device = device;
 	keyboard->wlr_keyboard = wlr_keyboard;
 
-	wlr_keyboard_set_keymap(wlr_keyboard, seat->keyboard_group->keyboard.keymap);
+	if (seat->keymap.keymap)
+		keymap_cache_apply(&seat->keymap, wlr_keyboard);
 
-	keyboard->modifiers.notify = keyboard_modifiers_notify;
-	wl_signal_add(&wlr_keyboard->events.modifiers, &keyboard->modifiers);
-	keyboard->key.notify = keyboard_key_notify;
-	wl_signal_add(&wlr_keyboard->events.key, &keyboard->key);
-
-	wlr_seat_set_keyboard(seat->seat, keyboard->wlr_keyboard);
+	keyboard_add(seat, keyboard);
 
 	return (struct wlrston_input *)keyboard;
 }
@@ -87,9 +94,10 @@ new_keyboard(struct wlrston_seat *seat, struct wlr_input_device *device)
 static struct wlrston_input *
 new_pointer(struct wlrston_seat *seat, struct wlr_input_device *device)
 {
-	struct wlrston_input *input =
-		calloc(1, sizeof(struct wlrston_input));
+	struct wlrston_input *input = pool_zalloc(&seat->server->pools.inputs);
 
+	if (!input)
+		return NULL;
 	input->device = device;
 
 	wlr_cursor_attach_input_device(seat->cursor, device);
@@ -99,6 +107,7 @@ new_pointer(struct wlrston_seat *seat, struct wlr_input_device *device)
 
 static void new_input_notify(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_seat *seat = wl_container_of(listener, seat, new_input);
 	struct wlr_input_device *device = data;
 	struct wlrston_input *input = NULL;
@@ -114,6 +123,11 @@ static void new_input_notify(struct wl_listener *listener, void *data)
 		wlr_log(WLR_INFO, "unsupported input device");
 		return;
 	}
+	if (!input) {
+		wlr_log(WLR_ERROR, "failed to allocate input device %s",
+			device->name);
+		return;
+	}
 	seat_add_device(seat, input);
 }
 
@@ -13,9 +13,12 @@
 #include <wlr/types/wlr_subcompositor.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_xdg_shell.h>
 
 #include <wlrston.h>
+#include <view.h>
+#include <transaction.h>
 
 struct wlrston_server *server_create(struct wl_display *display)
 {
@@ -27,6 +30,14 @@ struct wlrston_server *server_create(struct wl_display *display)
 
 	server->wl_display = display;
 
+	pool_init(&server->pools.views, "views", sizeof(struct wlrston_view));
+	pool_init(&server->pools.popups, "popups", sizeof(struct wlrston_popup));
+	pool_init(&server->pools.outputs, "outputs",
+		  sizeof(struct wlrston_output));
+	pool_init(&server->pools.inputs, "inputs", sizeof(struct wlrston_input));
+	pool_init(&server->pools.keyboards, "keyboards",
+		  sizeof(struct wlrston_keyboard));
+
 	server->backend = wlr_backend_autocreate(server->wl_display);
 	if (!server->backend) {
 		wlr_log(WLR_ERROR, "failed to create backend\n");
@@ -53,7 +64,26 @@ struct wlrston_server *server_create(struct wl_display *display)
 		goto failed_destroy_allocator;
 	}
 
-	if (!wlr_compositor_create(server->wl_display, server->renderer)) {
+	/*
+	 * Fullscreen views are stacked above the others, override-redirect
+	 * X11 windows such as menus above everything.
+	 */
+	server->view_tree = wlr_scene_tree_create(&server->scene->tree);
+	server->fullscreen_tree = wlr_scene_tree_create(&server->scene->tree);
+	server->unmanaged_tree = wlr_scene_tree_create(&server->scene->tree);
+	if (!server->view_tree || !server->fullscreen_tree ||
+	    !server->unmanaged_tree) {
+		wlr_log(WLR_ERROR, "failed to create scene layers\n");
+		goto failed_destroy_scene;
+	}
+	if (!switcher_init(&server->switcher, server)) {
+		wlr_log(WLR_ERROR, "failed to create the window switcher\n");
+		goto failed_destroy_scene;
+	}
+
+	server->compositor = wlr_compositor_create(server->wl_display,
+						   server->renderer);
+	if (!server->compositor) {
 		wlr_log(WLR_ERROR, "failed to create the wlroots compositor\n");
 		goto failed_destroy_scene;
 	}
@@ -79,12 +109,42 @@ struct wlrston_server *server_create(struct wl_display *display)
 		goto failed_destroy_output_layout;
 	}
 
+	/* The scene sends feedback for every frame it commits. */
+	server->presentation = wlr_presentation_create(server->wl_display,
+						       server->backend);
+	if (!server->presentation) {
+		wlr_log(WLR_ERROR, "unable to create presentation interface");
+		goto failed_destroy_output_layout;
+	}
+	wlr_scene_set_presentation(server->scene, server->presentation);
+
 	server->xdg_shell = wlr_xdg_shell_create(server->wl_display, 3);
 	server->new_xdg_surface.notify = xdg_surface_new;
 	wl_signal_add(&server->xdg_shell->events.new_surface,
 		      &server->new_xdg_surface);
 
+	if (!bindings_init(&server->bindings) ||
+	    !bindings_add_defaults(&server->bindings)) {
+		wlr_log(WLR_ERROR, "unable to create key bindings");
+		bindings_finish(&server->bindings);
+		goto failed_destroy_output_layout;
+	}
+
+	if (!idle_tracker_init(&server->idle, server)) {
+		wlr_log(WLR_ERROR, "unable to create idle protocols");
+		bindings_finish(&server->bindings);
+		goto failed_destroy_output_layout;
+	}
+
+	if (!client_tracker_init(&server->clients, server)) {
+		wlr_log(WLR_ERROR, "unable to create client tracker");
+		idle_tracker_finish(&server->idle);
+		bindings_finish(&server->bindings);
+		goto failed_destroy_output_layout;
+	}
+
 	seat_init(server);
+	latency_tracker_init(&server->latency, server->compositor);
 
 	server->new_output.notify = output_new;
 	wl_signal_add(&server->backend->events.new_output,
@@ -92,12 +152,14 @@ struct wlrston_server *server_create(struct wl_display *display)
 
 	wl_list_init(&server->output_list);
 	wl_list_init(&server->view_list);
+	spatial_index_init(&server->view_index);
 
 	return server;
 
 failed_destroy_output_layout:
 	wlr_output_layout_destroy(server->output_layout);
 failed_destroy_scene:
+	free(server->switcher.format);
 	wlr_scene_node_destroy(&server->scene->tree.node);
 failed_destroy_allocator:
 	wlr_allocator_destroy(server->allocator);
@@ -112,13 +174,27 @@ failed:
 
 void server_destory(struct wlrston_server *server)
 {
+	transaction_finish(server);
+	switcher_finish(&server->switcher);
+	idle_tracker_finish(&server->idle);
 	seat_finish(server);
+	latency_tracker_finish(&server->latency);
+	client_tracker_finish(&server->clients);
+	bindings_finish(&server->bindings);
+	spatial_index_finish(&server->view_index);
 	wlr_output_layout_destroy(server->output_layout);
 	wlr_scene_node_destroy(&server->scene->tree.node);
 	wlr_allocator_destroy(server->allocator);
 	wlr_renderer_destroy(server->renderer);
 	wlr_backend_destroy(server->backend);
 
+	/* after the backend, which destroys the outputs and inputs */
+	pool_finish(&server->pools.views);
+	pool_finish(&server->pools.popups);
+	pool_finish(&server->pools.outputs);
+	pool_finish(&server->pools.inputs);
+	pool_finish(&server->pools.keyboards);
+
 	free(server);
 }
 
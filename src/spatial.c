@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <wlr/util/log.h>
+
+#include <spatial.h>
+
+#define CELL_SHIFT 8 /* 256x256 cells */
+#define MAX_CELLS_PER_ENTRY 1024
+#define MIN_TABLE_SIZE 64
+#define MAX_CANDIDATES 64
+
+struct spatial_cell {
+	int32_t cx, cy;
+	bool used;
+	size_t len, cap;
+	struct spatial_entry **entries;
+};
+
+struct cell_range {
+	int32_t x1, y1, x2, y2; /* inclusive */
+};
+
+static int32_t cell_coord(int v)
+{
+	/* floor division, also for negative layout coordinates */
+	return v >= 0 ? v >> CELL_SHIFT : -((-v + (1 << CELL_SHIFT) - 1) >> CELL_SHIFT);
+}
+
+static int32_t floor_coord(double v)
+{
+	int32_t i = (int32_t)v;
+
+	return i - (v < i);
+}
+
+static bool box_cell_range(const struct wlr_box *box, struct cell_range *range)
+{
+	if (box->width <= 0 || box->height <= 0)
+		return false;
+
+	range->x1 = cell_coord(box->x);
+	range->y1 = cell_coord(box->y);
+	range->x2 = cell_coord(box->x + box->width - 1);
+	range->y2 = cell_coord(box->y + box->height - 1);
+	return true;
+}
+
+static size_t cell_range_count(const struct cell_range *range)
+{
+	return (size_t)(range->x2 - range->x1 + 1) *
+		(size_t)(range->y2 - range->y1 + 1);
+}
+
+static size_t cell_hash(int32_t cx, int32_t cy)
+{
+	return ((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u);
+}
+
+static struct spatial_cell *
+cell_find(struct spatial_index *index, int32_t cx, int32_t cy)
+{
+	size_t mask = index->n_cells - 1;
+	size_t i;
+
+	if (index->n_cells == 0)
+		return NULL;
+
+	for (i = cell_hash(cx, cy) & mask; index->cells[i].used; i = (i + 1) & mask) {
+		if (index->cells[i].cx == cx && index->cells[i].cy == cy)
+			return &index->cells[i];
+	}
+	return NULL;
+}
+
+static struct spatial_cell *
+cell_slot(struct spatial_cell *cells, size_t n_cells, int32_t cx, int32_t cy)
+{
+	size_t mask = n_cells - 1;
+	size_t i;
+
+	for (i = cell_hash(cx, cy) & mask; cells[i].used; i = (i + 1) & mask) {
+		if (cells[i].cx == cx && cells[i].cy == cy)
+			break;
+	}
+	return &cells[i];
+}
+
+static bool index_grow(struct spatial_index *index)
+{
+	size_t n_cells = index->n_cells ? index->n_cells * 2 : MIN_TABLE_SIZE;
+	struct spatial_cell *cells, *slot;
+	size_t i, n_used = 0;
+
+	cells = calloc(n_cells, sizeof(*cells));
+	if (!cells) {
+		wlr_log(WLR_ERROR, "failed to grow spatial index");
+		return false;
+	}
+
+	/* Empty cells are dropped on rehash. */
+	for (i = 0; i < index->n_cells; i++) {
+		struct spatial_cell *cell = &index->cells[i];
+
+		if (!cell->used)
+			continue;
+		if (cell->len == 0) {
+			free(cell->entries);
+			continue;
+		}
+		slot = cell_slot(cells, n_cells, cell->cx, cell->cy);
+		*slot = *cell;
+		n_used++;
+	}
+
+	free(index->cells);
+	index->cells = cells;
+	index->n_cells = n_cells;
+	index->n_used = n_used;
+	return true;
+}
+
+static struct spatial_cell *
+cell_get(struct spatial_index *index, int32_t cx, int32_t cy)
+{
+	struct spatial_cell *cell;
+
+	cell = cell_find(index, cx, cy);
+	if (cell)
+		return cell;
+
+	if ((index->n_used + 1) * 4 > index->n_cells * 3 && !index_grow(index))
+		return NULL;
+
+	cell = cell_slot(index->cells, index->n_cells, cx, cy);
+	cell->used = true;
+	cell->cx = cx;
+	cell->cy = cy;
+	index->n_used++;
+	return cell;
+}
+
+static bool entries_append(struct spatial_entry ***entries, size_t *len,
+			   size_t *cap, struct spatial_entry *entry)
+{
+	if (*len == *cap) {
+		size_t new_cap = *cap ? *cap * 2 : 4;
+		struct spatial_entry **new_entries;
+
+		new_entries = realloc(*entries, new_cap * sizeof(**entries));
+		if (!new_entries)
+			return false;
+		*entries = new_entries;
+		*cap = new_cap;
+	}
+	(*entries)[(*len)++] = entry;
+	return true;
+}
+
+static void entries_remove(struct spatial_entry **entries, size_t *len,
+			   struct spatial_entry *entry)
+{
+	size_t i;
+
+	for (i = 0; i < *len; i++) {
+		if (entries[i] == entry) {
+			entries[i] = entries[--(*len)];
+			return;
+		}
+	}
+}
+
+static void index_link(struct spatial_index *index, struct spatial_entry *entry)
+{
+	struct spatial_cell *cell;
+	struct cell_range range;
+	int32_t cx, cy;
+
+	if (!box_cell_range(&entry->box, &range))
+		return;
+
+	if (cell_range_count(&range) > MAX_CELLS_PER_ENTRY) {
+		entry->oversized = entries_append(&index->oversized,
+						  &index->n_oversized,
+						  &index->cap_oversized, entry);
+		return;
+	}
+
+	for (cy = range.y1; cy <= range.y2; cy++) {
+		for (cx = range.x1; cx <= range.x2; cx++) {
+			cell = cell_get(index, cx, cy);
+			if (!cell || !entries_append(&cell->entries, &cell->len,
+						     &cell->cap, entry))
+				wlr_log(WLR_ERROR, "spatial index out of memory");
+		}
+	}
+}
+
+static void index_unlink(struct spatial_index *index, struct spatial_entry *entry)
+{
+	struct spatial_cell *cell;
+	struct cell_range range;
+	int32_t cx, cy;
+
+	if (entry->oversized) {
+		entries_remove(index->oversized, &index->n_oversized, entry);
+		entry->oversized = false;
+		return;
+	}
+
+	if (!box_cell_range(&entry->box, &range))
+		return;
+
+	for (cy = range.y1; cy <= range.y2; cy++) {
+		for (cx = range.x1; cx <= range.x2; cx++) {
+			cell = cell_find(index, cx, cy);
+			if (cell)
+				entries_remove(cell->entries, &cell->len, entry);
+		}
+	}
+}
+
+void spatial_index_init(struct spatial_index *index)
+{
+	memset(index, 0, sizeof(*index));
+}
+
+void spatial_index_finish(struct spatial_index *index)
+{
+	size_t i;
+
+	for (i = 0; i < index->n_cells; i++)
+		free(index->cells[i].entries);
+	free(index->cells);
+	free(index->oversized);
+	memset(index, 0, sizeof(*index));
+}
+
+void spatial_index_insert(struct spatial_index *index,
+			  struct spatial_entry *entry,
+			  const struct wlr_box *box)
+{
+	if (entry->indexed)
+		spatial_index_remove(index, entry);
+
+	entry->box = *box;
+	entry->indexed = true;
+	index_link(index, entry);
+}
+
+void spatial_index_remove(struct spatial_index *index,
+			  struct spatial_entry *entry)
+{
+	if (!entry->indexed)
+		return;
+
+	index_unlink(index, entry);
+	entry->indexed = false;
+}
+
+void spatial_index_update(struct spatial_index *index,
+			  struct spatial_entry *entry,
+			  const struct wlr_box *box)
+{
+	struct cell_range old_range, new_range;
+	bool had_cells, has_cells;
+
+	if (!entry->indexed) {
+		entry->box = *box;
+		return;
+	}
+
+	/* Moves within the same cells, the common case, only touch the box. */
+	had_cells = box_cell_range(&entry->box, &old_range);
+	has_cells = box_cell_range(box, &new_range);
+	if (!entry->oversized && had_cells == has_cells &&
+	    (!has_cells || memcmp(&old_range, &new_range, sizeof(old_range)) == 0)) {
+		entry->box = *box;
+		return;
+	}
+
+	index_unlink(index, entry);
+	entry->box = *box;
+	index_link(index, entry);
+}
+
+static bool entry_contains(struct spatial_entry *entry, double x, double y)
+{
+	const struct wlr_box *box = &entry->box;
+
+	return x >= box->x && x < box->x + box->width &&
+		y >= box->y && y < box->y + box->height;
+}
+
+/*
+ * Adds the entries containing (x, y) below z, keeping the topmost
+ * MAX_CANDIDATES of them.
+ */
+static size_t collect(struct spatial_entry **out, size_t n,
+		      struct spatial_entry **entries, size_t len,
+		      double x, double y, uint64_t below)
+{
+	size_t i, j;
+
+	for (i = 0; i < len; i++) {
+		struct spatial_entry *entry = entries[i];
+
+		if (entry->z >= below || !entry_contains(entry, x, y))
+			continue;
+		if (n == MAX_CANDIDATES) {
+			if (entry->z < out[n - 1]->z)
+				continue;
+			n--;
+		}
+
+		/* keep candidates sorted top to bottom */
+		for (j = n; j > 0 && out[j - 1]->z < entry->z; j--)
+			out[j] = out[j - 1];
+		out[j] = entry;
+		n++;
+	}
+	return n;
+}
+
+struct spatial_entry *
+spatial_index_at(struct spatial_index *index, double x, double y,
+		 spatial_accept_func_t accept, void *data)
+{
+	struct spatial_entry *candidates[MAX_CANDIDATES];
+	uint64_t below = UINT64_MAX;
+	struct spatial_cell *cell;
+	size_t i, n;
+
+	/* also rejects NaN */
+	if (!(x > INT32_MIN && x < INT32_MAX && y > INT32_MIN && y < INT32_MAX))
+		return NULL;
+
+	cell = cell_find(index, cell_coord(floor_coord(x)),
+			 cell_coord(floor_coord(y)));
+	for (;;) {
+		n = 0;
+		if (cell)
+			n = collect(candidates, n, cell->entries, cell->len,
+				    x, y, below);
+		n = collect(candidates, n, index->oversized,
+			    index->n_oversized, x, y, below);
+
+		for (i = 0; i < n; i++) {
+			if (!accept || accept(candidates[i], x, y, data))
+				return candidates[i];
+		}
+		if (n < MAX_CANDIDATES)
+			return NULL;
+		/* all rejected, go on with the entries further down */
+		below = candidates[n - 1]->z;
+	}
+}
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <wlr/types/wlr_output.h>
+
+#include <wlrston.h>
+#include <view.h>
+#include <logger.h>
+#include <profile.h>
+
+static void stats_dump_latency(struct wlrston_output *output, FILE *f)
+{
+	const struct latency_histogram *histogram = &output->latency.histogram;
+	const char *name = output->wlr_output->name;
+	int i;
+
+	fprintf(f, "input_latency.%s.count %" PRIu64 "\n", name,
+		histogram->count);
+	if (histogram->count == 0)
+		return;
+
+	fprintf(f, "input_latency.%s.avg_us %" PRId64 "\n", name,
+		histogram->sum_nsec / (int64_t)histogram->count / 1000);
+	fprintf(f, "input_latency.%s.p50_us %" PRId64 "\n", name,
+		latency_histogram_percentile(histogram, 50) / 1000);
+	fprintf(f, "input_latency.%s.p90_us %" PRId64 "\n", name,
+		latency_histogram_percentile(histogram, 90) / 1000);
+	fprintf(f, "input_latency.%s.p99_us %" PRId64 "\n", name,
+		latency_histogram_percentile(histogram, 99) / 1000);
+	fprintf(f, "input_latency.%s.max_us %" PRId64 "\n", name,
+		histogram->max_nsec / 1000);
+
+	/* bucket_N counts latencies in [N-1, N) ms, the last one is open */
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (histogram->buckets[i])
+			fprintf(f, "input_latency.%s.bucket_%d %" PRIu64 "\n",
+				name, i + 1, histogram->buckets[i]);
+	}
+}
+
+static void stats_dump_pool(const struct pool *pool, FILE *f)
+{
+	fprintf(f, "pool.%s.live %zu\n", pool->name, pool->live);
+	fprintf(f, "pool.%s.peak %zu\n", pool->name, pool->peak);
+	fprintf(f, "pool.%s.slabs %zu\n", pool->name, pool->n_slabs);
+}
+
+static void stats_dump_client(struct client_account *account, FILE *f)
+{
+	uint64_t commits_per_sec, damage_px_per_sec;
+	int pid = account->pid;
+
+	client_account_rates(account, &commits_per_sec, &damage_px_per_sec);
+	fprintf(f, "client.%d.name %s\n", pid,
+		account->name[0] ? account->name : "?");
+	fprintf(f, "client.%d.surfaces %d\n", pid, account->n_surfaces);
+	fprintf(f, "client.%d.popups %d\n", pid, account->n_popups);
+	fprintf(f, "client.%d.commits %" PRIu64 "\n", pid, account->commits);
+	fprintf(f, "client.%d.commits_per_sec %" PRIu64 "\n", pid,
+		commits_per_sec);
+	fprintf(f, "client.%d.damage_px_per_sec %" PRIu64 "\n", pid,
+		damage_px_per_sec);
+	fprintf(f, "client.%d.commits_deferred %" PRIu64 "\n", pid,
+		account->commits_deferred);
+	fprintf(f, "client.%d.shm_bytes %" PRIu64 "\n", pid,
+		account->shm_bytes);
+	fprintf(f, "client.%d.texture_bytes %" PRIu64 "\n", pid,
+		account->texture_bytes);
+}
+
+/*
+ * Runtime counters are written as "section.name value" lines, one per
+ * line, so that they can be read with standard tools.
+ */
+static void stats_dump(struct wlrston_server *server, FILE *f)
+{
+	struct wlrston_seat *seat = &server->seat;
+	struct client_account *account;
+	struct wlrston_output *output;
+	struct wlrston_view *view;
+	int occluded = 0;
+
+	wl_list_for_each(view, &server->view_list, link)
+		occluded += view->occluded;
+
+	fprintf(f, "pointer.motion_events %" PRIu64 "\n",
+		seat->stats.motion_events);
+	fprintf(f, "pointer.motion_updates %" PRIu64 "\n",
+		seat->stats.motion_updates);
+	fprintf(f, "pointer.motion_coalesced %" PRIu64 "\n",
+		seat->stats.motion_events - seat->stats.motion_updates);
+
+	fprintf(f, "frame.callbacks_sent %" PRIu64 "\n",
+		server->stats.frames_sent);
+	fprintf(f, "frame.callbacks_throttled %" PRIu64 "\n",
+		server->stats.frames_throttled);
+	fprintf(f, "views.occluded %d\n", occluded);
+	fprintf(f, "transactions.applied %" PRIu64 "\n",
+		server->stats.transactions);
+	fprintf(f, "transactions.timed_out %" PRIu64 "\n",
+		server->stats.transactions_timed_out);
+	fprintf(f, "log.level %s\n",
+		logger_level_name(wlr_log_get_verbosity()));
+	fprintf(f, "log.dropped %" PRIu64 "\n", logger_dropped());
+	fprintf(f, "switcher.thumbnails_rendered %" PRIu64 "\n",
+		server->stats.thumbnails_rendered);
+
+	stats_dump_pool(&server->pools.views, f);
+	stats_dump_pool(&server->pools.popups, f);
+	stats_dump_pool(&server->pools.outputs, f);
+	stats_dump_pool(&server->pools.inputs, f);
+	stats_dump_pool(&server->pools.keyboards, f);
+	if (server->pools.x11_windows.name)
+		stats_dump_pool(&server->pools.x11_windows, f);
+
+	wl_list_for_each(output, &server->output_list, link)
+		stats_dump_latency(output, f);
+
+	wl_list_for_each(account, &server->clients.accounts, link)
+		stats_dump_client(account, f);
+
+	profile_dump(f);
+}
+
+void stats_write(struct wlrston_server *server)
+{
+	char tmp_path[4096];
+	FILE *f;
+
+	if (!server->stats_path) {
+		stats_dump(server, stderr);
+		return;
+	}
+
+	/* Readers never see a partially written file. */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", server->stats_path);
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		wlr_log_errno(WLR_ERROR, "failed to open %s", tmp_path);
+		return;
+	}
+
+	stats_dump(server, f);
+
+	if (fclose(f) != 0 || rename(tmp_path, server->stats_path) != 0) {
+		wlr_log_errno(WLR_ERROR, "failed to write %s", server->stats_path);
+		remove(tmp_path);
+	}
+}
@@ -0,0 +1,490 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_scene.h>
+
+#include <wlrston.h>
+#include <view.h>
+#include <switcher.h>
+
+/* Snapshot again once this share of the view was damaged, 1/N. */
+#define THUMBNAIL_DAMAGE_FRACTION 8
+/* Time spent on snapshots per frame, at least one is taken. */
+#define SWITCHER_REFRESH_BUDGET_NSEC 1000000
+#define SWITCHER_PADDING 8
+#define SWITCHER_MARGIN 32
+
+static const float backdrop_color[4] = { 0.08f, 0.08f, 0.08f, 0.85f };
+static const float highlight_color[4] = { 0.25f, 0.45f, 0.75f, 1.0f };
+static const float placeholder_color[4] = { 0.3f, 0.3f, 0.3f, 1.0f };
+
+struct snapshot_data {
+	struct wlr_renderer *renderer;
+	float identity[9];
+	int x, y; /* window geometry origin, layout coords */
+	double scale;
+};
+
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void snapshot_buffer(struct wlr_scene_buffer *buffer, int sx, int sy,
+			    void *data)
+{
+	struct snapshot_data *snapshot = data;
+	struct wlr_client_buffer *client_buffer;
+	struct wlr_texture *texture = NULL;
+	bool owned = false;
+	struct wlr_box box;
+	float matrix[9];
+	int width, height;
+
+	if (!buffer->buffer)
+		return;
+	client_buffer = wlr_client_buffer_get(buffer->buffer);
+	if (client_buffer)
+		texture = client_buffer->texture;
+	if (!texture) {
+		texture = wlr_texture_from_buffer(snapshot->renderer,
+						  buffer->buffer);
+		owned = true;
+	}
+	if (!texture)
+		return;
+
+	width = buffer->dst_width;
+	height = buffer->dst_height;
+	if (width <= 0 || height <= 0) {
+		width = buffer->buffer->width;
+		height = buffer->buffer->height;
+		if (buffer->transform & WL_OUTPUT_TRANSFORM_90) {
+			width = buffer->buffer->height;
+			height = buffer->buffer->width;
+		}
+	}
+
+	box.x = (sx - snapshot->x) * snapshot->scale;
+	box.y = (sy - snapshot->y) * snapshot->scale;
+	box.width = width * snapshot->scale + 0.5;
+	box.height = height * snapshot->scale + 0.5;
+	if (box.width < 1 || box.height < 1)
+		goto out;
+
+	wlr_matrix_project_box(matrix, &box,
+			       wlr_output_transform_invert(buffer->transform),
+			       0, snapshot->identity);
+	if (buffer->src_box.width > 0 && buffer->src_box.height > 0)
+		wlr_render_subtexture_with_matrix(snapshot->renderer, texture,
+						  &buffer->src_box, matrix, 1.0f);
+	else
+		wlr_render_texture_with_matrix(snapshot->renderer, texture,
+					       matrix, 1.0f);
+
+out:
+	if (owned)
+		wlr_texture_destroy(texture);
+}
+
+static struct switcher_entry *switcher_find(struct switcher *switcher,
+					    struct wlrston_view *view)
+{
+	int i;
+
+	for (i = 0; i < switcher->n_entries; i++) {
+		if (switcher->entries[i].view == view)
+			return &switcher->entries[i];
+	}
+	return NULL;
+}
+
+static void entry_show_thumbnail(struct switcher *switcher,
+				 struct switcher_entry *entry)
+{
+	struct wlr_buffer *buffer = entry->view->thumbnail.buffer;
+
+	if (!buffer)
+		return;
+	if (entry->thumbnail) {
+		wlr_scene_buffer_set_buffer_with_damage(entry->thumbnail,
+							buffer, NULL);
+	} else {
+		entry->thumbnail = wlr_scene_buffer_create(switcher->tree, buffer);
+		if (!entry->thumbnail)
+			return;
+	}
+	wlr_scene_node_set_position(&entry->thumbnail->node,
+				    entry->x + (THUMBNAIL_WIDTH - buffer->width) / 2,
+				    entry->y + (THUMBNAIL_HEIGHT - buffer->height) / 2);
+
+	if (entry->placeholder) {
+		wlr_scene_node_destroy(&entry->placeholder->node);
+		entry->placeholder = NULL;
+	}
+}
+
+static void thumbnail_queue(struct switcher *switcher, struct wlrston_view *view)
+{
+	struct view_thumbnail *thumbnail = &view->thumbnail;
+
+	if (thumbnail->queued)
+		return;
+	thumbnail->queued = true;
+	wl_list_insert(switcher->queue.prev, &thumbnail->link);
+}
+
+static void thumbnail_reset(struct wlrston_view *view)
+{
+	struct view_thumbnail *thumbnail = &view->thumbnail;
+
+	if (thumbnail->queued)
+		wl_list_remove(&thumbnail->link);
+	if (thumbnail->buffer)
+		wlr_buffer_drop(thumbnail->buffer);
+	if (thumbnail->back)
+		wlr_buffer_drop(thumbnail->back);
+	thumbnail->buffer = NULL;
+	thumbnail->back = NULL;
+	thumbnail->queued = false;
+	thumbnail->damage = 0;
+}
+
+/* Draws the window geometry of the view, popups included, scaled down. */
+static void thumbnail_render(struct switcher *switcher, struct wlrston_view *view)
+{
+	struct wlrston_server *server = switcher->server;
+	struct view_thumbnail *thumbnail = &view->thumbnail;
+	struct snapshot_data snapshot = { .renderer = server->renderer };
+	static const float clear[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	struct switcher_entry *entry;
+	struct wlr_buffer *buffer;
+	struct wlr_box geo_box;
+	int width, height;
+
+	view->impl->get_geometry(view, &geo_box);
+	if (geo_box.width <= 0 || geo_box.height <= 0)
+		return;
+
+	snapshot.scale = (double)THUMBNAIL_WIDTH / geo_box.width;
+	if ((double)THUMBNAIL_HEIGHT / geo_box.height < snapshot.scale)
+		snapshot.scale = (double)THUMBNAIL_HEIGHT / geo_box.height;
+	if (snapshot.scale > 1.0)
+		snapshot.scale = 1.0;
+	width = geo_box.width * snapshot.scale;
+	height = geo_box.height * snapshot.scale;
+	if (width < 1)
+		width = 1;
+	if (height < 1)
+		height = 1;
+
+	/* the front buffer may be on screen, draw into the other one */
+	if (thumbnail->back && (thumbnail->back->width != width ||
+				thumbnail->back->height != height)) {
+		wlr_buffer_drop(thumbnail->back);
+		thumbnail->back = NULL;
+	}
+	if (!thumbnail->back) {
+		thumbnail->back = wlr_allocator_create_buffer(server->allocator,
+							      width, height,
+							      switcher->format);
+		if (!thumbnail->back) {
+			wlr_log(WLR_ERROR, "failed to allocate a thumbnail");
+			return;
+		}
+	}
+
+	if (!wlr_renderer_begin_with_buffer(server->renderer, thumbnail->back))
+		return;
+	wlr_renderer_clear(server->renderer, clear);
+	wlr_matrix_identity(snapshot.identity);
+	snapshot.x = view->x;
+	snapshot.y = view->y;
+	wlr_scene_node_for_each_buffer(&view->scene_tree->node, snapshot_buffer,
+				       &snapshot);
+	wlr_renderer_end(server->renderer);
+
+	buffer = thumbnail->buffer;
+	thumbnail->buffer = thumbnail->back;
+	thumbnail->back = buffer;
+	thumbnail->src_width = geo_box.width;
+	thumbnail->src_height = geo_box.height;
+	thumbnail->damage = 0;
+	server->stats.thumbnails_rendered++;
+
+	entry = switcher_find(switcher, view);
+	if (entry)
+		entry_show_thumbnail(switcher, entry);
+}
+
+/* The output the pointer is on, or any. */
+static struct wlr_output *switcher_output(struct switcher *switcher)
+{
+	struct wlrston_server *server = switcher->server;
+	struct wlr_cursor *cursor = server->seat.cursor;
+	struct wlrston_output *output;
+	struct wlr_output *wlr_output;
+
+	wlr_output = wlr_output_layout_output_at(server->output_layout,
+						 cursor->x, cursor->y);
+	if (wlr_output || wl_list_empty(&server->output_list))
+		return wlr_output;
+	output = wl_container_of(server->output_list.next, output, link);
+	return output->wlr_output;
+}
+
+void switcher_refresh(struct switcher *switcher, struct wlr_output *output)
+{
+	struct view_thumbnail *thumbnail, *tmp;
+	struct wlrston_view *view;
+	int64_t deadline;
+
+	/* once per refresh cycle, not once per output */
+	if (wl_list_empty(&switcher->queue))
+		return;
+	if (output != (switcher->tree ? switcher->output :
+		       switcher_output(switcher)))
+		return;
+
+	deadline = now_nsec() + SWITCHER_REFRESH_BUDGET_NSEC;
+	wl_list_for_each_safe(thumbnail, tmp, &switcher->queue, link) {
+		view = wl_container_of(thumbnail, view, thumbnail);
+		/* disabled in the scene, nothing to draw from until it shows */
+		if (view->culled || view->saved_tree)
+			continue;
+
+		wl_list_remove(&thumbnail->link);
+		thumbnail->queued = false;
+		thumbnail_render(switcher, view);
+		if (now_nsec() >= deadline)
+			break;
+	}
+}
+
+static void switcher_select(struct switcher *switcher, int index)
+{
+	struct switcher_entry *entry = &switcher->entries[index];
+
+	switcher->selected = index;
+	if (switcher->highlight)
+		wlr_scene_node_set_position(&switcher->highlight->node,
+					    entry->x - SWITCHER_PADDING,
+					    entry->y - SWITCHER_PADDING);
+}
+
+/*
+ * Lays the views out in a grid centered on the output, as many as fit.
+ * Views without a thumbnail get a placeholder until theirs is taken.
+ */
+static bool switcher_open(struct switcher *switcher)
+{
+	struct wlrston_server *server = switcher->server;
+	int cell_width = THUMBNAIL_WIDTH + 2 * SWITCHER_PADDING;
+	int cell_height = THUMBNAIL_HEIGHT + 2 * SWITCHER_PADDING;
+	struct switcher_entry *entry;
+	struct wlr_scene_rect *backdrop;
+	struct wlr_output *wlr_output;
+	struct wlrston_view *view;
+	struct wlr_box box;
+	int n_views, columns, rows, n, x, y, i = 0;
+
+	n_views = wl_list_length(&server->view_list);
+	wlr_output = switcher_output(switcher);
+	if (n_views < 2 || !wlr_output)
+		return false;
+	switcher->output = wlr_output;
+	wlr_output_layout_get_box(server->output_layout, wlr_output, &box);
+
+	columns = (box.width - 2 * SWITCHER_MARGIN) / cell_width;
+	rows = (box.height - 2 * SWITCHER_MARGIN) / cell_height;
+	if (columns < 1)
+		columns = 1;
+	if (rows < 1)
+		rows = 1;
+	n = n_views < columns * rows ? n_views : columns * rows;
+	if (n < columns)
+		columns = n;
+	rows = (n + columns - 1) / columns;
+
+	switcher->entries = calloc(n, sizeof(*switcher->entries));
+	if (!switcher->entries)
+		return false;
+	switcher->tree = wlr_scene_tree_create(switcher->layer);
+	if (!switcher->tree) {
+		free(switcher->entries);
+		switcher->entries = NULL;
+		return false;
+	}
+
+	x = box.x + (box.width - columns * cell_width) / 2;
+	y = box.y + (box.height - rows * cell_height) / 2;
+	backdrop = wlr_scene_rect_create(switcher->tree, columns * cell_width,
+					 rows * cell_height, backdrop_color);
+	if (backdrop)
+		wlr_scene_node_set_position(&backdrop->node, x, y);
+	switcher->highlight = wlr_scene_rect_create(switcher->tree, cell_width,
+						    cell_height,
+						    highlight_color);
+
+	/* most recently focused first */
+	wl_list_for_each(view, &server->view_list, link) {
+		if (i == n)
+			break;
+		entry = &switcher->entries[i];
+		entry->view = view;
+		entry->x = x + (i % columns) * cell_width + SWITCHER_PADDING;
+		entry->y = y + (i / columns) * cell_height + SWITCHER_PADDING;
+		i++;
+
+		if (view->thumbnail.buffer) {
+			entry_show_thumbnail(switcher, entry);
+			continue;
+		}
+		entry->placeholder = wlr_scene_rect_create(switcher->tree,
+							   THUMBNAIL_WIDTH,
+							   THUMBNAIL_HEIGHT,
+							   placeholder_color);
+		if (entry->placeholder)
+			wlr_scene_node_set_position(&entry->placeholder->node,
+						    entry->x, entry->y);
+		thumbnail_queue(switcher, view);
+	}
+	switcher->n_entries = n;
+	switcher_select(switcher, 0);
+	return true;
+}
+
+void switcher_next(struct switcher *switcher)
+{
+	if (!switcher->tree && !switcher_open(switcher))
+		return;
+	switcher_select(switcher, (switcher->selected + 1) % switcher->n_entries);
+}
+
+void switcher_end(struct switcher *switcher, bool focus)
+{
+	struct wlrston_view *view;
+
+	if (!switcher->tree)
+		return;
+	view = switcher->entries[switcher->selected].view;
+
+	wlr_scene_node_destroy(&switcher->tree->node);
+	free(switcher->entries);
+	switcher->tree = NULL;
+	switcher->output = NULL;
+	switcher->highlight = NULL;
+	switcher->entries = NULL;
+	switcher->n_entries = 0;
+	switcher->selected = 0;
+
+	if (focus)
+		focus_view(view, view->impl->get_surface(view));
+}
+
+void switcher_view_map(struct wlrston_view *view)
+{
+	thumbnail_queue(&view->server->switcher, view);
+}
+
+void switcher_view_commit(struct wlrston_view *view)
+{
+	struct wlr_surface *surface = view->impl->get_surface(view);
+	struct view_thumbnail *thumbnail = &view->thumbnail;
+	pixman_box32_t *rects;
+	struct wlr_box geo_box;
+	uint64_t area;
+	int n_rects, i;
+
+	if (thumbnail->queued)
+		return;
+
+	view->impl->get_geometry(view, &geo_box);
+	if (geo_box.width != thumbnail->src_width ||
+	    geo_box.height != thumbnail->src_height) {
+		thumbnail_queue(&view->server->switcher, view);
+		return;
+	}
+
+	rects = pixman_region32_rectangles(&surface->buffer_damage, &n_rects);
+	for (i = 0; i < n_rects; i++)
+		thumbnail->damage += (uint64_t)(rects[i].x2 - rects[i].x1) *
+				     (rects[i].y2 - rects[i].y1);
+
+	area = (uint64_t)surface->current.buffer_width *
+	       surface->current.buffer_height;
+	if (thumbnail->damage * THUMBNAIL_DAMAGE_FRACTION >= area)
+		thumbnail_queue(&view->server->switcher, view);
+}
+
+/* Called once the view is off view_list. */
+void switcher_view_unmap(struct wlrston_view *view)
+{
+	struct switcher *switcher = &view->server->switcher;
+	struct wlrston_view *selected;
+	int i;
+
+	thumbnail_reset(view);
+	if (!switcher_find(switcher, view))
+		return;
+
+	/* laid out again without it, keeping the selection if it stays */
+	selected = switcher->entries[switcher->selected].view;
+	switcher_end(switcher, false);
+	if (!switcher_open(switcher))
+		return;
+	for (i = 0; i < switcher->n_entries; i++) {
+		if (switcher->entries[i].view == selected)
+			switcher_select(switcher, i);
+	}
+}
+
+bool switcher_init(struct switcher *switcher, struct wlrston_server *server)
+{
+	switcher->server = server;
+	wl_list_init(&switcher->queue);
+
+	/* created last, so it stacks above the view layers */
+	switcher->layer = wlr_scene_tree_create(&server->scene->tree);
+	if (!switcher->layer)
+		return false;
+
+	switcher->format = calloc(1, sizeof(*switcher->format) +
+				  sizeof(uint64_t));
+	if (!switcher->format)
+		return false;
+	switcher->format->format = DRM_FORMAT_ARGB8888;
+	switcher->format->len = 1;
+	switcher->format->capacity = 1;
+	switcher->format->modifiers[0] = DRM_FORMAT_MOD_INVALID;
+	return true;
+}
+
+void switcher_finish(struct switcher *switcher)
+{
+	struct wlrston_view *view;
+
+	switcher_end(switcher, false);
+	wl_list_for_each(view, &switcher->server->view_list, link)
+		thumbnail_reset(view);
+	free(switcher->format);
+	switcher->format = NULL;
+}
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <stdlib.h>
+
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#include <wlrston.h>
+#include <view.h>
+#include <transaction.h>
+#include <profile.h>
+
+/* How long a transaction waits for slow clients before applying anyway. */
+#define TRANSACTION_TIMEOUT_MSEC 200
+
+struct transaction_instruction {
+	struct transaction *transaction;
+	struct wlrston_view *view;
+	struct wlr_box box;
+	uint32_t serial; /* configure sent for box, 0 if none to wait for */
+	bool ready;
+	struct wl_list link; /* transaction::instructions */
+};
+
+struct transaction {
+	struct wlrston_server *server;
+	struct wl_list instructions;
+	int n_waiting; /* instructions not ready yet */
+	struct wl_event_source *timer;
+};
+
+static void view_configure_now(struct wlrston_view *view,
+			       const struct wlr_box *box)
+{
+	view->impl->set_fullscreen(view, view->fullscreen);
+	view->impl->configure(view, box->width, box->height);
+	view_set_position(view, box->x, box->y);
+	server_update_visibility(view->server);
+}
+
+static void instruction_destroy(struct transaction_instruction *instruction)
+{
+	if (instruction->view->instruction == instruction)
+		instruction->view->instruction = NULL;
+	wl_list_remove(&instruction->link);
+	free(instruction);
+}
+
+static void transaction_destroy(struct transaction *transaction)
+{
+	struct transaction_instruction *instruction, *tmp;
+
+	wl_list_for_each_safe(instruction, tmp, &transaction->instructions, link)
+		instruction_destroy(instruction);
+	if (transaction->timer)
+		wl_event_source_remove(transaction->timer);
+	free(transaction);
+}
+
+static void transaction_apply(struct transaction *transaction)
+{
+	struct wlrston_server *server = transaction->server;
+	struct transaction_instruction *instruction;
+	struct wlrston_view *view;
+
+	if (server->transaction_inflight == transaction)
+		server->transaction_inflight = NULL;
+
+	wl_list_for_each(instruction, &transaction->instructions, link) {
+		view = instruction->view;
+		view_drop_saved(view);
+		view_set_position(view, instruction->box.x, instruction->box.y);
+	}
+	server_update_visibility(server);
+	server->stats.transactions++;
+	transaction_destroy(transaction);
+}
+
+static int transaction_timeout(void *data)
+{
+	PROFILE_LISTENER();
+	struct transaction *transaction = data;
+
+	wlr_log(WLR_DEBUG, "transaction timed out, %d views not ready",
+		transaction->n_waiting);
+	transaction->server->stats.transactions_timed_out++;
+	transaction_apply(transaction);
+	return 0;
+}
+
+static void transaction_commit(struct transaction *transaction)
+{
+	struct wlrston_server *server = transaction->server;
+	struct transaction_instruction *instruction;
+	struct wl_event_loop *loop;
+	struct wlrston_view *view;
+
+	/* one in flight at a time, the older one shows up first */
+	if (server->transaction_inflight)
+		transaction_apply(server->transaction_inflight);
+
+	wl_list_for_each(instruction, &transaction->instructions, link) {
+		view = instruction->view;
+		/* state and size go out in one configure */
+		view->impl->set_fullscreen(view, view->fullscreen);
+		instruction->serial = view->impl->configure(view,
+							    instruction->box.width,
+							    instruction->box.height);
+		/* X11 windows just move along with the others */
+		if (instruction->serial == 0) {
+			instruction->ready = true;
+			continue;
+		}
+		transaction->n_waiting++;
+		if (!view->saved_tree)
+			view_save_buffers(view);
+	}
+
+	/* empty when all its views were unmapped before the commit */
+	if (transaction->n_waiting == 0) {
+		transaction_apply(transaction);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(server->wl_display);
+	transaction->timer = wl_event_loop_add_timer(loop, transaction_timeout,
+						     transaction);
+	if (!transaction->timer) {
+		transaction_apply(transaction);
+		return;
+	}
+	wl_event_source_timer_update(transaction->timer,
+				     TRANSACTION_TIMEOUT_MSEC);
+	server->transaction_inflight = transaction;
+}
+
+static void transaction_idle(void *data)
+{
+	struct wlrston_server *server = data;
+	struct transaction *transaction = server->transaction_open;
+
+	server->transaction_idle = NULL;
+	server->transaction_open = NULL;
+	if (transaction)
+		transaction_commit(transaction);
+}
+
+void transaction_add_view(struct wlrston_view *view, const struct wlr_box *box)
+{
+	struct wlrston_server *server = view->server;
+	struct transaction *transaction = server->transaction_open;
+	struct transaction_instruction *instruction;
+	struct wl_event_loop *loop;
+
+	if (view->instruction && view->instruction->transaction == transaction) {
+		view->instruction->box = *box;
+		return;
+	}
+
+	if (!transaction) {
+		transaction = calloc(1, sizeof(*transaction));
+		if (!transaction) {
+			view_configure_now(view, box);
+			return;
+		}
+		transaction->server = server;
+		wl_list_init(&transaction->instructions);
+		server->transaction_open = transaction;
+	}
+
+	instruction = calloc(1, sizeof(*instruction));
+	if (!instruction) {
+		view_configure_now(view, box);
+		return;
+	}
+	instruction->transaction = transaction;
+	instruction->view = view;
+	instruction->box = *box;
+	wl_list_insert(transaction->instructions.prev, &instruction->link);
+	view->instruction = instruction;
+
+	if (!server->transaction_idle) {
+		loop = wl_display_get_event_loop(server->wl_display);
+		server->transaction_idle =
+			wl_event_loop_add_idle(loop, transaction_idle, server);
+		if (!server->transaction_idle)
+			transaction_idle(server);
+	}
+}
+
+void transaction_view_commit(struct wlrston_view *view)
+{
+	struct transaction *transaction = view->server->transaction_inflight;
+	struct transaction_instruction *instruction;
+	struct wlrston_output *output;
+
+	if (!transaction)
+		return;
+
+	wl_list_for_each(instruction, &transaction->instructions, link) {
+		if (instruction->view != view)
+			continue;
+		if (instruction->ready ||
+		    !view->impl->acked(view, instruction->serial))
+			return;
+		instruction->ready = true;
+		if (--transaction->n_waiting == 0) {
+			transaction_apply(transaction);
+			return;
+		}
+		break;
+	}
+
+	/* hidden, its commits do not schedule frames by themselves */
+	if (view->saved_tree && (output = view_get_output(view)))
+		wlr_output_schedule_frame(output->wlr_output);
+}
+
+static bool transaction_remove(struct transaction *transaction,
+			       struct wlrston_view *view)
+{
+	struct transaction_instruction *instruction;
+
+	wl_list_for_each(instruction, &transaction->instructions, link) {
+		if (instruction->view != view)
+			continue;
+		if (!instruction->ready)
+			transaction->n_waiting--;
+		instruction_destroy(instruction);
+		return true;
+	}
+	return false;
+}
+
+void transaction_remove_view(struct wlrston_view *view)
+{
+	struct wlrston_server *server = view->server;
+	struct transaction *transaction;
+
+	view_drop_saved(view);
+
+	if (server->transaction_open)
+		transaction_remove(server->transaction_open, view);
+
+	transaction = server->transaction_inflight;
+	if (transaction && transaction_remove(transaction, view) &&
+	    transaction->n_waiting == 0)
+		transaction_apply(transaction);
+}
+
+void transaction_finish(struct wlrston_server *server)
+{
+	if (server->transaction_idle)
+		wl_event_source_remove(server->transaction_idle);
+	if (server->transaction_open)
+		transaction_destroy(server->transaction_open);
+	if (server->transaction_inflight)
+		transaction_destroy(server->transaction_inflight);
+	server->transaction_idle = NULL;
+	server->transaction_open = NULL;
+	server->transaction_inflight = NULL;
+}
@@ -3,17 +3,38 @@
  * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
  */
 
-#include <assert.h>
-
-#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/edges.h>
+#include <wlr/util/log.h>
 
 #include <wlrston.h>
 #include <view.h>
+#include <transaction.h>
+#include <profile.h>
+
+/* Keeps views in the fullscreen layer above the others for hit-testing. */
+#define VIEW_Z_FULLSCREEN (1ULL << 63)
+
+/* How long an interactive resize waits for the client to ack a size. */
+#define RESIZE_TIMEOUT_MSEC 200
+
+static bool view_on_output(struct wlrston_view *view,
+			   struct wlrston_output *output)
+{
+	struct wlr_box output_box, overlap;
+
+	wlr_output_layout_get_box(view->server->output_layout,
+				  output->wlr_output, &output_box);
+	return wlr_box_intersection(&overlap, &view->spatial.box, &output_box);
+}
 
 void focus_view(struct wlrston_view *view, struct wlr_surface *surface)
 {
-	struct wlr_xdg_surface *previous;
+	struct wlrston_view *previous;
 	struct wlr_surface *prev_surface;
 	struct wlrston_server *server;
 	struct wlr_keyboard *keyboard;
@@ -28,26 +49,713 @@ void focus_view(struct wlrston_view *view, struct wlr_surface *surface)
 	seat = &server->seat;
 	wlr_seat = seat->seat;
 
+	/* Bringing up a covered view ends fullscreen on top of it. */
+	if (view->culled) {
+		struct wlrston_output *output;
+
+		wl_list_for_each(output, &server->output_list, link) {
+			if (output->fullscreen_view && view_on_output(view, output))
+				view_set_fullscreen(output->fullscreen_view,
+						    false, NULL);
+		}
+	}
+
 	prev_surface = wlr_seat->keyboard_state.focused_surface;
 	if (prev_surface == surface) {
 		return;
 	}
-	if (prev_surface) {
-		previous = wlr_xdg_surface_from_wlr_surface(wlr_seat->keyboard_state.focused_surface);
-		assert(previous->role == WLR_XDG_SURFACE_ROLE_TOPLEVEL);
-		wlr_xdg_toplevel_set_activated(previous->toplevel, false);
-	}
+	previous = server->focused_view;
+	if (previous && previous != view)
+		previous->impl->set_activated(previous, false);
+	server->focused_view = view;
 	keyboard = wlr_seat_get_keyboard(wlr_seat);
 
-	wlr_scene_node_raise_to_top(&view->scene_tree->node);
+	view_raise(view);
 	wl_list_remove(&view->link);
 	wl_list_insert(&server->view_list, &view->link);
 
-	wlr_xdg_toplevel_set_activated(view->xdg_toplevel, true);
+	view->impl->set_activated(view, true);
 
 	if (keyboard != NULL) {
-		wlr_seat_keyboard_notify_enter(wlr_seat, view->xdg_toplevel->base->surface,
+		wlr_seat_keyboard_notify_enter(wlr_seat, view->impl->get_surface(view),
 					       keyboard->keycodes, keyboard->num_keycodes,
 					       &keyboard->modifiers);
 	}
 }
+
+static void bounds_add_surface(struct wlr_surface *surface, int sx, int sy,
+			       void *data)
+{
+	pixman_region32_t *bounds = data;
+
+	pixman_region32_union_rect(bounds, bounds, sx, sy,
+				   surface->current.width,
+				   surface->current.height);
+}
+
+/*
+ * Bounding box of the toplevel, its subsurfaces and popups in layout
+ * coordinates. The scene places the window geometry origin at view->x/y.
+ */
+void view_update_bounds(struct wlrston_view *view)
+{
+	pixman_region32_t bounds;
+	pixman_box32_t *extents;
+	struct wlr_box geo_box, box;
+
+	pixman_region32_init(&bounds);
+	view->impl->for_each_surface(view, bounds_add_surface, &bounds);
+	extents = pixman_region32_extents(&bounds);
+
+	view->impl->get_geometry(view, &geo_box);
+	box.x = view->x - geo_box.x + extents->x1;
+	box.y = view->y - geo_box.y + extents->y1;
+	box.width = extents->x2 - extents->x1;
+	box.height = extents->y2 - extents->y1;
+	pixman_region32_fini(&bounds);
+
+	spatial_index_update(&view->server->view_index, &view->spatial, &box);
+	view->server->occlusion_dirty = true;
+}
+
+void view_set_position(struct wlrston_view *view, int x, int y)
+{
+	struct wlr_box box = view->spatial.box;
+
+	box.x += x - view->x;
+	box.y += y - view->y;
+	view->x = x;
+	view->y = y;
+	if (view->impl->set_position)
+		view->impl->set_position(view, x, y);
+	wlr_scene_node_set_position(&view->scene_tree->node, x, y);
+	/* the resize snapshot is placed at the resize box instead */
+	if (view->saved_tree && !view->resize.saved)
+		wlr_scene_node_set_position(&view->saved_tree->node, x, y);
+	spatial_index_update(&view->server->view_index, &view->spatial, &box);
+	view_update_visibility(view);
+}
+
+void view_raise(struct wlrston_view *view)
+{
+	struct wlrston_server *server = view->server;
+
+	wlr_scene_node_raise_to_top(&view->scene_tree->node);
+	view->spatial.z = ++server->view_stack_seq;
+	if (view->scene_tree->node.parent == server->fullscreen_tree)
+		view->spatial.z |= VIEW_Z_FULLSCREEN;
+	server->occlusion_dirty = true;
+}
+
+struct wlrston_output *view_get_output(struct wlrston_view *view)
+{
+	struct wlr_output *wlr_output;
+	struct wlr_box geo_box;
+
+	view->impl->get_geometry(view, &geo_box);
+	wlr_output = wlr_output_layout_output_at(view->server->output_layout,
+						 view->x + geo_box.width / 2.0,
+						 view->y + geo_box.height / 2.0);
+	return wlr_output ? wlr_output->data : NULL;
+}
+
+/* The fullscreen view this one is stacked with: itself or a parent. */
+static struct wlrston_view *view_fullscreen_root(struct wlrston_view *view)
+{
+	for (; view; view = view->impl->get_parent(view)) {
+		if (view->fullscreen)
+			return view;
+	}
+	return NULL;
+}
+
+/*
+ * Fullscreen views and their transients live in the top layer. Any other
+ * view that only shows on outputs with a fullscreen view is culled: its
+ * scene node is disabled, so it is neither rendered nor sent frame
+ * callbacks. That leaves the fullscreen surface alone on its output, which
+ * is what lets wlr_scene_output_commit() scan it out directly.
+ */
+void view_update_visibility(struct wlrston_view *view)
+{
+	struct wlrston_server *server = view->server;
+	struct wlrston_view *root = view_fullscreen_root(view);
+	struct wlr_scene_tree *layer;
+	struct wlrston_output *output;
+	bool covered = false, shown = false;
+
+	layer = root ? server->fullscreen_tree : server->view_tree;
+	if (view->scene_tree->node.parent != layer) {
+		wlr_scene_node_reparent(&view->scene_tree->node, layer);
+		view_raise(view);
+	}
+
+	if (!root) {
+		wl_list_for_each(output, &server->output_list, link) {
+			if (!view_on_output(view, output))
+				continue;
+			if (output->fullscreen_view)
+				covered = true;
+			else
+				shown = true;
+		}
+	}
+
+	view->culled = covered && !shown;
+	wlr_scene_node_set_enabled(&view->scene_tree->node,
+				   !view->culled && !view->saved_tree);
+	if (view->saved_tree) {
+		wlr_scene_node_reparent(&view->saved_tree->node, layer);
+		wlr_scene_node_place_above(&view->saved_tree->node,
+					   &view->scene_tree->node);
+		wlr_scene_node_set_enabled(&view->saved_tree->node,
+					   !view->culled);
+	}
+	server->occlusion_dirty = true;
+}
+
+void server_update_visibility(struct wlrston_server *server)
+{
+	struct wlrston_view *view;
+
+	/* least recently focused first, so layer changes keep the order */
+	wl_list_for_each_reverse(view, &server->view_list, link)
+		view_update_visibility(view);
+}
+
+/* Stretches the saved copy from the view's size to another. */
+struct save_data {
+	struct wlr_scene_tree *saved_tree;
+	int x, y; /* origin of the live tree */
+	int width, height;
+	int from_width, from_height;
+};
+
+static void save_buffer(struct wlr_scene_buffer *buffer, int sx, int sy,
+			void *data)
+{
+	struct save_data *save = data;
+	struct wlr_scene_buffer *copy;
+	int width, height, tmp;
+
+	if (!buffer->buffer)
+		return;
+
+	if (buffer->dst_width > 0 && buffer->dst_height > 0) {
+		width = buffer->dst_width;
+		height = buffer->dst_height;
+	} else {
+		if (buffer->src_box.width > 0 && buffer->src_box.height > 0) {
+			width = buffer->src_box.width;
+			height = buffer->src_box.height;
+		} else {
+			width = buffer->buffer->width;
+			height = buffer->buffer->height;
+		}
+		if (buffer->transform & WL_OUTPUT_TRANSFORM_90) {
+			tmp = width;
+			width = height;
+			height = tmp;
+		}
+	}
+
+	copy = wlr_scene_buffer_create(save->saved_tree, buffer->buffer);
+	if (!copy)
+		return;
+	wlr_scene_node_set_position(&copy->node,
+		(int64_t)(sx - save->x) * save->width / save->from_width,
+		(int64_t)(sy - save->y) * save->height / save->from_height);
+	width = (int64_t)width * save->width / save->from_width;
+	height = (int64_t)height * save->height / save->from_height;
+	wlr_scene_buffer_set_dest_size(copy, width > 0 ? width : 1,
+				       height > 0 ? height : 1);
+	wlr_scene_buffer_set_source_box(copy, &buffer->src_box);
+	wlr_scene_buffer_set_transform(copy, buffer->transform);
+}
+
+static void view_save_scaled(struct wlrston_view *view, int width, int height,
+			     int from_width, int from_height)
+{
+	struct wlr_scene_tree *parent = view->scene_tree->node.parent;
+	struct save_data save = {
+		.x = view->scene_tree->node.x,
+		.y = view->scene_tree->node.y,
+		.width = width,
+		.height = height,
+		.from_width = from_width,
+		.from_height = from_height,
+	};
+
+	view->saved_tree = wlr_scene_tree_create(parent);
+	if (!view->saved_tree)
+		return;
+	view->saved_tree->node.data = view;
+	save.saved_tree = view->saved_tree;
+	wlr_scene_node_set_position(&view->saved_tree->node, save.x, save.y);
+	wlr_scene_node_for_each_buffer(&view->scene_tree->node, save_buffer,
+				       &save);
+	view_update_visibility(view);
+}
+
+void view_save_buffers(struct wlrston_view *view)
+{
+	view_save_scaled(view, 1, 1, 1, 1);
+}
+
+void view_drop_saved(struct wlrston_view *view)
+{
+	if (!view->saved_tree)
+		return;
+	wlr_scene_node_destroy(&view->saved_tree->node);
+	view->saved_tree = NULL;
+}
+
+static void send_surface_frame_done(struct wlr_surface *surface, int sx, int sy,
+				    void *data)
+{
+	wlr_surface_send_frame_done(surface, data);
+}
+
+void server_send_saved_frame_done(struct wlrston_server *server,
+				  struct wlrston_output *output,
+				  const struct timespec *now)
+{
+	struct wlrston_view *view;
+
+	wl_list_for_each(view, &server->view_list, link) {
+		if (!view->saved_tree || view->culled ||
+		    view_get_output(view) != output)
+			continue;
+		view->impl->for_each_surface(view, send_surface_frame_done,
+					     (void *)now);
+	}
+}
+
+struct opaque_data {
+	pixman_region32_t *opaque;
+	int x, y;
+};
+
+static void opaque_add_surface(struct wlr_surface *surface, int sx, int sy,
+			       void *data)
+{
+	struct opaque_data *opaque = data;
+	pixman_region32_t region;
+
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, &surface->opaque_region);
+	pixman_region32_translate(&region, opaque->x + sx, opaque->y + sy);
+	pixman_region32_union(opaque->opaque, opaque->opaque, &region);
+	pixman_region32_fini(&region);
+}
+
+/* Opaque parts of the view and its popups, in layout coordinates. */
+static void view_get_opaque(struct wlrston_view *view, pixman_region32_t *opaque)
+{
+	struct opaque_data data = { .opaque = opaque };
+	struct wlr_box geo_box;
+
+	view->impl->get_geometry(view, &geo_box);
+	data.x = view->x - geo_box.x;
+	data.y = view->y - geo_box.y;
+	view->impl->for_each_surface(view, opaque_add_surface, &data);
+}
+
+static void layer_update_occlusion(struct wlr_scene_tree *layer,
+				   pixman_region32_t *uncovered)
+{
+	pixman_region32_t region;
+	struct wlr_scene_node *node;
+	struct wlrston_view *view;
+	struct wlr_box *box;
+	bool saved;
+
+	pixman_region32_init(&region);
+
+	/* top to bottom */
+	wl_list_for_each_reverse(node, &layer->children, link) {
+		view = node->data;
+		if (!view || !view->mapped)
+			continue;
+		/* a view with a saved copy is seen through the copy */
+		saved = view->saved_tree && node == &view->saved_tree->node;
+		if (view->saved_tree && !saved)
+			continue;
+		if (!node->enabled) {
+			view->occluded = true;
+			continue;
+		}
+
+		box = &view->spatial.box;
+		pixman_region32_intersect_rect(&region, uncovered, box->x, box->y,
+					       box->width, box->height);
+		view->occluded = !pixman_region32_not_empty(&region);
+		/* the live surfaces' opaque regions may not match the copy */
+		if (view->occluded || saved)
+			continue;
+
+		pixman_region32_clear(&region);
+		view_get_opaque(view, &region);
+		pixman_region32_subtract(uncovered, uncovered, &region);
+	}
+
+	pixman_region32_fini(&region);
+}
+
+/*
+ * Works out which views are completely covered by opaque surfaces above
+ * them or lie outside of all outputs. Their frame callbacks are throttled
+ * in output_send_frame_done() and their idle inhibitors stop counting.
+ * Only runs after something that can change the result, which at least
+ * every view commit does.
+ */
+void server_update_occlusion(struct wlrston_server *server)
+{
+	pixman_region32_t uncovered;
+	struct wlrston_output *output;
+	struct wlr_box box;
+
+	if (!server->occlusion_dirty)
+		return;
+	server->occlusion_dirty = false;
+
+	pixman_region32_init(&uncovered);
+	wl_list_for_each(output, &server->output_list, link) {
+		wlr_output_layout_get_box(server->output_layout,
+					  output->wlr_output, &box);
+		pixman_region32_union_rect(&uncovered, &uncovered, box.x, box.y,
+					   box.width, box.height);
+	}
+
+	layer_update_occlusion(server->fullscreen_tree, &uncovered);
+	layer_update_occlusion(server->view_tree, &uncovered);
+
+	pixman_region32_fini(&uncovered);
+
+	/* an inhibitor only counts while its view can be seen */
+	idle_tracker_update_inhibited(&server->idle);
+}
+
+void view_set_fullscreen(struct wlrston_view *view, bool fullscreen,
+			 struct wlr_output *wlr_output)
+{
+	struct wlrston_server *server = view->server;
+	struct wlrston_output *output = NULL;
+	struct wlr_box geo_box, box;
+
+	if (fullscreen) {
+		output = wlr_output ? wlr_output->data : view_get_output(view);
+		if (!output && !wl_list_empty(&server->output_list))
+			output = wl_container_of(server->output_list.next,
+						 output, link);
+	}
+	if ((fullscreen && !output) || view->fullscreen_output == output) {
+		/* nothing changes, but the client still wants a configure */
+		view->impl->set_fullscreen(view, view->fullscreen);
+		return;
+	}
+
+	view_resize_reset(view);
+	if (view == server->grabbed_view)
+		reset_cursor_mode(server);
+
+	if (view->fullscreen) {
+		view->fullscreen_output->fullscreen_view = NULL;
+		view->fullscreen_output = NULL;
+	} else {
+		view->impl->get_geometry(view, &geo_box);
+		view->saved_geometry.x = view->x;
+		view->saved_geometry.y = view->y;
+		view->saved_geometry.width = geo_box.width;
+		view->saved_geometry.height = geo_box.height;
+	}
+
+	if (fullscreen) {
+		if (output->fullscreen_view)
+			view_set_fullscreen(output->fullscreen_view, false, NULL);
+		wlr_output_layout_get_box(server->output_layout,
+					  output->wlr_output, &box);
+		output->fullscreen_view = view;
+		view->fullscreen_output = output;
+	} else {
+		box = view->saved_geometry;
+	}
+	view->fullscreen = fullscreen;
+
+	/*
+	 * The state goes out with the new size in one configure, and the
+	 * views it uncovers or culls change along with it.
+	 */
+	transaction_add_view(view, &box);
+}
+
+void view_index_add(struct wlrston_view *view)
+{
+	struct wlrston_server *server = view->server;
+
+	view->spatial.data = view;
+	view_raise(view);
+	spatial_index_insert(&server->view_index, &view->spatial,
+			     &view->spatial.box);
+	view_update_bounds(view);
+}
+
+void view_index_remove(struct wlrston_view *view)
+{
+	spatial_index_remove(&view->server->view_index, &view->spatial);
+}
+
+void view_map(struct wlrston_view *view, bool fullscreen,
+	      struct wlr_output *fullscreen_output)
+{
+	view->mapped = true;
+	wl_list_insert(&view->server->view_list, &view->link);
+	view_index_add(view);
+	switcher_view_map(view);
+
+	if (fullscreen)
+		view_set_fullscreen(view, true, fullscreen_output);
+	else
+		view_update_visibility(view);
+
+	/* A window opening under a fullscreen one must not steal focus. */
+	if (view->culled) {
+		wl_list_remove(&view->link);
+		wl_list_insert(view->server->view_list.prev, &view->link);
+		return;
+	}
+	focus_view(view, view->impl->get_surface(view));
+}
+
+void view_unmap(struct wlrston_view *view)
+{
+	struct wlrston_server *server = view->server;
+
+	view_resize_reset(view);
+	if (view == server->grabbed_view) {
+		reset_cursor_mode(server);
+	}
+	if (view == server->focused_view)
+		server->focused_view = NULL;
+	transaction_remove_view(view);
+	if (view->fullscreen) {
+		view->fullscreen_output->fullscreen_view = NULL;
+		view->fullscreen_output = NULL;
+		view->fullscreen = false;
+	}
+	view_index_remove(view);
+	wl_list_remove(&view->link);
+	switcher_view_unmap(view);
+	view->mapped = false;
+	server_update_visibility(server);
+}
+
+void view_commit(struct wlrston_view *view)
+{
+	transaction_view_commit(view);
+	view_resize_commit(view);
+	view_update_bounds(view);
+	switcher_view_commit(view);
+}
+
+void view_begin_interactive(struct wlrston_view *view,
+			    enum wlrston_cursor_mode mode, uint32_t edges)
+{
+	struct wlrston_server *server = view->server;
+	struct wlrston_seat *seat = &server->seat;
+	struct wlr_surface *focused_surface =
+		seat->seat->pointer_state.focused_surface;
+
+	if (!focused_surface ||
+	    view->impl->get_surface(view) != wlr_surface_get_root_surface(focused_surface)) {
+		return;
+	}
+	server->grabbed_view = view;
+	server->cursor_mode = mode;
+
+	if (mode == WLRSTON_CURSOR_MOVE) {
+		server->grab_x = seat->cursor->x - view->x;
+		server->grab_y = seat->cursor->y - view->y;
+	} else {
+		struct wlr_box geo_box;
+		view->impl->get_geometry(view, &geo_box);
+
+		double border_x = (view->x + geo_box.x) +
+			((edges & WLR_EDGE_RIGHT) ? geo_box.width : 0);
+		double border_y = (view->y + geo_box.y) +
+			((edges & WLR_EDGE_BOTTOM) ? geo_box.height : 0);
+		server->grab_x = seat->cursor->x - border_x;
+		server->grab_y = seat->cursor->y - border_y;
+
+		server->grab_geobox = geo_box;
+		server->grab_geobox.x += view->x;
+		server->grab_geobox.y += view->y;
+
+		server->resize_edges = edges;
+	}
+}
+
+/* Shows the buffers the view has now stretched to the requested box. */
+static void view_resize_snapshot(struct wlrston_view *view)
+{
+	struct wlr_box geo_box;
+
+	/* a transaction shows its own copy */
+	if (view->saved_tree && !view->resize.saved)
+		return;
+
+	view->impl->get_geometry(view, &geo_box);
+	if (geo_box.width <= 0 || geo_box.height <= 0)
+		return;
+
+	view_drop_saved(view);
+	view_save_scaled(view, view->resize.box.width, view->resize.box.height,
+			 geo_box.width, geo_box.height);
+	if (!view->saved_tree)
+		return;
+	view->resize.saved = true;
+	/* the box is the window geometry, CSD shadows lie outside of it */
+	wlr_scene_node_set_position(&view->saved_tree->node,
+		view->resize.box.x - (int64_t)geo_box.x *
+			view->resize.box.width / geo_box.width,
+		view->resize.box.y - (int64_t)geo_box.y *
+			view->resize.box.height / geo_box.height);
+}
+
+static void view_resize_drop_snapshot(struct wlrston_view *view)
+{
+	if (!view->resize.saved)
+		return;
+	view->resize.saved = false;
+	view_drop_saved(view);
+	view_update_visibility(view);
+}
+
+static void view_send_resize(struct wlrston_view *view)
+{
+	struct wlrston_output *output;
+
+	view->resize.sent = view->resize.box;
+	view->resize.pending = false;
+	view->resize.serial = view->impl->configure(view,
+						    view->resize.box.width,
+						    view->resize.box.height);
+	if (view->resize.serial == 0)
+		return;
+	if (view->resize.timer)
+		wl_event_source_timer_update(view->resize.timer,
+					     RESIZE_TIMEOUT_MSEC);
+
+	/* hidden, it needs a frame for its frame callbacks */
+	output = view_get_output(view);
+	if (output)
+		wlr_output_schedule_frame(output->wlr_output);
+}
+
+/* Place the view so that the edges not being dragged stay put. */
+static void view_place_resized(struct wlrston_view *view,
+			       const struct wlr_box *target, int width, int height)
+{
+	struct wlr_box geo_box;
+	int left = target->x, top = target->y;
+
+	if (view->resize.edges & WLR_EDGE_LEFT)
+		left = target->x + target->width - width;
+	if (view->resize.edges & WLR_EDGE_TOP)
+		top = target->y + target->height - height;
+
+	view->impl->get_geometry(view, &geo_box);
+	view_set_position(view, left - geo_box.x, top - geo_box.y);
+}
+
+/* The client did not ack in time, it gets the latest size anyway. */
+static int view_resize_timeout(void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = data;
+
+	wlr_log(WLR_DEBUG, "resize configure %u not acked in time",
+		view->resize.serial);
+	view->resize.serial = 0;
+	if (view->resize.pending) {
+		view_send_resize(view);
+		view_resize_snapshot(view);
+	} else {
+		view_resize_drop_snapshot(view);
+	}
+	return 0;
+}
+
+void view_resize(struct wlrston_view *view, uint32_t edges,
+		 const struct wlr_box *box)
+{
+	struct wl_event_loop *loop;
+
+	view->resize.edges = edges;
+	view->resize.box = *box;
+
+	if (!view->resize.timer) {
+		loop = wl_display_get_event_loop(view->server->wl_display);
+		view->resize.timer = wl_event_loop_add_timer(loop,
+			view_resize_timeout, view);
+	}
+
+	if (view->resize.serial == 0) {
+		view_send_resize(view);
+	} else {
+		view->resize.pending = true;
+	}
+
+	/* X11 windows take the size right away, there is no ack to wait for */
+	if (view->resize.serial == 0) {
+		view_place_resized(view, box, box->width, box->height);
+		return;
+	}
+	view_resize_snapshot(view);
+}
+
+/*
+ * Called when the toplevel commits, with the new buffer already in place.
+ * Only then does the view move, along with the buffer of the acked size.
+ */
+void view_resize_commit(struct wlrston_view *view)
+{
+	struct wlr_box geo_box;
+
+	if (view->resize.serial == 0)
+		return;
+	if (!view->impl->acked(view, view->resize.serial))
+		return;
+
+	view->resize.serial = 0;
+	if (view->resize.timer)
+		wl_event_source_timer_update(view->resize.timer, 0);
+	view->impl->get_geometry(view, &geo_box);
+	view_place_resized(view, &view->resize.sent, geo_box.width,
+			   geo_box.height);
+
+	if (view->resize.pending) {
+		view_send_resize(view);
+		view_resize_snapshot(view);
+	} else {
+		view_resize_drop_snapshot(view);
+	}
+}
+
+/* The last size of the grab goes out even with a configure in flight. */
+void view_resize_end(struct wlrston_view *view)
+{
+	if (view->resize.pending)
+		view_send_resize(view);
+}
+
+void view_resize_reset(struct wlrston_view *view)
+{
+	if (view->resize.timer) {
+		wl_event_source_remove(view->resize.timer);
+		view->resize.timer = NULL;
+	}
+	view->resize.serial = 0;
+	view->resize.pending = false;
+	view_resize_drop_snapshot(view);
+}
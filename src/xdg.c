@@ -8,98 +8,154 @@
 
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/types/wlr_scene.h>
-#include <wlr/types/wlr_cursor.h>
-#include <wlr/util/edges.h>
 
 #include <wlrston.h>
 #include <view.h>
+#include <profile.h>
+
+static struct wlr_surface *xdg_view_get_surface(struct wlrston_view *view)
+{
+	return view->xdg_toplevel->base->surface;
+}
+
+static void xdg_view_get_geometry(struct wlrston_view *view,
+				  struct wlr_box *box)
+{
+	wlr_xdg_surface_get_geometry(view->xdg_toplevel->base, box);
+}
+
+static void xdg_view_for_each_surface(struct wlrston_view *view,
+				      wlr_surface_iterator_func_t iterator,
+				      void *data)
+{
+	wlr_xdg_surface_for_each_surface(view->xdg_toplevel->base, iterator,
+					 data);
+}
+
+static struct wlrston_view *xdg_view_get_parent(struct wlrston_view *view)
+{
+	struct wlr_xdg_toplevel *parent = view->xdg_toplevel->parent;
+	struct wlr_scene_tree *tree;
+
+	if (!parent)
+		return NULL;
+	tree = parent->base->data;
+	return tree ? tree->node.data : NULL;
+}
+
+static void xdg_view_set_activated(struct wlrston_view *view, bool activated)
+{
+	wlr_xdg_toplevel_set_activated(view->xdg_toplevel, activated);
+}
+
+static void xdg_view_set_fullscreen(struct wlrston_view *view, bool fullscreen)
+{
+	wlr_xdg_toplevel_set_fullscreen(view->xdg_toplevel, fullscreen);
+}
+
+static uint32_t xdg_view_configure(struct wlrston_view *view, int width,
+				   int height)
+{
+	return wlr_xdg_toplevel_set_size(view->xdg_toplevel, width, height);
+}
+
+static bool xdg_view_acked(struct wlrston_view *view, uint32_t serial)
+{
+	struct wlr_xdg_surface *xdg_surface = view->xdg_toplevel->base;
+
+	return (int32_t)(xdg_surface->current.configure_serial - serial) >= 0;
+}
+
+static void xdg_view_close(struct wlrston_view *view)
+{
+	wlr_xdg_toplevel_send_close(view->xdg_toplevel);
+}
+
+static const struct view_impl xdg_view_impl = {
+	.get_surface = xdg_view_get_surface,
+	.get_geometry = xdg_view_get_geometry,
+	.for_each_surface = xdg_view_for_each_surface,
+	.get_parent = xdg_view_get_parent,
+	.set_activated = xdg_view_set_activated,
+	.set_fullscreen = xdg_view_set_fullscreen,
+	.configure = xdg_view_configure,
+	.acked = xdg_view_acked,
+	.close = xdg_view_close,
+};
 
 static void xdg_toplevel_map(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_view *view = wl_container_of(listener, view, map);
+	struct wlr_xdg_toplevel *toplevel = view->xdg_toplevel;
 
-	wl_list_insert(&view->server->view_list, &view->link);
-	focus_view(view, view->xdg_toplevel->base->surface);
+	view_map(view, toplevel->requested.fullscreen,
+		 toplevel->requested.fullscreen_output);
 }
 
 static void xdg_toplevel_unmap(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_view *view = wl_container_of(listener, view, unmap);
 
-	if (view == view->server->grabbed_view) {
-		reset_cursor_mode(view->server);
-	}
-	wl_list_remove(&view->link);
+	view_unmap(view);
+}
+
+static void xdg_toplevel_commit(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = wl_container_of(listener, view, commit);
+
+	if (!view->mapped)
+		return;
+
+	view_commit(view);
 }
 
 static void xdg_toplevel_destroy(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_view *view = wl_container_of(listener, view, destroy);
+	struct wlrston_popup *popup, *tmp;
+
+	wl_list_for_each_safe(popup, tmp, &view->popups, link) {
+		popup->view = NULL;
+		wl_list_remove(&popup->link);
+		wl_list_init(&popup->link);
+	}
 
 	wl_list_remove(&view->map.link);
 	wl_list_remove(&view->unmap.link);
+	wl_list_remove(&view->commit.link);
 	wl_list_remove(&view->destroy.link);
 	wl_list_remove(&view->request_move.link);
 	wl_list_remove(&view->request_resize.link);
 	wl_list_remove(&view->request_maximize.link);
 	wl_list_remove(&view->request_fullscreen.link);
-	free(view);
+	pool_free(&view->server->pools.views, view);
 }
 
 
-static void
-begin_interactive(struct wlrston_view *view, enum wlrston_cursor_mode mode, uint32_t edges)
-{
-	struct wlrston_server *server = view->server;
-	struct wlrston_seat *seat = &server->seat;
-	struct wlr_surface *focused_surface =
-		seat->seat->pointer_state.focused_surface;
-
-	if (view->xdg_toplevel->base->surface != wlr_surface_get_root_surface(focused_surface)) {
-		return;
-	}
-	server->grabbed_view = view;
-	server->cursor_mode = mode;
-
-	if (mode == WLRSTON_CURSOR_MOVE) {
-		server->grab_x = seat->cursor->x - view->x;
-		server->grab_y = seat->cursor->y - view->y;
-	} else {
-		struct wlr_box geo_box;
-		wlr_xdg_surface_get_geometry(view->xdg_toplevel->base, &geo_box);
-
-		double border_x = (view->x + geo_box.x) +
-			((edges & WLR_EDGE_RIGHT) ? geo_box.width : 0);
-		double border_y = (view->y + geo_box.y) +
-			((edges & WLR_EDGE_BOTTOM) ? geo_box.height : 0);
-		server->grab_x = seat->cursor->x - border_x;
-		server->grab_y = seat->cursor->y - border_y;
-
-		server->grab_geobox = geo_box;
-		server->grab_geobox.x += view->x;
-		server->grab_geobox.y += view->y;
-
-		server->resize_edges = edges;
-	}
-}
-
 static void xdg_toplevel_request_move(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_view *view = wl_container_of(listener, view, request_move);
 
-	begin_interactive(view, WLRSTON_CURSOR_MOVE, 0);
+	view_begin_interactive(view, WLRSTON_CURSOR_MOVE, 0);
 }
 
 static void xdg_toplevel_request_resize(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_view *view = wl_container_of(listener, view, request_resize);
 	struct wlr_xdg_toplevel_resize_event *event = data;
 
-	begin_interactive(view, WLRSTON_CURSOR_RESIZE, event->edges);
+	view_begin_interactive(view, WLRSTON_CURSOR_RESIZE, event->edges);
 }
 
 static void xdg_toplevel_request_maximize(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_view *view = wl_container_of(listener, view, request_maximize);
 
 	wlr_xdg_surface_schedule_configure(view->xdg_toplevel->base);
@@ -107,32 +163,106 @@ static void xdg_toplevel_request_maximize(struct wl_listener *listener, void *da
 
 static void xdg_toplevel_request_fullscreen(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_view *view = wl_container_of(listener, view, request_fullscreen);
+	struct wlr_xdg_toplevel *toplevel = view->xdg_toplevel;
 
-	wlr_xdg_surface_schedule_configure(view->xdg_toplevel->base);
+	/* Before the first map, the request is picked up in xdg_toplevel_map. */
+	if (!toplevel->base->mapped) {
+		wlr_xdg_surface_schedule_configure(toplevel->base);
+		return;
+	}
+	view_set_fullscreen(view, toplevel->requested.fullscreen,
+			    toplevel->requested.fullscreen_output);
+}
+
+static void xdg_popup_commit(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_popup *popup = wl_container_of(listener, popup, commit);
+
+	if (popup->view && popup->view->mapped)
+		view_update_bounds(popup->view);
+}
+
+static void xdg_popup_destroy(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_popup *popup = wl_container_of(listener, popup, destroy);
+	struct wlrston_view *view = popup->view;
+
+	wl_list_remove(&popup->commit.link);
+	wl_list_remove(&popup->destroy.link);
+	wl_list_remove(&popup->link);
+	pool_free(&popup->server->pools.popups, popup);
+
+	if (view && view->mapped)
+		view_update_bounds(view);
+}
+
+static struct wlrston_view *view_from_tree(struct wlr_scene_tree *tree)
+{
+	while (tree != NULL && tree->node.data == NULL) {
+		tree = tree->node.parent;
+	}
+	return tree ? tree->node.data : NULL;
+}
+
+static void xdg_popup_new(struct wlr_xdg_surface *xdg_surface)
+{
+	struct wlr_xdg_surface *parent;
+	struct wlr_scene_tree *parent_tree;
+	struct wlrston_popup *popup;
+	struct wlrston_view *view;
+
+	parent = wlr_xdg_surface_from_wlr_surface(xdg_surface->popup->parent);
+	parent_tree = parent->data;
+	xdg_surface->data = wlr_scene_xdg_surface_create(parent_tree, xdg_surface);
+
+	/* Popups extend the bounds their toplevel is hit-tested with. */
+	view = view_from_tree(parent_tree);
+	if (!view)
+		return;
+
+	popup = pool_zalloc(&view->server->pools.popups);
+	if (!popup)
+		return;
+	popup->server = view->server;
+	popup->xdg_popup = xdg_surface->popup;
+	popup->view = view;
+	wl_list_insert(&view->popups, &popup->link);
+
+	popup->commit.notify = xdg_popup_commit;
+	wl_signal_add(&xdg_surface->surface->events.commit, &popup->commit);
+	popup->destroy.notify = xdg_popup_destroy;
+	wl_signal_add(&xdg_surface->events.destroy, &popup->destroy);
 }
 
 void xdg_surface_new(struct wl_listener *listener, void *data)
 {
+	PROFILE_LISTENER();
 	struct wlrston_server *server = wl_container_of(listener, server, new_xdg_surface);
 	struct wlr_xdg_surface *xdg_surface = data;
-	struct wlr_xdg_surface *parent;
-	struct wlr_scene_tree *parent_tree;
 	struct wlr_xdg_toplevel *toplevel;
 	struct wlrston_view *view;
 
 	if (xdg_surface->role == WLR_XDG_SURFACE_ROLE_POPUP) {
-		parent = wlr_xdg_surface_from_wlr_surface(xdg_surface->popup->parent);
-		parent_tree = parent->data;
-		xdg_surface->data = wlr_scene_xdg_surface_create(parent_tree, xdg_surface);
+		xdg_popup_new(xdg_surface);
 		return;
 	}
 	assert(xdg_surface->role == WLR_XDG_SURFACE_ROLE_TOPLEVEL);
 
-	view = calloc(1, sizeof(struct wlrston_view));
+	view = pool_zalloc(&server->pools.views);
+	if (!view) {
+		wlr_log(WLR_ERROR, "failed to allocate a view");
+		wl_resource_post_no_memory(xdg_surface->resource);
+		return;
+	}
 	view->server = server;
+	view->impl = &xdg_view_impl;
 	view->xdg_toplevel = xdg_surface->toplevel;
-	view->scene_tree = wlr_scene_xdg_surface_create(&view->server->scene->tree,
+	wl_list_init(&view->popups);
+	view->scene_tree = wlr_scene_xdg_surface_create(view->server->view_tree,
 							view->xdg_toplevel->base);
 	view->scene_tree->node.data = view;
 	xdg_surface->data = view->scene_tree;
@@ -141,6 +271,8 @@ void xdg_surface_new(struct wl_listener *listener, void *data)
 	wl_signal_add(&xdg_surface->events.map, &view->map);
 	view->unmap.notify = xdg_toplevel_unmap;
 	wl_signal_add(&xdg_surface->events.unmap, &view->unmap);
+	view->commit.notify = xdg_toplevel_commit;
+	wl_signal_add(&xdg_surface->surface->events.commit, &view->commit);
 	view->destroy.notify = xdg_toplevel_destroy;
 	wl_signal_add(&xdg_surface->events.destroy, &view->destroy);
 
@@ -0,0 +1,501 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2024 He Yong <hyyoxhk@163.com>
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+#include <wlr/xwayland.h>
+
+#include <wlrston.h>
+#include <view.h>
+#include <xwayland.h>
+#include <profile.h>
+
+/*
+ * wlroots only listens for clients again when the server it loses ran
+ * for longer than 5 seconds, any shorter and X11 would be gone for good.
+ */
+#define XWAYLAND_MIN_RUN_SEC 6
+
+struct xwayland {
+	struct wlrston_server *server;
+	struct wlr_xwayland *wlr_xwayland;
+	int n_surfaces; /* X11 windows, mapped or not */
+
+	int idle_timeout_msec;
+	struct wl_event_source *idle_timer; /* NULL without a timeout */
+
+	struct wl_listener ready;
+	struct wl_listener new_surface;
+};
+
+/*
+ * Every X11 window, whether it ends up managed or not is only known when
+ * it maps. The view is used while a managed window is mapped.
+ */
+struct xwayland_surface {
+	struct wlrston_view view;
+	struct xwayland *xwayland;
+	struct wlr_xwayland_surface *xsurface;
+	struct wlr_scene_tree *surface_tree; /* NULL while unmapped */
+	bool managed;
+
+	struct wl_listener request_configure;
+	struct wl_listener request_activate;
+};
+
+static struct xwayland_surface *surface_from_view(struct wlrston_view *view)
+{
+	struct xwayland_surface *surface;
+
+	return wl_container_of(view, surface, view);
+}
+
+static struct wlr_surface *xwayland_view_get_surface(struct wlrston_view *view)
+{
+	return surface_from_view(view)->xsurface->surface;
+}
+
+/* X11 windows draw their own decorations, the geometry is the surface. */
+static void xwayland_view_get_geometry(struct wlrston_view *view,
+				       struct wlr_box *box)
+{
+	struct wlr_surface *surface = xwayland_view_get_surface(view);
+
+	box->x = box->y = 0;
+	box->width = surface ? surface->current.width : 0;
+	box->height = surface ? surface->current.height : 0;
+}
+
+static void xwayland_view_for_each_surface(struct wlrston_view *view,
+					   wlr_surface_iterator_func_t iterator,
+					   void *data)
+{
+	struct wlr_surface *surface = xwayland_view_get_surface(view);
+
+	if (surface)
+		wlr_surface_for_each_surface(surface, iterator, data);
+}
+
+static struct wlrston_view *xwayland_view_get_parent(struct wlrston_view *view)
+{
+	struct wlr_xwayland_surface *parent =
+		surface_from_view(view)->xsurface->parent;
+	struct xwayland_surface *surface = parent ? parent->data : NULL;
+
+	return surface && surface->managed ? &surface->view : NULL;
+}
+
+static void xwayland_view_set_activated(struct wlrston_view *view,
+					bool activated)
+{
+	wlr_xwayland_surface_activate(surface_from_view(view)->xsurface,
+				      activated);
+}
+
+static void xwayland_view_set_fullscreen(struct wlrston_view *view,
+					 bool fullscreen)
+{
+	wlr_xwayland_surface_set_fullscreen(surface_from_view(view)->xsurface,
+					    fullscreen);
+}
+
+/* X11 has no configure serials, the new size is not waited for. */
+static uint32_t xwayland_view_configure(struct wlrston_view *view, int width,
+					int height)
+{
+	wlr_xwayland_surface_configure(surface_from_view(view)->xsurface,
+				       view->x, view->y, width, height);
+	return 0;
+}
+
+static bool xwayland_view_acked(struct wlrston_view *view, uint32_t serial)
+{
+	return true;
+}
+
+/* Clients place their menus from where they think their window is. */
+static void xwayland_view_set_position(struct wlrston_view *view, int x, int y)
+{
+	struct wlr_xwayland_surface *xsurface = surface_from_view(view)->xsurface;
+
+	wlr_xwayland_surface_configure(xsurface, x, y, xsurface->width,
+				       xsurface->height);
+}
+
+static void xwayland_view_close(struct wlrston_view *view)
+{
+	wlr_xwayland_surface_close(surface_from_view(view)->xsurface);
+}
+
+static const struct view_impl xwayland_view_impl = {
+	.get_surface = xwayland_view_get_surface,
+	.get_geometry = xwayland_view_get_geometry,
+	.for_each_surface = xwayland_view_for_each_surface,
+	.get_parent = xwayland_view_get_parent,
+	.set_activated = xwayland_view_set_activated,
+	.set_fullscreen = xwayland_view_set_fullscreen,
+	.configure = xwayland_view_configure,
+	.acked = xwayland_view_acked,
+	.set_position = xwayland_view_set_position,
+	.close = xwayland_view_close,
+};
+
+/*
+ * Idleness is counted in X11 windows, not X11 clients: wlroots 0.16 does
+ * not tell which X11 clients are connected, so one that has no window
+ * left does not keep Xwayland running.
+ */
+static void xwayland_arm_idle(struct xwayland *xwayland)
+{
+	if (xwayland->idle_timer && xwayland->n_surfaces == 0)
+		wl_event_source_timer_update(xwayland->idle_timer,
+					     xwayland->idle_timeout_msec);
+}
+
+/*
+ * Destroying the Xwayland client stops the server. Because it was started
+ * lazily, wlroots goes back to waiting on the X11 sockets, DISPLAY stays
+ * valid and the next client brings it back up.
+ */
+static int xwayland_idle_timeout(void *data)
+{
+	PROFILE_LISTENER();
+	struct xwayland *xwayland = data;
+	struct wlr_xwayland_server *server = xwayland->wlr_xwayland->server;
+	time_t ran;
+
+	if (xwayland->n_surfaces > 0 || !server || !server->client)
+		return 0;
+
+	ran = time(NULL) - server->server_start;
+	if (ran < XWAYLAND_MIN_RUN_SEC) {
+		wl_event_source_timer_update(xwayland->idle_timer,
+					     (XWAYLAND_MIN_RUN_SEC - ran) * 1000);
+		return 0;
+	}
+
+	wlr_log(WLR_INFO, "no X11 windows for %d s, stopping Xwayland",
+		xwayland->idle_timeout_msec / 1000);
+	wl_client_destroy(server->client);
+	return 0;
+}
+
+static void xwayland_surface_commit(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = wl_container_of(listener, view, commit);
+	struct xwayland_surface *surface = surface_from_view(view);
+	struct wlr_xwayland_surface *xsurface = surface->xsurface;
+
+	if (surface->managed)
+		view_commit(view);
+	else
+		wlr_scene_node_set_position(&surface->surface_tree->node,
+					    xsurface->x, xsurface->y);
+}
+
+static void xwayland_surface_map(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = wl_container_of(listener, view, map);
+	struct xwayland_surface *surface = surface_from_view(view);
+	struct wlr_xwayland_surface *xsurface = surface->xsurface;
+	struct wlrston_server *server = view->server;
+
+	surface->managed = !xsurface->override_redirect;
+	if (!surface->managed) {
+		surface->surface_tree = wlr_scene_subsurface_tree_create(
+			server->unmanaged_tree, xsurface->surface);
+		if (!surface->surface_tree)
+			goto failed;
+		wlr_scene_node_set_position(&surface->surface_tree->node,
+					    xsurface->x, xsurface->y);
+	} else {
+		view->scene_tree = wlr_scene_tree_create(server->view_tree);
+		if (!view->scene_tree)
+			goto failed;
+		surface->surface_tree = wlr_scene_subsurface_tree_create(
+			view->scene_tree, xsurface->surface);
+		if (!surface->surface_tree) {
+			wlr_scene_node_destroy(&view->scene_tree->node);
+			view->scene_tree = NULL;
+			goto failed;
+		}
+		view->scene_tree->node.data = view;
+		view->x = xsurface->x;
+		view->y = xsurface->y;
+		wlr_scene_node_set_position(&view->scene_tree->node,
+					    view->x, view->y);
+	}
+
+	view->commit.notify = xwayland_surface_commit;
+	wl_signal_add(&xsurface->surface->events.commit, &view->commit);
+
+	if (surface->managed)
+		view_map(view, xsurface->fullscreen, NULL);
+	return;
+
+failed:
+	surface->managed = false;
+	wlr_log(WLR_ERROR, "failed to show X11 window 0x%x",
+		xsurface->window_id);
+}
+
+static void xwayland_surface_unmap(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = wl_container_of(listener, view, unmap);
+	struct xwayland_surface *surface = surface_from_view(view);
+
+	if (!surface->surface_tree)
+		return;
+
+	wl_list_remove(&view->commit.link);
+	if (surface->managed) {
+		view_unmap(view);
+		/* takes the surface tree along */
+		wlr_scene_node_destroy(&view->scene_tree->node);
+		view->scene_tree = NULL;
+	} else {
+		wlr_scene_node_destroy(&surface->surface_tree->node);
+	}
+	surface->surface_tree = NULL;
+	surface->managed = false;
+}
+
+static void xwayland_surface_destroy(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = wl_container_of(listener, view, destroy);
+	struct xwayland_surface *surface = surface_from_view(view);
+	struct xwayland *xwayland = surface->xwayland;
+
+	xwayland_surface_unmap(&view->unmap, NULL);
+
+	wl_list_remove(&view->map.link);
+	wl_list_remove(&view->unmap.link);
+	wl_list_remove(&view->destroy.link);
+	wl_list_remove(&view->request_move.link);
+	wl_list_remove(&view->request_resize.link);
+	wl_list_remove(&view->request_fullscreen.link);
+	wl_list_remove(&surface->request_configure.link);
+	wl_list_remove(&surface->request_activate.link);
+	surface->xsurface->data = NULL;
+	pool_free(&xwayland->server->pools.x11_windows, surface);
+
+	xwayland->n_surfaces--;
+	xwayland_arm_idle(xwayland);
+}
+
+static void xwayland_surface_request_configure(struct wl_listener *listener,
+					       void *data)
+{
+	PROFILE_LISTENER();
+	struct xwayland_surface *surface =
+		wl_container_of(listener, surface, request_configure);
+	struct wlr_xwayland_surface_configure_event *event = data;
+	struct wlrston_view *view = &surface->view;
+
+	if (!surface->managed) {
+		wlr_xwayland_surface_configure(surface->xsurface, event->x,
+					       event->y, event->width,
+					       event->height);
+		return;
+	}
+
+	/* the client is told it stays where it is */
+	if (view->fullscreen) {
+		wlr_xwayland_surface_configure(surface->xsurface, view->x,
+					       view->y, surface->xsurface->width,
+					       surface->xsurface->height);
+		return;
+	}
+
+	wlr_xwayland_surface_configure(surface->xsurface, event->x, event->y,
+				       event->width, event->height);
+	if (event->x != view->x || event->y != view->y)
+		view_set_position(view, event->x, event->y);
+}
+
+static void xwayland_surface_request_activate(struct wl_listener *listener,
+					      void *data)
+{
+	PROFILE_LISTENER();
+	struct xwayland_surface *surface =
+		wl_container_of(listener, surface, request_activate);
+
+	if (surface->managed)
+		focus_view(&surface->view, surface->xsurface->surface);
+}
+
+static void xwayland_surface_request_move(struct wl_listener *listener,
+					  void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = wl_container_of(listener, view, request_move);
+
+	if (surface_from_view(view)->managed)
+		view_begin_interactive(view, WLRSTON_CURSOR_MOVE, 0);
+}
+
+static void xwayland_surface_request_resize(struct wl_listener *listener,
+					    void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view = wl_container_of(listener, view, request_resize);
+	struct wlr_xwayland_resize_event *event = data;
+
+	if (surface_from_view(view)->managed)
+		view_begin_interactive(view, WLRSTON_CURSOR_RESIZE, event->edges);
+}
+
+static void xwayland_surface_request_fullscreen(struct wl_listener *listener,
+						void *data)
+{
+	PROFILE_LISTENER();
+	struct wlrston_view *view =
+		wl_container_of(listener, view, request_fullscreen);
+	struct xwayland_surface *surface = surface_from_view(view);
+
+	/* before the first map, the state is picked up in xwayland_surface_map */
+	if (surface->managed)
+		view_set_fullscreen(view, surface->xsurface->fullscreen, NULL);
+}
+
+static void xwayland_new_surface(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct xwayland *xwayland =
+		wl_container_of(listener, xwayland, new_surface);
+	struct wlr_xwayland_surface *xsurface = data;
+	struct xwayland_surface *surface;
+	struct wlrston_view *view;
+
+	surface = pool_zalloc(&xwayland->server->pools.x11_windows);
+	if (!surface) {
+		wlr_log(WLR_ERROR, "failed to allocate X11 window 0x%x",
+			xsurface->window_id);
+		return;
+	}
+	surface->xwayland = xwayland;
+	surface->xsurface = xsurface;
+	xsurface->data = surface;
+
+	view = &surface->view;
+	view->server = xwayland->server;
+	view->impl = &xwayland_view_impl;
+	wl_list_init(&view->popups);
+
+	view->map.notify = xwayland_surface_map;
+	wl_signal_add(&xsurface->events.map, &view->map);
+	view->unmap.notify = xwayland_surface_unmap;
+	wl_signal_add(&xsurface->events.unmap, &view->unmap);
+	view->destroy.notify = xwayland_surface_destroy;
+	wl_signal_add(&xsurface->events.destroy, &view->destroy);
+	view->request_move.notify = xwayland_surface_request_move;
+	wl_signal_add(&xsurface->events.request_move, &view->request_move);
+	view->request_resize.notify = xwayland_surface_request_resize;
+	wl_signal_add(&xsurface->events.request_resize, &view->request_resize);
+	view->request_fullscreen.notify = xwayland_surface_request_fullscreen;
+	wl_signal_add(&xsurface->events.request_fullscreen,
+		      &view->request_fullscreen);
+	surface->request_configure.notify = xwayland_surface_request_configure;
+	wl_signal_add(&xsurface->events.request_configure,
+		      &surface->request_configure);
+	surface->request_activate.notify = xwayland_surface_request_activate;
+	wl_signal_add(&xsurface->events.request_activate,
+		      &surface->request_activate);
+
+	xwayland->n_surfaces++;
+	if (xwayland->idle_timer)
+		wl_event_source_timer_update(xwayland->idle_timer, 0);
+}
+
+static void xwayland_ready(struct wl_listener *listener, void *data)
+{
+	PROFILE_LISTENER();
+	struct xwayland *xwayland = wl_container_of(listener, xwayland, ready);
+
+	wlr_log(WLR_INFO, "Xwayland started on DISPLAY=%s",
+		xwayland->wlr_xwayland->display_name);
+	/* a new client each time it starts, before any X11 window */
+	client_tracker_exempt(&xwayland->server->clients,
+			      xwayland->wlr_xwayland->server->client);
+	/* a client that never opens a window does not keep it running */
+	xwayland_arm_idle(xwayland);
+}
+
+struct xwayland *xwayland_create(struct wlrston_server *server,
+				 int idle_timeout_sec)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+	struct xwayland *xwayland;
+
+	xwayland = calloc(1, sizeof(*xwayland));
+	if (!xwayland) {
+		wlr_log(WLR_ERROR, "failed to allocate Xwayland");
+		return NULL;
+	}
+	xwayland->server = server;
+	xwayland->idle_timeout_msec = idle_timeout_sec * 1000;
+	pool_init(&xwayland->server->pools.x11_windows, "x11_windows",
+		  sizeof(struct xwayland_surface));
+
+	if (idle_timeout_sec > 0) {
+		xwayland->idle_timer = wl_event_loop_add_timer(loop,
+			xwayland_idle_timeout, xwayland);
+		if (!xwayland->idle_timer)
+			goto failed_free;
+	}
+
+	/* only the sockets, the server starts with the first client */
+	xwayland->wlr_xwayland = wlr_xwayland_create(server->wl_display,
+						     server->compositor, true);
+	if (!xwayland->wlr_xwayland) {
+		wlr_log(WLR_ERROR, "failed to set up Xwayland");
+		goto failed_remove_timer;
+	}
+	wlr_xwayland_set_seat(xwayland->wlr_xwayland, server->seat.seat);
+
+	xwayland->ready.notify = xwayland_ready;
+	wl_signal_add(&xwayland->wlr_xwayland->events.ready, &xwayland->ready);
+	xwayland->new_surface.notify = xwayland_new_surface;
+	wl_signal_add(&xwayland->wlr_xwayland->events.new_surface,
+		      &xwayland->new_surface);
+
+	setenv("DISPLAY", xwayland->wlr_xwayland->display_name, true);
+	wlr_log(WLR_INFO, "X11 clients can connect on DISPLAY=%s",
+		xwayland->wlr_xwayland->display_name);
+	return xwayland;
+
+failed_remove_timer:
+	if (xwayland->idle_timer)
+		wl_event_source_remove(xwayland->idle_timer);
+failed_free:
+	pool_finish(&xwayland->server->pools.x11_windows);
+	free(xwayland);
+	return NULL;
+}
+
+void xwayland_destroy(struct xwayland *xwayland)
+{
+	if (!xwayland)
+		return;
+
+	wl_list_remove(&xwayland->ready.link);
+	wl_list_remove(&xwayland->new_surface.link);
+	/* destroys the windows that are left */
+	wlr_xwayland_destroy(xwayland->wlr_xwayland);
+	unsetenv("DISPLAY");
+
+	if (xwayland->idle_timer)
+		wl_event_source_remove(xwayland->idle_timer);
+	pool_finish(&xwayland->server->pools.x11_windows);
+	free(xwayland);
+}